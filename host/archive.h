@@ -0,0 +1,632 @@
+// archive.h
+//
+// Columnar archive of the records of a log, for keeping them long term. The
+// records are cut into chunks of a time range each, and each chunk stores a
+// column per field, compressed the way Gorilla (Pelkonen et al., VLDB 2015)
+// does for time series:
+//
+//  - times as the delta of the delta to the previous record, mostly one bit
+//    as the records come at a fixed interval
+//  - each temperature as the XOR with the previous value of the sensor,
+//    storing only the bits that differ, mostly one bit as the temperature
+//    rarely changes from one record to the next
+//  - the status as runs of the same HEATER_ENABLED, HEATING and SENSOR_ERROR
+//    bits; KEYFRAME and SAME_INTERVAL only matter for the log encoding
+//
+// A directory at the end holds the time range, the number of heating records
+// and the min and max of each sensor of every chunk, so a scan skips the
+// chunks a time window or a threshold rules out without decoding them.
+//
+// Archive file, little endian:
+//   "TEMPARC", version (uint8_t), numSensors (uint8_t), format version of the
+//   log (uint8_t), reserved (uint16_t), start timestamp of the log (uint32_t)
+// the chunks, each the columns one after the other, each a byte size
+// (uint32_t) and its bits, most significant first:
+//   times, status runs, numSensors temperatures
+// the directory, an entry per chunk:
+//   offset (uint64_t), records (uint32_t), first and last time (int64_t, see
+//   toEpoch()), heating records (uint32_t), numSensors times min and max
+//   (int16_t, quarter degrees; min > max for a sensor without readings)
+// and the footer: offset of the directory (uint64_t), chunks (uint32_t),
+// "TARC".
+//
+// Bits of the time column, per record from the second on, for the zig-zag
+// encoded delta of delta d:
+//   0                      d == 0
+//   10, 7 bits             d < 2^7
+//   110, 9 bits            d < 2^9
+//   1110, 12 bits          d < 2^12
+//   1111, 64 bits          else
+// The delta of the first record is to the first time of the directory entry,
+// and the delta before it 0.
+//
+// Bits of a temperature column, the value as a double, NaN without a reading:
+// the first value in 64 bits, then per record x, the XOR with the previous:
+//   0                      x == 0
+//   10, bits               the bits of x fit the window of the last 11
+//   11, 6 bits leading zeros, 6 bits bits - 1, bits
+//
+// The status column holds runs as pairs of the status bits (uint8_t) and the
+// length of the run (varint).
+#ifndef ARCHIVE_H
+#define ARCHIVE_H
+
+#include "templog.h"
+#include "timeindex.h"
+
+namespace templog {
+
+// Writes bits most significant first
+class BitWriter {
+public:
+  void put(uint64_t bits, unsigned n) {
+    while (n) {
+      unsigned take = std::min(n, 8 - fill);
+      cur = uint8_t(cur << take) |
+            uint8_t((bits >> (n - take)) & ((1u << take) - 1));
+      fill += take;
+      n -= take;
+      if (fill == 8) {
+        out.push_back(cur);
+        cur = 0;
+        fill = 0;
+      }
+    }
+  }
+  // The bits, the last byte padded with zeros
+  std::vector<uint8_t> &finish() {
+    if (fill)
+      out.push_back(uint8_t(cur << (8 - fill)));
+    cur = 0;
+    fill = 0;
+    return out;
+  }
+  void clear() { out.clear(); }
+
+private:
+  std::vector<uint8_t> out;
+  uint8_t cur = 0;
+  unsigned fill = 0;
+};
+
+class BitReader {
+public:
+  BitReader(const uint8_t *p, size_t size) : p(p), bits(size * 8) {}
+
+  uint64_t get(unsigned n) {
+    if (n == 0)
+      return 0;
+    // Most reads fit in the 8 bytes from the current one
+    size_t byte = pos >> 3;
+    unsigned at = pos & 7;
+    if (byte + 8 <= bits / 8 && n <= 64 - at) {
+      uint64_t v = __builtin_bswap64(load<uint64_t>(p + byte)) << at;
+      pos += n;
+      return v >> (64 - n);
+    }
+    uint64_t v = 0;
+    while (n) {
+      if (pos >= bits) {
+        overrun = true;
+        return 0;
+      }
+      at = pos & 7;
+      unsigned take = std::min(n, 8 - at);
+      v = v << take | (p[pos >> 3] >> (8 - at - take) & ((1u << take) - 1));
+      pos += take;
+      n -= take;
+    }
+    return v;
+  }
+  bool bit() { return get(1); }
+  // Leading ones, at most max
+  unsigned ones(unsigned max) {
+    unsigned n = 0;
+    while (n < max && bit())
+      n++;
+    return n;
+  }
+  // Read past the end
+  bool failed() const { return overrun; }
+
+private:
+  const uint8_t *p;
+  size_t bits;
+  size_t pos = 0;
+  bool overrun = false;
+};
+
+// A chunk, decoded
+struct ArchiveChunk {
+  std::vector<int64_t> times;
+  std::vector<uint8_t> status;
+  std::vector<double> temperatures; // sensor by sensor, s * records + i
+};
+
+// A record of a decoded chunk, with the accessors of a Cursor
+class ArchiveRecord {
+public:
+  ArchiveRecord(const ArchiveChunk &c, uint8_t numSensors, size_t i)
+      : c(&c), n(numSensors), i(i) {}
+  int64_t time() const { return c->times[i]; }
+  uint8_t status() const { return c->status[i]; }
+  uint8_t numSensors() const { return n; }
+  double temperature(uint8_t s) const {
+    return c->temperatures[s * c->times.size() + i];
+  }
+
+private:
+  const ArchiveChunk *c;
+  uint8_t n;
+  size_t i;
+};
+
+class Archive {
+public:
+  static const uint8_t VERSION = 1;
+  static const size_t HEADER_SIZE = 16;
+  static const size_t FOOTER_SIZE = 16;
+
+  // A directory entry
+  struct Chunk {
+    uint64_t offset;
+    uint32_t records;
+    int64_t first;
+    int64_t last;
+    uint32_t heating;
+    // records does not fit in the bytes of the chunk, decode() fails
+    bool damaged;
+  };
+
+  // Map and validate path. error() tells why it failed.
+  bool open(const std::string &path) {
+    error_.clear();
+    chunks.clear();
+    min.clear();
+    max.clear();
+    records_ = 0;
+    if (!map.open(path, error_))
+      return false;
+    const uint8_t *p = map.data();
+    size_t size = map.size();
+    if (size < HEADER_SIZE + FOOTER_SIZE || memcmp(p, "TEMPARC", 7) != 0 ||
+        memcmp(p + size - 4, "TARC", 4) != 0)
+      return fail("not an archive");
+    if (p[7] != VERSION)
+      return fail("unsupported archive version " + std::to_string(p[7]));
+    numSensors_ = p[8];
+    logVersion_ = p[9];
+    start_ = load<uint32_t>(p + 12);
+    uint64_t dir = load<uint64_t>(p + size - FOOTER_SIZE);
+    uint32_t n = load<uint32_t>(p + size - FOOTER_SIZE + 8);
+    // No sums of the footer's numbers, which could wrap around
+    if (n > (size - HEADER_SIZE - FOOTER_SIZE) / entrySize() ||
+        dir != size - FOOTER_SIZE - uint64_t(n) * entrySize())
+      return fail("invalid directory");
+    for (uint32_t i = 0; i < n; i++) {
+      const uint8_t *e = p + dir + i * entrySize();
+      Chunk c = {load<uint64_t>(e),      load<uint32_t>(e + 8),
+                 load<int64_t>(e + 12),  load<int64_t>(e + 20),
+                 load<uint32_t>(e + 28), false};
+      if (c.offset < (i ? chunks.back().offset : HEADER_SIZE) || c.offset > dir)
+        return fail("invalid directory");
+      chunks.push_back(c);
+      for (uint8_t s = 0; s < numSensors_; s++) {
+        min.push_back(load<int16_t>(e + 32 + 4 * s));
+        max.push_back(load<int16_t>(e + 34 + 4 * s));
+      }
+    }
+    end = dir;
+    // A record takes at least a bit of the time column and of each
+    // temperature column. A damaged count would otherwise make decode()
+    // allocate for records that are not there.
+    for (size_t i = 0; i < chunks.size(); i++) {
+      Chunk &c = chunks[i];
+      uint64_t bytes = (i + 1 < n ? chunks[i + 1].offset : end) - c.offset;
+      c.damaged = uint64_t(c.records) * (1 + numSensors_) > bytes * 8;
+      if (!c.damaged)
+        records_ += c.records;
+    }
+    return true;
+  }
+
+  const std::string &error() const { return error_; }
+  uint8_t numSensors() const { return numSensors_; }
+  uint8_t logVersion() const { return logVersion_; }
+  uint32_t start() const { return start_; }
+  // Of the chunks that are not damaged
+  uint64_t records() const { return records_; }
+  size_t size() const { return map.size(); }
+  size_t chunkCount() const { return chunks.size(); }
+  const Chunk &chunk(size_t i) const { return chunks[i]; }
+
+  // Decode chunk i. Fails if it is damaged.
+  bool decode(size_t i, ArchiveChunk &out) const {
+    const Chunk &c = chunks[i];
+    size_t next = i + 1 < chunks.size() ? chunks[i + 1].offset : end;
+    if (c.damaged || c.offset > next || next > end)
+      return false;
+    const uint8_t *p = map.data() + c.offset;
+    const uint8_t *stop = map.data() + next;
+    out.times.resize(c.records);
+    out.status.resize(c.records);
+    out.temperatures.resize(size_t(c.records) * numSensors_);
+    const uint8_t *col;
+    size_t size;
+    if (!column(p, stop, col, size) ||
+        !decodeTimes(col, size, c.first, out.times.data(), c.records) ||
+        !column(p, stop, col, size) ||
+        !decodeStatus(col, size, out.status.data(), c.records))
+      return false;
+    for (uint8_t s = 0; s < numSensors_; s++) {
+      if (!column(p, stop, col, size) ||
+          !decodeValues(col, size,
+                        out.temperatures.data() + size_t(s) * c.records,
+                        c.records))
+        return false;
+    }
+    return true;
+  }
+
+  // Call fn(record) for each record from time from to to, inclusive, that
+  // passes the thresholds, an ArchiveRecord. Returns the number of chunks
+  // decoded; skipped counts those that the thresholds ruled out, damaged
+  // those that failed to decode.
+  template <class Fn>
+  size_t query(int64_t from, int64_t to,
+               const std::vector<Threshold> &thresholds, Fn &&fn,
+               size_t *skipped = nullptr, size_t *damaged = nullptr) const {
+    size_t decoded = 0;
+    if (skipped)
+      *skipped = 0;
+    if (damaged)
+      *damaged = 0;
+    ArchiveChunk chunk;
+    for (size_t i = 0; i < chunks.size(); i++) {
+      const Chunk &c = chunks[i];
+      if (c.last < from || c.first > to)
+        continue;
+      bool may = true;
+      for (const Threshold &t : thresholds)
+        may = may && t.mayPass(min[i * numSensors_ + t.sensor],
+                               max[i * numSensors_ + t.sensor]);
+      if (!may) {
+        if (skipped)
+          ++*skipped;
+        continue;
+      }
+      if (!decode(i, chunk)) {
+        if (damaged)
+          ++*damaged;
+        continue;
+      }
+      decoded++;
+      for (size_t k = 0; k < c.records; k++) {
+        ArchiveRecord r(chunk, numSensors_, k);
+        if (r.time() < from || r.time() > to)
+          continue;
+        bool pass = true;
+        for (const Threshold &t : thresholds)
+          pass = pass && t.passes(r);
+        if (pass)
+          fn(r);
+      }
+    }
+    return decoded;
+  }
+
+  size_t entrySize() const { return 32 + 4 * numSensors_; }
+
+  // Column coding, shared with ArchiveWriter. The time arithmetic wraps
+  // around, so any times, even damaged ones, round trip.
+  static void encodeTimes(const int64_t *t, size_t n, int64_t first,
+                          BitWriter &w) {
+    uint64_t prev = first, delta = 0;
+    for (size_t i = 0; i < n; i++) {
+      uint64_t d = uint64_t(t[i]) - prev;
+      uint64_t dod = d - delta;
+      uint64_t z = (dod << 1) ^ uint64_t(int64_t(dod) >> 63);
+      if (z == 0)
+        w.put(0, 1);
+      else if (z < 1 << 7)
+        w.put(0x2 << 7 | z, 9);
+      else if (z < 1 << 9)
+        w.put(0x6 << 9 | z, 12);
+      else if (z < 1 << 12)
+        w.put(0xE << 12 | z, 16);
+      else {
+        w.put(0xF, 4);
+        w.put(z, 64);
+      }
+      prev = t[i];
+      delta = d;
+    }
+  }
+
+  static bool decodeTimes(const uint8_t *p, size_t size, int64_t first,
+                          int64_t *t, size_t n) {
+    static const unsigned width[] = {0, 7, 9, 12, 64};
+    BitReader r(p, size);
+    uint64_t prev = first, delta = 0;
+    for (size_t i = 0; i < n; i++) {
+      uint64_t z = r.get(width[r.ones(4)]);
+      delta += (z >> 1) ^ -(z & 1);
+      t[i] = int64_t(prev += delta);
+    }
+    return !r.failed();
+  }
+
+  static void encodeStatus(const uint8_t *s, size_t n,
+                           std::vector<uint8_t> &out) {
+    for (size_t i = 0; i < n;) {
+      size_t run = 1;
+      while (i + run < n && s[i + run] == s[i])
+        run++;
+      out.push_back(s[i]);
+      for (uint64_t v = run; ; v >>= 7) {
+        out.push_back(uint8_t(v & 0x7F) | (v >= 0x80 ? 0x80 : 0));
+        if (v < 0x80)
+          break;
+      }
+      i += run;
+    }
+  }
+
+  static bool decodeStatus(const uint8_t *p, size_t size, uint8_t *s,
+                           size_t n) {
+    const uint8_t *end = p + size;
+    for (size_t i = 0; i < n;) {
+      if (p >= end)
+        return false;
+      uint8_t value = *p++ | RECORD;
+      uint64_t run = 0;
+      for (int shift = 0; ; shift += 7) {
+        if (p >= end || shift > 56)
+          return false;
+        run |= uint64_t(*p & 0x7F) << shift;
+        if (!(*p++ & 0x80))
+          break;
+      }
+      if (run == 0 || run > n - i)
+        return false;
+      std::fill(s + i, s + i + run, value);
+      i += run;
+    }
+    return true;
+  }
+
+  static void encodeValues(const double *v, size_t n, BitWriter &w) {
+    uint64_t prev = 0;
+    int leading = -1, trailing = 0;
+    for (size_t i = 0; i < n; i++) {
+      uint64_t bits = valueBits(v[i]);
+      if (i == 0) {
+        w.put(bits, 64);
+      } else if (uint64_t x = bits ^ prev; x == 0) {
+        w.put(0, 1);
+      } else {
+        int lz = __builtin_clzll(x), tz = __builtin_ctzll(x);
+        if (leading >= 0 && lz >= leading && tz >= trailing) {
+          w.put(0x2, 2);
+          w.put(x >> trailing, 64 - leading - trailing);
+        } else {
+          leading = lz;
+          trailing = tz;
+          w.put(0x3, 2);
+          w.put(leading, 6);
+          w.put(63 - leading - trailing, 6);
+          w.put(x >> trailing, 64 - leading - trailing);
+        }
+      }
+      prev = bits;
+    }
+  }
+
+  static bool decodeValues(const uint8_t *p, size_t size, double *v,
+                           size_t n) {
+    BitReader r(p, size);
+    uint64_t bits = 0;
+    unsigned leading = 0, trailing = 0;
+    for (size_t i = 0; i < n; i++) {
+      if (i == 0) {
+        bits = r.get(64);
+      } else if (r.bit()) {
+        if (r.bit()) {
+          leading = unsigned(r.get(6));
+          unsigned width = unsigned(r.get(6)) + 1;
+          if (leading + width > 64)
+            return false;
+          trailing = 64 - leading - width;
+        }
+        bits ^= r.get(64 - leading - trailing) << trailing;
+      }
+      memcpy(&v[i], &bits, sizeof(bits));
+    }
+    return !r.failed();
+  }
+
+private:
+  std::string error_;
+  MappedFile map;
+  uint8_t numSensors_ = 0;
+  uint8_t logVersion_ = 0;
+  uint32_t start_ = 0;
+  uint64_t records_ = 0;
+  uint64_t end = 0; // of the chunks
+  std::vector<Chunk> chunks;
+  std::vector<int16_t> min; // numSensors per chunk
+  std::vector<int16_t> max;
+
+  bool fail(const std::string &what) {
+    error_ = what;
+    return false;
+  }
+
+  // The next column of a chunk
+  static bool column(const uint8_t *&p, const uint8_t *stop,
+                     const uint8_t *&col, size_t &size) {
+    if (stop - p < 4)
+      return false;
+    size = load<uint32_t>(p);
+    if (size_t(stop - p - 4) < size)
+      return false;
+    col = p + 4;
+    p += 4 + size;
+    return true;
+  }
+
+  // All NaN the same, so a sensor without readings costs a bit per record
+  static uint64_t valueBits(double v) {
+    if (std::isnan(v))
+      v = NAN;
+    uint64_t bits;
+    memcpy(&bits, &v, sizeof(bits));
+    return bits;
+  }
+};
+
+// Writes an archive, a chunk at a time
+class ArchiveWriter {
+public:
+  static const uint32_t CHUNK_RECORDS = 8192;
+  static const int64_t CHUNK_SECONDS = 86400;
+
+  ~ArchiveWriter() {
+    if (out)
+      fclose(out);
+  }
+
+  // Create path for the records of a log. A chunk is cut at chunkRecords
+  // records or after chunkSeconds, whichever comes first.
+  bool open(const std::string &path, const Header &log,
+            uint32_t chunkRecords = CHUNK_RECORDS,
+            int64_t chunkSeconds = CHUNK_SECONDS) {
+    numSensors = log.numSensors;
+    this->chunkRecords = chunkRecords ? chunkRecords : 1;
+    this->chunkSeconds = chunkSeconds;
+    temps.resize(numSensors);
+    if (!(out = fopen(path.c_str(), "wb")))
+      return fail("cannot create " + path);
+    uint8_t h[Archive::HEADER_SIZE] = {'T', 'E', 'M', 'P', 'A', 'R', 'C',
+                                       Archive::VERSION, numSensors,
+                                       log.version};
+    memcpy(h + 12, &log.start, sizeof(log.start));
+    return write(h, sizeof(h));
+  }
+
+  // Add a record, with the accessors of a Cursor
+  template <class Record> bool add(const Record &r) {
+    if (!times.empty() && (times.size() >= chunkRecords ||
+                           r.time() - times.front() >= chunkSeconds ||
+                           r.time() < times.front()) &&
+        !flush())
+      return false;
+    times.push_back(r.time());
+    status.push_back(r.status() & (HEATER_ENABLED | HEATING | SENSOR_ERROR));
+    for (uint8_t s = 0; s < numSensors; s++)
+      temps[s].push_back(s < r.numSensors() ? r.temperature(s) : NAN);
+    return true;
+  }
+
+  // Write the last chunk, the directory and the footer, and close the file
+  bool close() {
+    bool ok = flush();
+    uint64_t dirOffset = offset;
+    for (size_t i = 0; ok && i < dir.size(); i += entrySize())
+      ok = write(&dir[i], entrySize());
+    uint32_t n = uint32_t(dir.size() / entrySize());
+    uint8_t footer[Archive::FOOTER_SIZE] = {0};
+    memcpy(footer, &dirOffset, sizeof(dirOffset));
+    memcpy(footer + 8, &n, sizeof(n));
+    memcpy(footer + 12, "TARC", 4);
+    ok = ok && write(footer, sizeof(footer));
+    if (out && fclose(out) != 0 && ok)
+      ok = fail("cannot write");
+    out = nullptr;
+    return ok;
+  }
+
+  const std::string &error() const { return error_; }
+  uint64_t bytes() const { return offset; }
+
+private:
+  FILE *out = nullptr;
+  std::string error_;
+  uint8_t numSensors = 0;
+  uint32_t chunkRecords = CHUNK_RECORDS;
+  int64_t chunkSeconds = CHUNK_SECONDS;
+  uint64_t offset = 0;
+  // The chunk being filled
+  std::vector<int64_t> times;
+  std::vector<uint8_t> status;
+  std::vector<std::vector<double>> temps;
+  std::vector<uint8_t> dir;
+  BitWriter bits;
+
+  size_t entrySize() const { return 32 + 4 * size_t(numSensors); }
+
+  bool fail(const std::string &what) {
+    error_ = what + ": " + strerror(errno);
+    return false;
+  }
+
+  bool write(const void *p, size_t n) {
+    if (fwrite(p, 1, n, out) != n)
+      return fail("cannot write");
+    offset += n;
+    return true;
+  }
+
+  bool writeColumn(const std::vector<uint8_t> &col) {
+    uint32_t size = uint32_t(col.size());
+    return write(&size, sizeof(size)) && write(col.data(), col.size());
+  }
+
+  bool flush() {
+    if (times.empty())
+      return true;
+    uint32_t n = uint32_t(times.size());
+    std::vector<uint8_t> e(entrySize());
+    uint32_t heating = uint32_t(std::count_if(
+        status.begin(), status.end(), [](uint8_t s) { return s & HEATING; }));
+    memcpy(&e[0], &offset, 8);
+    memcpy(&e[8], &n, 4);
+    memcpy(&e[12], &times.front(), 8);
+    memcpy(&e[20], &*std::max_element(times.begin(), times.end()), 8);
+    memcpy(&e[28], &heating, 4);
+    for (uint8_t s = 0; s < numSensors; s++) {
+      // Rounded outwards, so the range holds all values of the chunk
+      int16_t mn = 32767, mx = NO_TEMPERATURE;
+      for (double t : temps[s]) {
+        if (!std::isfinite(t) || t * 4 <= NO_TEMPERATURE || t * 4 >= 32767)
+          continue;
+        mn = std::min(mn, int16_t(std::floor(t * 4)));
+        mx = std::max(mx, int16_t(std::ceil(t * 4)));
+      }
+      memcpy(&e[32 + 4 * s], &mn, 2);
+      memcpy(&e[34 + 4 * s], &mx, 2);
+    }
+    dir.insert(dir.end(), e.begin(), e.end());
+
+    bits.clear();
+    Archive::encodeTimes(times.data(), n, times.front(), bits);
+    bool ok = writeColumn(bits.finish());
+    std::vector<uint8_t> runs;
+    Archive::encodeStatus(status.data(), n, runs);
+    ok = ok && writeColumn(runs);
+    for (uint8_t s = 0; ok && s < numSensors; s++) {
+      bits.clear();
+      Archive::encodeValues(temps[s].data(), n, bits);
+      ok = writeColumn(bits.finish());
+    }
+    times.clear();
+    status.clear();
+    for (std::vector<double> &t : temps)
+      t.clear();
+    return ok;
+  }
+};
+
+} // namespace templog
+
+#endif
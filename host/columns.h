@@ -0,0 +1,251 @@
+// columns.h
+//
+// Bulk kernels that turn version 1 records into columns: gather splits the
+// fixed size records (numSensors floats, the heater bool and the packed
+// timestamp; 9 bytes with one sensor) into a column per field, and
+// decodeTimes converts a column of packed RTC timestamps to seconds since
+// 1970.
+//
+// Each kernel has a scalar version and x86 versions, picked at run time for
+// the CPU: AVX2 and SSE4.1 for decodeTimes, AVX2 for gather, as SSE has no
+// gather instruction. All versions give the same results.
+#ifndef COLUMNS_H
+#define COLUMNS_H
+
+#include "templog.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define TEMPLOG_X86 1
+#else
+#define TEMPLOG_X86 0
+#endif
+
+namespace templog {
+namespace columns {
+
+enum Isa { SCALAR, SSE41, AVX2 };
+
+inline const char *isaName(Isa isa) {
+  static const char *names[] = {"scalar", "sse4.1", "avx2"};
+  return names[isa];
+}
+
+// The best the CPU supports
+inline Isa bestIsa() {
+#if TEMPLOG_X86
+  if (__builtin_cpu_supports("avx2"))
+    return AVX2;
+  if (__builtin_cpu_supports("sse4.1"))
+    return SSE41;
+#endif
+  return SCALAR;
+}
+
+// decodeTimes counts days from 1996-03-01, so that a year starts after the
+// leap day and every fourth year from there is a leap year: true from 1996 to
+// 2095, which covers the 2000 - 2063 of a packed timestamp. The day of the
+// year since March is (153 * month since March + 2) / 5 + day - 1. The
+// seconds fit in 32 bits until 2106.
+const uint32_t DAYS_1970_TO_1996_03_01 = 9556;
+
+inline uint32_t decodeTime(uint32_t t) {
+  uint32_t year = t >> 26, month = t >> 22 & 0x0F, day = t >> 17 & 0x1F;
+  uint32_t y = year + 4 - (month <= 2);   // years since 1996
+  uint32_t mp = month > 2 ? month - 3 : month + 9;
+  uint32_t days = DAYS_1970_TO_1996_03_01 + 365 * y + y / 4 +
+                  (153 * mp + 2) / 5 + day - 1;
+  return days * 86400 + (t >> 12 & 0x1F) * 3600 + (t >> 6 & 0x3F) * 60 +
+         (t & 0x3F);
+}
+
+inline void decodeTimesScalar(const uint32_t *packed, int64_t *out, size_t n) {
+  for (size_t i = 0; i < n; i++)
+    out[i] = decodeTime(packed[i]);
+}
+
+#if TEMPLOG_X86
+// x / 5 for 0 <= x < 2^14, with a multiply and a shift
+#define TEMPLOG_DIV5(mul, srli, x) srli(mul(x, c5), 16)
+
+__attribute__((target("sse4.1"))) inline void
+decodeTimesSse41(const uint32_t *packed, int64_t *out, size_t n) {
+  const __m128i m4 = _mm_set1_epi32(0x0F), m5 = _mm_set1_epi32(0x1F),
+                m6 = _mm_set1_epi32(0x3F), two = _mm_set1_epi32(2),
+                three = _mm_set1_epi32(3), four = _mm_set1_epi32(4),
+                twelve = _mm_set1_epi32(12), c5 = _mm_set1_epi32(13108),
+                c365 = _mm_set1_epi32(365), c153 = _mm_set1_epi32(153),
+                c86400 = _mm_set1_epi32(86400), c3600 = _mm_set1_epi32(3600),
+                c60 = _mm_set1_epi32(60),
+                base = _mm_set1_epi32(DAYS_1970_TO_1996_03_01 - 1);
+  size_t i = 0;
+  for (; i + 4 <= n; i += 4) {
+    __m128i t = _mm_loadu_si128(reinterpret_cast<const __m128i *>(packed + i));
+    __m128i year = _mm_srli_epi32(t, 26);
+    __m128i month = _mm_and_si128(_mm_srli_epi32(t, 22), m4);
+    __m128i day = _mm_and_si128(_mm_srli_epi32(t, 17), m5);
+    // -1 for January and February, which count to the year before
+    __m128i early = _mm_cmpgt_epi32(three, month);
+    __m128i y4 = _mm_add_epi32(_mm_add_epi32(year, early), four);
+    __m128i mp = _mm_add_epi32(_mm_sub_epi32(month, three),
+                               _mm_and_si128(early, twelve));
+    __m128i days = _mm_add_epi32(_mm_mullo_epi32(y4, c365),
+                                 _mm_srli_epi32(y4, 2));
+    __m128i doy = TEMPLOG_DIV5(_mm_mullo_epi32, _mm_srli_epi32,
+                               _mm_add_epi32(_mm_mullo_epi32(mp, c153), two));
+    days = _mm_add_epi32(days, _mm_add_epi32(doy, day));
+    days = _mm_add_epi32(days, base);
+    __m128i s = _mm_mullo_epi32(days, c86400);
+    s = _mm_add_epi32(
+        s, _mm_mullo_epi32(_mm_and_si128(_mm_srli_epi32(t, 12), m5), c3600));
+    s = _mm_add_epi32(
+        s, _mm_mullo_epi32(_mm_and_si128(_mm_srli_epi32(t, 6), m6), c60));
+    s = _mm_add_epi32(s, _mm_and_si128(t, m6));
+    _mm_storeu_si128(reinterpret_cast<__m128i *>(out + i),
+                     _mm_cvtepu32_epi64(s));
+    _mm_storeu_si128(reinterpret_cast<__m128i *>(out + i + 2),
+                     _mm_cvtepu32_epi64(_mm_srli_si128(s, 8)));
+  }
+  decodeTimesScalar(packed + i, out + i, n - i);
+}
+
+__attribute__((target("avx2"))) inline void
+decodeTimesAvx2(const uint32_t *packed, int64_t *out, size_t n) {
+  const __m256i m4 = _mm256_set1_epi32(0x0F), m5 = _mm256_set1_epi32(0x1F),
+                m6 = _mm256_set1_epi32(0x3F), two = _mm256_set1_epi32(2),
+                three = _mm256_set1_epi32(3), four = _mm256_set1_epi32(4),
+                twelve = _mm256_set1_epi32(12),
+                c5 = _mm256_set1_epi32(13108),
+                c365 = _mm256_set1_epi32(365), c153 = _mm256_set1_epi32(153),
+                c86400 = _mm256_set1_epi32(86400),
+                c3600 = _mm256_set1_epi32(3600), c60 = _mm256_set1_epi32(60),
+                base = _mm256_set1_epi32(DAYS_1970_TO_1996_03_01 - 1);
+  size_t i = 0;
+  for (; i + 8 <= n; i += 8) {
+    __m256i t =
+        _mm256_loadu_si256(reinterpret_cast<const __m256i *>(packed + i));
+    __m256i year = _mm256_srli_epi32(t, 26);
+    __m256i month = _mm256_and_si256(_mm256_srli_epi32(t, 22), m4);
+    __m256i day = _mm256_and_si256(_mm256_srli_epi32(t, 17), m5);
+    // -1 for January and February, which count to the year before
+    __m256i early = _mm256_cmpgt_epi32(three, month);
+    __m256i y4 = _mm256_add_epi32(_mm256_add_epi32(year, early), four);
+    __m256i mp = _mm256_add_epi32(_mm256_sub_epi32(month, three),
+                                  _mm256_and_si256(early, twelve));
+    __m256i days = _mm256_add_epi32(_mm256_mullo_epi32(y4, c365),
+                                    _mm256_srli_epi32(y4, 2));
+    __m256i doy = TEMPLOG_DIV5(
+        _mm256_mullo_epi32, _mm256_srli_epi32,
+        _mm256_add_epi32(_mm256_mullo_epi32(mp, c153), two));
+    days = _mm256_add_epi32(days, _mm256_add_epi32(doy, day));
+    days = _mm256_add_epi32(days, base);
+    __m256i s = _mm256_mullo_epi32(days, c86400);
+    s = _mm256_add_epi32(
+        s, _mm256_mullo_epi32(
+               _mm256_and_si256(_mm256_srli_epi32(t, 12), m5), c3600));
+    s = _mm256_add_epi32(
+        s, _mm256_mullo_epi32(_mm256_and_si256(_mm256_srli_epi32(t, 6), m6),
+                              c60));
+    s = _mm256_add_epi32(s, _mm256_and_si256(t, m6));
+    _mm256_storeu_si256(reinterpret_cast<__m256i *>(out + i),
+                        _mm256_cvtepu32_epi64(_mm256_castsi256_si128(s)));
+    _mm256_storeu_si256(reinterpret_cast<__m256i *>(out + i + 4),
+                        _mm256_cvtepu32_epi64(_mm256_extracti128_si256(s, 1)));
+  }
+  decodeTimesScalar(packed + i, out + i, n - i);
+}
+#undef TEMPLOG_DIV5
+#endif // TEMPLOG_X86
+
+// Seconds since 1970 of n packed timestamps, as toEpoch(). The timestamps
+// have to be valid, as the RTC writes them.
+inline void decodeTimes(const uint32_t *packed, int64_t *out, size_t n,
+                        Isa isa = bestIsa()) {
+#if TEMPLOG_X86
+  if (isa == AVX2)
+    return decodeTimesAvx2(packed, out, n);
+  if (isa == SSE41)
+    return decodeTimesSse41(packed, out, n);
+#endif
+  (void)isa;
+  decodeTimesScalar(packed, out, n);
+}
+
+// Columns of version 1 records with 4 byte temperatures
+struct Columns {
+  std::vector<float> temperatures; // numSensors columns, one after the other
+  std::vector<uint8_t> heater;
+  std::vector<uint32_t> timestamps;
+};
+
+inline void gatherScalar(const FixedRecords &r, uint8_t numSensors,
+                         size_t from, size_t to, Columns &c) {
+  size_t n = r.size();
+  const uint8_t *p = r.data() + from * r.stride();
+  for (size_t i = from; i < to; i++, p += r.stride()) {
+    for (uint8_t s = 0; s < numSensors; s++)
+      c.temperatures[s * n + i] = load<float>(p + 4 * s);
+    c.heater[i] = p[4 * numSensors] != 0;
+    c.timestamps[i] = load<uint32_t>(p + 4 * numSensors + 1);
+  }
+}
+
+#if TEMPLOG_X86
+__attribute__((target("avx2"))) inline void
+gatherAvx2(const FixedRecords &r, uint8_t numSensors, Columns &c) {
+  size_t n = r.size();
+  int stride = int(r.stride());
+  // A 4 byte gather of the heater byte or the timestamp reads up to 3 bytes
+  // past the record; leave the last records to the scalar loop so nothing is
+  // read past the end of the mapping. The offsets are 32 bit.
+  size_t vn = n > 2 ? n - 2 : 0;
+  if (vn > size_t(INT32_MAX) / stride - 8)
+    vn = size_t(INT32_MAX) / stride - 8;
+  const __m256i lanes = _mm256_mullo_epi32(
+      _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7), _mm256_set1_epi32(stride));
+  const __m256i byte = _mm256_set1_epi32(0xFF), zero = _mm256_setzero_si256();
+  const int heaterAt = 4 * numSensors, timeAt = heaterAt + 1;
+  size_t i = 0;
+  for (; i + 8 <= vn; i += 8) {
+    const uint8_t *base = r.data() + i * stride;
+    for (uint8_t s = 0; s < numSensors; s++) {
+      __m256 t = _mm256_i32gather_ps(
+          reinterpret_cast<const float *>(base + 4 * s), lanes, 1);
+      _mm256_storeu_ps(&c.temperatures[s * n + i], t);
+    }
+    __m256i h = _mm256_i32gather_epi32(
+        reinterpret_cast<const int *>(base + heaterAt), lanes, 1);
+    // 0 or 1, one byte each
+    h = _mm256_sub_epi32(zero, _mm256_cmpgt_epi32(_mm256_and_si256(h, byte),
+                                                   zero));
+    __m128i h16 = _mm_packus_epi32(_mm256_castsi256_si128(h),
+                                   _mm256_extracti128_si256(h, 1));
+    _mm_storel_epi64(reinterpret_cast<__m128i *>(&c.heater[i]),
+                     _mm_packus_epi16(h16, h16));
+    __m256i ts = _mm256_i32gather_epi32(
+        reinterpret_cast<const int *>(base + timeAt), lanes, 1);
+    _mm256_storeu_si256(reinterpret_cast<__m256i *>(&c.timestamps[i]), ts);
+  }
+  gatherScalar(r, numSensors, i, n, c);
+}
+#endif // TEMPLOG_X86
+
+// Split version 1 records with 4 byte temperatures into columns
+inline void gather(const FixedRecords &r, uint8_t numSensors, Columns &c,
+                   Isa isa = bestIsa()) {
+  size_t n = r.size();
+  c.temperatures.resize(n * numSensors);
+  c.heater.resize(n);
+  c.timestamps.resize(n);
+#if TEMPLOG_X86
+  if (isa == AVX2)
+    return gatherAvx2(r, numSensors, c);
+#endif
+  (void)isa;
+  gatherScalar(r, numSensors, 0, n, c);
+}
+
+} // namespace columns
+} // namespace templog
+
+#endif
@@ -0,0 +1,298 @@
+// control.h
+//
+// How well HeaterControl holds the temperature, from the records of a log
+// stream in a single pass.
+//
+// A session is a run of records with HEATER_ENABLED, ended by disabling the
+// heater or by a gap of more than GAP seconds. The log does not hold the
+// target temperature, so the sessions are split into setpoint epochs by the
+// switching of the heater instead: with hysteresis the heater switches on at
+// target - hysteresis and off at target + hysteresis, and the target of an
+// epoch is the midpoint of the two. A switch more than step degrees from
+// where the epoch switched before starts a new epoch. A switch that came early
+// (on higher, or off lower, than before) marks the change of the setpoint
+// itself, one that came late (on lower, or off higher) marks a change during
+// the half cycle before it, so that half cycle goes to the new epoch. The
+// first switches of a session have nothing to compare with, so a setpoint
+// changed before the heater settled once is taken as a threshold.
+//
+// For each epoch ControlStats has:
+//   overshoot, undershoot  the max above and the min below the target, after
+//                          the first half cycle, the approach
+//   settling               the time from the start of the epoch to the
+//                          start of the steady oscillation: the cycles from
+//                          there on, each an on and an off half cycle, peak
+//                          and bottom out within band of each other. -1 if
+//                          the epoch ended before STEADY_CYCLES of them, it
+//                          never settled.
+//   period                 the mean time from one switch on to the next
+//   duty                   the share of the time the heater was on
+//   switches               the switches of the relay, on and off, and the
+//                          switches per hour, a measure of relay wear
+//
+// ControlAnalyzer holds the current epoch and half cycle, whatever the length
+// of the stream.
+#ifndef CONTROL_H
+#define CONTROL_H
+
+#include "templog.h"
+
+namespace templog {
+
+struct ControlStats {
+  uint32_t session; // from 1
+  int64_t start;
+  int64_t end;
+  double target;     // NAN without switching both ways, unless given
+  double overshoot;  // NAN without a half cycle after the approach
+  double undershoot;
+  int64_t settling;  // -1 if it never settled
+  double period;     // NAN with fewer than two switches on
+  int64_t heating;   // seconds the heater was on
+  uint32_t switches;
+
+  int64_t seconds() const { return end - start; }
+  double duty() const { return seconds() ? double(heating) / seconds() : NAN; }
+  double switchesPerHour() const {
+    return seconds() ? switches * 3600.0 / seconds() : NAN;
+  }
+};
+
+struct ControlOptions {
+  uint8_t sensor = 0;  // the sensor the heater is controlled by
+  double target = NAN; // the target, for all epochs, if known
+  double band = 3;     // degrees the peaks and the bottoms of the cycles
+                       // may move and count as settled
+  double step = 3;     // degrees a switch moves to start a new epoch
+};
+
+// Out is called with the const ControlStats & of each epoch
+template <class Out> class ControlAnalyzer {
+public:
+  // Records further apart end the session
+  static const int64_t GAP = 60;
+  // Cycles within band that make the oscillation steady
+  static const uint32_t STEADY_CYCLES = 4;
+
+  ControlAnalyzer(const ControlOptions &options, Out out)
+      : opt(options), out(out) {}
+
+  // Records in order of time, a Cursor or the like
+  template <class Record> void add(const Record &r) {
+    int64_t t = r.time();
+    bool enabled = r.status() & HEATER_ENABLED;
+    // HEATING is left set when the heater is disabled
+    bool heating = enabled && (r.status() & HEATING);
+    double temp = opt.sensor < r.numSensors() ? r.temperature(opt.sensor) : NAN;
+    bool gap = t - last > GAP || t < last;
+    if (inSession && (!enabled || gap)) {
+      // The session lasts until it was disabled, which switches the relay off
+      if (!gap) {
+        if (lastHeating) {
+          half.heating += t - last;
+          epoch.switches++;
+        }
+        last = t;
+      }
+      endSession();
+    }
+    if (!enabled)
+      return;
+    if (!inSession) {
+      inSession = true;
+      session++;
+      startEpoch(t);
+      startHalf(t);
+      if (heating)
+        epoch.switches++;
+    } else {
+      if (lastHeating)
+        half.heating += t - last;
+      if (heating != lastHeating)
+        onSwitch(t, heating, temp);
+    }
+    last = t;
+    lastHeating = heating;
+    if (!std::isnan(temp)) {
+      half.min = std::min(half.min, temp);
+      half.max = std::max(half.max, temp);
+    }
+  }
+
+  // End the stream
+  void finish() {
+    if (inSession)
+      endSession();
+  }
+
+  uint32_t sessions() const { return session; }
+
+private:
+  struct HalfCycle {
+    int64_t start;
+    int64_t end;
+    double min;
+    double max;
+    int64_t heating;
+  };
+
+  // The epoch besides ControlStats
+  struct Epoch {
+    ControlStats stats;
+    int64_t heating;
+    uint32_t switches;
+    double onSum, offSum; // the temperatures at the switches
+    uint32_t ons, offs;
+    int64_t firstOn, lastOn;
+    uint32_t halves; // finished half cycles
+    double max, min; // after the approach
+    HalfCycle prev;  // the last finished half cycle
+    // The cycles since the last one that did not fit within band, the
+    // range of their peaks and of their bottoms
+    int64_t steadyStart;
+    uint32_t steadyCycles;
+    double peakLo, peakHi, bottomLo, bottomHi;
+  };
+
+  ControlOptions opt;
+  Out out;
+  bool inSession = false;
+  uint32_t session = 0;
+  int64_t last = 0;
+  bool lastHeating = false;
+  Epoch epoch;
+  HalfCycle half;
+
+  void startEpoch(int64_t t) {
+    epoch = Epoch();
+    epoch.stats.session = session;
+    epoch.stats.start = t;
+    epoch.max = -INFINITY;
+    epoch.min = INFINITY;
+  }
+
+  void startHalf(int64_t t) { half = {t, t, INFINITY, -INFINITY, 0}; }
+
+  double target() const {
+    if (!std::isnan(opt.target))
+      return opt.target;
+    if (!epoch.ons || !epoch.offs)
+      return NAN;
+    return (epoch.onSum / epoch.ons + epoch.offSum / epoch.offs) / 2;
+  }
+
+  void onSwitch(int64_t t, bool on, double temp) {
+    // Where the epoch switched before; the other way at first
+    double onAt = epoch.ons ? epoch.onSum / epoch.ons : NAN;
+    double offAt = epoch.offs ? epoch.offSum / epoch.offs : NAN;
+    bool early = false, late = false;
+    if (std::isnan(opt.target) && !std::isnan(temp)) {
+      if (on) {
+        early = temp > onAt + opt.step || (!epoch.ons && temp > offAt);
+        late = temp < onAt - opt.step;
+      } else {
+        early = temp < offAt - opt.step || (!epoch.offs && temp < onAt);
+        late = temp > offAt + opt.step;
+      }
+    }
+    half.end = t;
+    if (late) {
+      HalfCycle h = half;
+      emit(h.start);
+      startEpoch(h.start);
+      half = h;
+    }
+    addHalf(half);
+    if (early) {
+      emit(t);
+      startEpoch(t);
+    }
+    epoch.switches++;
+    // An early switch is where the setpoint changed, not a threshold
+    if (!early && !std::isnan(temp)) {
+      if (on) {
+        if (!epoch.ons)
+          epoch.firstOn = t;
+        epoch.lastOn = t;
+        epoch.onSum += temp;
+        epoch.ons++;
+      } else {
+        epoch.offSum += temp;
+        epoch.offs++;
+      }
+    }
+    startHalf(t);
+  }
+
+  // A finished half cycle into the epoch. One cut short by the end of the
+  // session is no cycle of the oscillation.
+  void addHalf(const HalfCycle &h, bool switched = true) {
+    epoch.heating += h.heating;
+    if (epoch.halves++) {
+      epoch.max = std::max(epoch.max, h.max);
+      epoch.min = std::min(epoch.min, h.min);
+      if (switched)
+        addCycle(epoch.prev, h);
+    }
+    epoch.prev = h;
+  }
+
+  // The cycle of two half cycles, on and off or off and on
+  void addCycle(const HalfCycle &a, const HalfCycle &b) {
+    double peak = std::max(a.max, b.max);
+    double bottom = std::min(a.min, b.min);
+    // Without readings
+    if (peak < bottom) {
+      epoch.steadyCycles = 0;
+      return;
+    }
+    if (epoch.steadyCycles) {
+      double peakLo = std::min(epoch.peakLo, peak);
+      double peakHi = std::max(epoch.peakHi, peak);
+      double bottomLo = std::min(epoch.bottomLo, bottom);
+      double bottomHi = std::max(epoch.bottomHi, bottom);
+      if (peakHi - peakLo <= opt.band && bottomHi - bottomLo <= opt.band) {
+        epoch.peakLo = peakLo;
+        epoch.peakHi = peakHi;
+        epoch.bottomLo = bottomLo;
+        epoch.bottomHi = bottomHi;
+        epoch.steadyCycles++;
+        return;
+      }
+    }
+    epoch.steadyStart = a.start;
+    epoch.steadyCycles = 1;
+    epoch.peakLo = epoch.peakHi = peak;
+    epoch.bottomLo = epoch.bottomHi = bottom;
+  }
+
+  void endSession() {
+    half.end = last;
+    addHalf(half, false);
+    emit(last);
+    inSession = false;
+    lastHeating = false;
+  }
+
+  void emit(int64_t end) {
+    ControlStats &s = epoch.stats;
+    s.end = end;
+    s.target = target();
+    bool known = !std::isnan(s.target);
+    s.overshoot = known && epoch.max > -INFINITY ? epoch.max - s.target : NAN;
+    s.undershoot = known && epoch.min < INFINITY ? s.target - epoch.min : NAN;
+    s.settling = epoch.steadyCycles >= STEADY_CYCLES
+                     ? epoch.steadyStart - s.start
+                     : -1;
+    s.period = epoch.ons > 1 ? double(epoch.lastOn - epoch.firstOn) /
+                                   (epoch.ons - 1)
+                             : NAN;
+    s.heating = epoch.heating;
+    s.switches = epoch.switches;
+    out(static_cast<const ControlStats &>(s));
+  }
+};
+
+} // namespace templog
+
+#endif
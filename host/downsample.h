@@ -0,0 +1,235 @@
+// downsample.h
+//
+// Largest-Triangle-Three-Buckets downsampling (Steinarsson, 2013) of the
+// records, for plotting long runs. The time range is cut into buckets of
+// equal length, one per point of the plot, and from each bucket the record
+// is picked, per sensor, that spans the largest triangle with the record
+// picked from the bucket before and the mean of the bucket after. Peaks and
+// dips survive, which taking every nth record or the mean would flatten.
+//
+// Of the records where HEATER_ENABLED or HEATING change, the first and the
+// last of each bucket are kept as well, with the record before each. The
+// heater state is exact where a bucket starts and ends, and a bucket where
+// the heater switched more often shows the first switch and the last. A
+// bucket keeps at most numSensors picks, two steps, the record before each
+// and its last record, before a step of the next, so a run goes to at most
+// points * (numSensors + 5) records and the first one.
+//
+// Lttb is a streaming operator: records go in in order of time, from a
+// Cursor or a Merger, and the picked ones come out in order, a bucket later.
+// It holds two buckets of records, whatever the length of the run.
+#ifndef DOWNSAMPLE_H
+#define DOWNSAMPLE_H
+
+#include "templog.h"
+
+namespace templog {
+
+// A record copied out of a Cursor or the like, with the same accessors
+struct Sample {
+  int64_t time_ = 0;
+  uint8_t status_ = 0;
+  std::vector<double> temps;
+
+  int64_t time() const { return time_; }
+  uint8_t status() const { return status_; }
+  uint8_t numSensors() const { return uint8_t(temps.size()); }
+  double temperature(uint8_t i) const { return temps[i]; }
+};
+
+// Out is called with each picked record, a const Sample &
+template <class Out> class Lttb {
+public:
+  // Downsample the records from time from to to, inclusive, to points
+  // buckets. Records outside the range are dropped.
+  Lttb(uint8_t numSensors, int64_t from, int64_t to, size_t points, Out out)
+      : numSensors(numSensors), from(from), to(to),
+        scale(double(points ? points : 1) / (double(to) - double(from) + 1)),
+        out(out), anchor(numSensors, Point{0, NAN}) {
+    prev.numSensors = cur.numSensors = numSensors;
+    sample.temps.resize(numSensors);
+  }
+
+  template <class Record> void add(const Record &r) {
+    int64_t t = r.time();
+    if (t < from || t > to)
+      return;
+    int64_t index = int64_t((double(t) - double(from)) * scale);
+    if (!cur.empty() && index != cur.index) {
+      keepSteps();
+      if (!prev.empty())
+        pick(prev, mean(cur));
+      std::swap(prev, cur);
+      cur.clear();
+    }
+    cur.index = index;
+    uint8_t status = r.status() & (HEATER_ENABLED | HEATING);
+    if (started && status != lastStatus)
+      (cur.firstStep < 0 ? cur.firstStep : cur.lastStep) = long(cur.size());
+    bool keep = !started;
+    started = true;
+    lastStatus = status;
+    cur.add(r, keep);
+    // The first record is the anchor of the first bucket
+    if (keep && cur.size() == 1 && prev.empty())
+      setAnchor(cur, 0);
+  }
+
+  // Pick from the last buckets and keep the last record
+  void finish() {
+    if (cur.empty())
+      return;
+    keepSteps();
+    if (!prev.empty())
+      pick(prev, mean(cur));
+    last(cur);
+    prev.clear();
+    cur.clear();
+  }
+
+private:
+  struct Point {
+    double t;
+    double y;
+  };
+
+  // The records of a bucket, a column each
+  struct Bucket {
+    uint8_t numSensors = 0;
+    int64_t index = 0;
+    std::vector<int64_t> times;
+    std::vector<uint8_t> status;
+    std::vector<double> temps; // numSensors per record
+    std::vector<bool> keep;
+    // The first and the last heater step, -1 if none
+    long firstStep = -1, lastStep = -1;
+
+    bool empty() const { return times.empty(); }
+    size_t size() const { return times.size(); }
+    double value(size_t i, uint8_t s) const {
+      return temps[i * numSensors + s];
+    }
+    template <class Record> void add(const Record &r, bool k) {
+      times.push_back(r.time());
+      status.push_back(r.status());
+      for (uint8_t s = 0; s < numSensors; s++)
+        temps.push_back(s < r.numSensors() ? r.temperature(s) : NAN);
+      keep.push_back(k);
+    }
+    void clear() {
+      times.clear();
+      status.clear();
+      temps.clear();
+      keep.clear();
+      firstStep = lastStep = -1;
+    }
+  };
+
+  uint8_t numSensors;
+  int64_t from;
+  int64_t to;
+  double scale; // buckets per second
+  Out out;
+  Bucket prev, cur;
+  // The record picked last, per sensor
+  std::vector<Point> anchor;
+  bool started = false;
+  uint8_t lastStatus = 0;
+  Sample sample;
+
+  // Keep the first and the last step of the bucket that is complete, and
+  // the record before each, which is the last of prev for the first record
+  void keepSteps() {
+    for (long step : {cur.firstStep, cur.lastStep}) {
+      if (step < 0)
+        continue;
+      cur.keep[step] = true;
+      (step ? cur.keep[step - 1] : prev.keep.back()) = true;
+    }
+  }
+
+  void setAnchor(const Bucket &b, size_t i) {
+    for (uint8_t s = 0; s < numSensors; s++) {
+      if (!std::isnan(b.value(i, s)))
+        anchor[s] = {double(b.times[i] - from), b.value(i, s)};
+    }
+  }
+
+  // The mean time and value of each sensor of b
+  std::vector<Point> mean(const Bucket &b) const {
+    std::vector<Point> m(numSensors);
+    double t = 0;
+    for (int64_t time : b.times)
+      t += double(time - from);
+    t /= b.size();
+    for (uint8_t s = 0; s < numSensors; s++) {
+      double y = 0;
+      size_t n = 0;
+      for (size_t i = 0; i < b.size(); i++) {
+        if (!std::isnan(b.value(i, s))) {
+          y += b.value(i, s);
+          n++;
+        }
+      }
+      // Without readings, flat from the anchor
+      m[s] = {t, n ? y / n : anchor[s].y};
+    }
+    return m;
+  }
+
+  // Pick the record of each sensor from b, with c the mean of the next
+  // bucket, and send the kept records of b
+  void pick(Bucket &b, const std::vector<Point> &c) {
+    for (uint8_t s = 0; s < numSensors; s++) {
+      const Point &a = anchor[s];
+      double best = -1;
+      size_t picked = 0;
+      for (size_t i = 0; i < b.size(); i++) {
+        double y = b.value(i, s);
+        if (std::isnan(y))
+          continue;
+        double t = double(b.times[i] - from);
+        // Twice the area of the triangle; without an anchor yet, the first
+        double area = std::isnan(a.y) ? 0
+                                      : std::fabs((a.t - c[s].t) * (y - a.y) -
+                                                  (a.t - t) * (c[s].y - a.y));
+        if (area > best) {
+          best = area;
+          picked = i;
+        }
+      }
+      if (best >= 0) {
+        b.keep[picked] = true;
+        anchor[s] = {double(b.times[picked] - from), b.value(picked, s)};
+      }
+    }
+    send(b);
+  }
+
+  // The last bucket: its last record is the end of the line
+  void last(Bucket &b) {
+    b.keep.back() = true;
+    std::vector<Point> c(numSensors);
+    for (uint8_t s = 0; s < numSensors; s++) {
+      double y = b.value(b.size() - 1, s);
+      c[s] = {double(b.times.back() - from), std::isnan(y) ? anchor[s].y : y};
+    }
+    pick(b, c);
+  }
+
+  void send(const Bucket &b) {
+    for (size_t i = 0; i < b.size(); i++) {
+      if (!b.keep[i])
+        continue;
+      sample.time_ = b.times[i];
+      sample.status_ = b.status[i];
+      for (uint8_t s = 0; s < numSensors; s++)
+        sample.temps[s] = b.value(i, s);
+      out(static_cast<const Sample &>(sample));
+    }
+  }
+};
+
+} // namespace templog
+
+#endif
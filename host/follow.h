@@ -0,0 +1,175 @@
+// follow.h
+//
+// Reads a log while it is still being written: by templog telemetry -l, or
+// on a card that is synced now and then. Each poll maps the file again if it
+// changed and decodes from where the last poll left off.
+//
+// The last block of a version 3 log is written again as records are added,
+// and may be cut short or fail its check while it is being written. So a
+// poll starts again at the last block it decoded records from, or the last
+// keyframe of a version 2 log, and skips the records of it already seen. A
+// cut off version 1 record is decoded once it is complete. The work of a
+// poll is the data added since the last one, and a block.
+#ifndef FOLLOW_H
+#define FOLLOW_H
+
+#include "templog.h"
+
+#include <sys/stat.h>
+
+namespace templog {
+
+class Follower {
+public:
+  // Start at the beginning of path
+  bool open(const std::string &path) {
+    path_ = path;
+    size = 0;
+    mtime = {0, 0};
+    resume = 0;
+    seen = 0;
+    if (!f.open(path))
+      return false;
+    header = f.header();
+    return true;
+  }
+
+  // Call fn(cursor) for each record added since the last poll. Returns the
+  // number of records, or -1 if the file is gone; error() tells why. A file
+  // that was replaced or cut is read again from the start, and restarted()
+  // is true until the next poll.
+  template <class Fn> long poll(Fn &&fn) {
+    restarted_ = false;
+    struct stat st;
+    if (stat(path_.c_str(), &st) != 0) {
+      error_ = "cannot stat " + path_ + ": " + strerror(errno);
+      return -1;
+    }
+    if (size_t(st.st_size) == size && st.st_mtim.tv_sec == mtime.tv_sec &&
+        st.st_mtim.tv_nsec == mtime.tv_nsec)
+      return 0;
+    if (!f.open(path_)) {
+      error_ = f.error();
+      return -1;
+    }
+    if (f.size() < size || f.header().start != header.start ||
+        f.header().version != header.version) {
+      resume = 0;
+      seen = 0;
+      restarted_ = true;
+    }
+    header = f.header();
+    size = f.size();
+    mtime = st.st_mtim;
+
+    // Records from resume on, the first seen of them already reported
+    Cursor c(f, resume);
+    size_t at = resume;
+    uint64_t n = 0, index = 0;
+    while (c.next()) {
+      size_t from = restartOffset(c);
+      if (from != at) {
+        at = from;
+        index = 0;
+      }
+      if (at == resume && index < seen) {
+        index++;
+        continue;
+      }
+      index++;
+      fn(static_cast<const Cursor &>(c));
+      n++;
+    }
+    if (at != resume || index > seen) {
+      resume = at;
+      seen = index;
+    }
+    return long(n);
+  }
+
+  const LogFile &file() const { return f; }
+  const std::string &error() const { return error_; }
+  bool restarted() const { return restarted_; }
+
+private:
+  std::string path_;
+  std::string error_;
+  LogFile f;
+  Header header; // of the file when it was last mapped
+  size_t size = 0;
+  struct timespec mtime = {0, 0};
+  size_t resume = 0; // where the next poll starts decoding
+  uint64_t seen = 0; // records from resume on already reported
+  bool restarted_ = false;
+  size_t keyframe = 0;
+
+  // Where decoding can start again to get to the record of c
+  size_t restartOffset(const Cursor &c) {
+    switch (f.header().version) {
+    case 1:
+      return c.recordOffset();
+    case 2:
+      if (c.status() & KEYFRAME)
+        keyframe = c.recordOffset();
+      return keyframe;
+    default:
+      return c.blockOffset();
+    }
+  }
+};
+
+// Running totals of the records seen, for the status line of a live view:
+// the last reading, min, max and mean of each sensor and the share of the
+// time the heater was on
+struct LiveStats {
+  // Records further apart are not counted as heating in between
+  static const int64_t GAP = 60;
+
+  uint64_t records = 0;
+  int64_t first = 0;
+  int64_t last = 0;
+  int64_t heating = 0; // seconds
+  bool wasHeating = false;
+  std::vector<double> current, min, max, sum;
+  std::vector<uint64_t> readings;
+
+  template <class Record> void add(const Record &r) {
+    uint8_t n = r.numSensors();
+    if (current.size() != n) {
+      current.assign(n, NAN);
+      min.assign(n, INFINITY);
+      max.assign(n, -INFINITY);
+      sum.assign(n, 0);
+      readings.assign(n, 0);
+    }
+    int64_t t = r.time();
+    if (!records)
+      first = t;
+    else if (wasHeating && t > last && t - last <= GAP)
+      heating += t - last;
+    records++;
+    last = t;
+    wasHeating = (r.status() & HEATER_ENABLED) && (r.status() & HEATING);
+    for (uint8_t s = 0; s < n; s++) {
+      double v = r.temperature(s);
+      current[s] = v;
+      if (std::isnan(v))
+        continue;
+      min[s] = std::min(min[s], v);
+      max[s] = std::max(max[s], v);
+      sum[s] += v;
+      readings[s]++;
+    }
+  }
+
+  double mean(uint8_t s) const {
+    return readings[s] ? sum[s] / readings[s] : NAN;
+  }
+  double duty() const {
+    return last > first ? double(heating) / (last - first) : 0;
+  }
+};
+
+} // namespace templog
+
+#endif
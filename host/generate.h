@@ -0,0 +1,117 @@
+// generate.h
+//
+// Records of a simulated oven, for logs to test and time the tools with. An
+// element heats the oven, which loses heat to the room, and HeaterControl
+// switches the element with its hysteresis and minimum time between toggles.
+// The heater is enabled for bakes of one to six hours at a target of 40 to
+// 220 degrees, now and then changed during the bake, with idle time between
+// them. Sensor 0 is the one the heater is controlled by; the others lag
+// behind it, further from the element. The readings are noisy and may fail,
+// and the log rounds them to quarter degrees as the MAX6675 does.
+#ifndef GENERATE_H
+#define GENERATE_H
+
+#include "templog.h"
+
+#include <random>
+
+namespace templog {
+
+struct GeneratorOptions {
+  uint8_t numSensors = 1;
+  double noise = 0.25;   // standard deviation of the readings, degrees
+  double hysteresis = 2; // HeaterControl::hysteresis
+  double errors = 0;     // share of readings that fail
+  uint32_t seed = 1;
+};
+
+class Generator {
+public:
+  // HeaterControl::toggleDelay, in seconds
+  static const int64_t TOGGLE_DELAY = 5;
+
+  Generator(const GeneratorOptions &options, int64_t start)
+      : opt(options), rng(options.seed), time(start - 1), oven(20),
+        element(20), sensors(options.numSensors, 20) {
+    scheduleIdle();
+  }
+
+  // The record a second after the last: its time, status and numSensors
+  // temperatures, NaN for a failed reading
+  void next(int64_t &t, uint8_t &status, double *temps) {
+    t = ++time;
+    if (t >= until)
+      enabled ? scheduleIdle() : scheduleBake();
+    else if (enabled && t >= change)
+      changeTarget();
+
+    // A second of the plant. The room follows the time of day.
+    if (t % 60 == 0)
+      room = 20 + 3 * std::sin(2 * M_PI * (t % 86400) / 86400.0);
+    element += (enabled && heating ? 1.5 : 0) - (element - oven) * 0.02;
+    oven += (element - oven) * 0.01 - (oven - room) * 0.003;
+    bool error = false;
+    for (uint8_t s = 0; s < opt.numSensors; s++) {
+      sensors[s] += (oven - 3 * s - sensors[s]) * (s ? 0.05 : 1);
+      bool failed = opt.errors > 0 && uniform(rng) < opt.errors;
+      temps[s] = failed ? NAN : sensors[s] + opt.noise * normal(rng);
+      error |= failed;
+    }
+
+    // HeaterControl::update() on the first sensor. Like the firmware, the
+    // HEATING bit stays as it was while the heater is disabled.
+    double m = temps[0];
+    if (enabled && t - lastToggle >= TOGGLE_DELAY) {
+      if (m < target - opt.hysteresis) {
+        heating = true;
+        lastToggle = t;
+      } else if (m > target + opt.hysteresis) {
+        heating = false;
+        lastToggle = t;
+      }
+    }
+    status = (enabled ? HEATER_ENABLED : 0) | (heating ? HEATING : 0) |
+             (error ? SENSOR_ERROR : 0);
+  }
+
+private:
+  GeneratorOptions opt;
+  std::mt19937 rng;
+  std::normal_distribution<double> normal;
+  std::uniform_real_distribution<double> uniform;
+  int64_t time;
+  double room = 20;
+  double oven, element;
+  std::vector<double> sensors;
+  bool enabled = false;
+  bool heating = false;
+  double target = 0;
+  int64_t lastToggle = INT64_MIN / 2;
+  int64_t until = 0;  // end of the bake or the idle time
+  int64_t change = 0; // next change of the target during a bake
+
+  int64_t between(int64_t lo, int64_t hi) {
+    return lo + int64_t(rng() % uint64_t(hi - lo + 1));
+  }
+
+  void scheduleIdle() {
+    enabled = false;
+    until = time + between(1800, 3 * 3600);
+  }
+
+  void scheduleBake() {
+    enabled = true;
+    target = 40 + 5 * between(0, 36);
+    until = time + between(3600, 6 * 3600);
+    change = time + between(1800, 4 * 3600);
+  }
+
+  void changeTarget() {
+    target = std::min(220.0, std::max(40.0, target + 5 * between(-6, 6)));
+    change = time + between(1800, 4 * 3600);
+  }
+};
+
+} // namespace templog
+
+#endif
@@ -0,0 +1,139 @@
+// pool.h
+//
+// Work-stealing thread pool for the batch commands of templog. Each worker
+// has its own deque of tasks. It runs the newest task of its own deque
+// first, so the chunks a file task queues run on the worker that opened the
+// file, and when that is empty it steals the oldest task of another worker,
+// the one most likely to queue more work.
+#ifndef POOL_H
+#define POOL_H
+
+#include <algorithm>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace templog {
+
+class Pool {
+public:
+  // threads workers, 0 for one per core
+  explicit Pool(unsigned threads = 0) {
+    if (!threads)
+      threads = std::max(1u, std::thread::hardware_concurrency());
+    for (unsigned i = 0; i < threads; i++)
+      queues.emplace_back(new Queue);
+    for (unsigned i = 0; i < threads; i++)
+      workers.emplace_back(&Pool::run, this, i);
+  }
+  ~Pool() {
+    wait();
+    {
+      std::lock_guard<std::mutex> g(lock);
+      stopping = true;
+    }
+    wake.notify_all();
+    for (std::thread &t : workers)
+      t.join();
+  }
+  Pool(const Pool &) = delete;
+  Pool &operator=(const Pool &) = delete;
+
+  unsigned size() const { return unsigned(workers.size()); }
+
+  // Queue a task. From a worker it goes to the worker's own deque, else the
+  // deques take turns.
+  void submit(std::function<void()> task) {
+    size_t q = current == this ? self : next++ % queues.size();
+    // Counted before it is in a deque: another worker may take it and
+    // finish it before this one gets the lock again
+    {
+      std::lock_guard<std::mutex> g(lock);
+      queued++;
+      pending++;
+    }
+    {
+      std::lock_guard<std::mutex> g(queues[q]->lock);
+      queues[q]->tasks.push_back(std::move(task));
+    }
+    wake.notify_one();
+  }
+
+  // Wait until all tasks are done, including those queued by tasks. Not
+  // from a worker.
+  void wait() {
+    std::unique_lock<std::mutex> g(lock);
+    done.wait(g, [this] { return pending == 0; });
+  }
+
+private:
+  struct Queue {
+    std::mutex lock;
+    std::deque<std::function<void()>> tasks;
+  };
+  std::vector<std::unique_ptr<Queue>> queues;
+  std::vector<std::thread> workers;
+  size_t next = 0; // the deque for the next task from outside
+
+  // Counts of tasks in the deques and not finished, and the shutdown flag
+  std::mutex lock;
+  std::condition_variable wake;
+  std::condition_variable done;
+  long queued = 0;
+  size_t pending = 0;
+  bool stopping = false;
+
+  // The pool and index of the worker running on this thread
+  static inline thread_local const Pool *current = nullptr;
+  static inline thread_local size_t self = 0;
+
+  void run(size_t index) {
+    current = this;
+    self = index;
+    std::function<void()> task;
+    while (true) {
+      if (take(task)) {
+        task();
+        task = nullptr;
+        std::lock_guard<std::mutex> g(lock);
+        if (--pending == 0)
+          done.notify_all();
+        continue;
+      }
+      std::unique_lock<std::mutex> g(lock);
+      wake.wait(g, [this] { return stopping || queued > 0; });
+      if (stopping && queued <= 0)
+        return;
+    }
+  }
+
+  // The newest task of our own deque, or the oldest of another
+  bool take(std::function<void()> &task) {
+    for (size_t i = 0; i < queues.size() && !task; i++) {
+      Queue &q = *queues[(self + i) % queues.size()];
+      std::lock_guard<std::mutex> g(q.lock);
+      if (q.tasks.empty())
+        continue;
+      if (i == 0) {
+        task = std::move(q.tasks.back());
+        q.tasks.pop_back();
+      } else {
+        task = std::move(q.tasks.front());
+        q.tasks.pop_front();
+      }
+    }
+    if (!task)
+      return false;
+    std::lock_guard<std::mutex> g(lock);
+    queued--;
+    return true;
+  }
+};
+
+} // namespace templog
+
+#endif
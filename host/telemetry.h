@@ -0,0 +1,184 @@
+// telemetry.h
+//
+// Receiver of the binary telemetry the firmware sends on the serial port with
+// TELEMETRY_BINARY, see telemetry.h of the firmware for the frame format.
+// Each frame decodes to a TelemetryFrame, which has the accessors of a Cursor
+// for the record it stands for, so the tools handle it as a record of a log.
+#ifndef TEMPLOG_TELEMETRY_H
+#define TEMPLOG_TELEMETRY_H
+
+#include "templog.h"
+
+namespace templog {
+
+struct TelemetryFrame {
+  static const uint8_t VERSION = 1;
+  // Bits of flags besides HEATER_ENABLED, HEATING and SENSOR_ERROR
+  static const uint8_t LOGGING = 0x08;
+  static const uint8_t STATS = 0x10;
+
+  uint8_t seq;
+  uint8_t flags;
+  uint32_t timestamp_;   // packed
+  int16_t target;        // quarter degrees
+  uint16_t untilDisable; // minutes
+  uint32_t fileId;       // 0 when not logging
+  std::vector<int16_t> temps;
+  // With STATS
+  uint32_t maxLogMicros;
+  uint8_t queueDepth;
+  uint32_t maxWaitAvoided;
+
+  // As a Cursor
+  int64_t time() const { return toEpoch(timestamp_); }
+  uint32_t timestamp() const { return timestamp_; }
+  uint8_t status() const {
+    return (flags & (HEATER_ENABLED | HEATING | SENSOR_ERROR)) | RECORD;
+  }
+  uint8_t numSensors() const { return uint8_t(temps.size()); }
+  double temperature(uint8_t i) const {
+    return temps[i] == NO_TEMPERATURE ? NAN : temps[i] / 4.0;
+  }
+  int16_t quarterDegrees(uint8_t i) const { return temps[i]; }
+
+  double targetTemperature() const { return target / 4.0; }
+  bool logging() const { return flags & LOGGING; }
+  bool hasStats() const { return flags & STATS; }
+};
+
+// Undo the COBS encoding of n bytes without the zero delimiters into out,
+// which has room for n bytes. Returns the decoded size, or -1 if the bytes
+// are not COBS.
+inline long cobsDecode(const uint8_t *in, size_t n, uint8_t *out) {
+  size_t o = 0;
+  for (size_t i = 0; i < n;) {
+    uint8_t code = in[i++];
+    if (code == 0 || i + code - 1 > n)
+      return -1;
+    for (uint8_t k = 1; k < code; k++)
+      out[o++] = in[i++];
+    // A code of 0xFF is a full run without a zero after it
+    if (code != 0xFF && i < n)
+      out[o++] = 0;
+  }
+  return long(o);
+}
+
+// Parse a decoded frame
+inline bool parseTelemetry(const uint8_t *p, size_t n, TelemetryFrame &f,
+                           std::string &error) {
+  if (n < 16 + 2) {
+    error = "short frame";
+    return false;
+  }
+  if (crc16(0xFFFF, p, n - 2) != load<uint16_t>(p + n - 2)) {
+    error = "bad CRC";
+    return false;
+  }
+  if (p[0] != TelemetryFrame::VERSION) {
+    error = "unsupported telemetry version " + std::to_string(p[0]);
+    return false;
+  }
+  f.seq = p[1];
+  f.flags = p[2];
+  f.timestamp_ = load<uint32_t>(p + 3);
+  f.target = load<int16_t>(p + 7);
+  f.untilDisable = load<uint16_t>(p + 9);
+  f.fileId = load<uint32_t>(p + 11);
+  uint8_t numSensors = p[15];
+  size_t size = 16 + 2 * numSensors + (f.hasStats() ? 9 : 0) + 2;
+  if (n != size) {
+    error = "bad frame size";
+    return false;
+  }
+  f.temps.resize(numSensors);
+  for (uint8_t i = 0; i < numSensors; i++)
+    f.temps[i] = load<int16_t>(p + 16 + 2 * i);
+  const uint8_t *s = p + 16 + 2 * numSensors;
+  f.maxLogMicros = f.hasStats() ? load<uint32_t>(s) : 0;
+  f.queueDepth = f.hasStats() ? s[4] : 0;
+  f.maxWaitAvoided = f.hasStats() ? load<uint32_t>(s + 5) : 0;
+  return true;
+}
+
+// Finds the frames in the bytes from the serial port. What is between two
+// zero bytes and does not decode is text the firmware printed, or a damaged
+// frame.
+class TelemetryReceiver {
+public:
+  // Frames longer than this are not frames
+  static const size_t MAX_FRAME = 256;
+
+  // Feed n bytes. Calls frame(const TelemetryFrame &) for each frame and
+  // text(const std::string &) for each line of text between frames.
+  template <class FrameFn, class TextFn>
+  void feed(const uint8_t *p, size_t n, FrameFn &&frame, TextFn &&text) {
+    for (size_t i = 0; i < n; i++) {
+      if (p[i] != 0) {
+        buf.push_back(p[i]);
+        // Too long for a frame: text without frames, a line at a time
+        if (buf.size() <= MAX_FRAME || (p[i] != '\n' && buf.size() < 4096))
+          continue;
+      }
+      if (!buf.empty())
+        finish(frame, text);
+      buf.clear();
+    }
+  }
+
+  uint64_t frames() const { return frames_; }
+  // Frames that did not decode or failed their check
+  uint64_t damaged() const { return damaged_; }
+  // Frames missing by their sequence numbers
+  uint64_t lost() const { return lost_; }
+
+private:
+  std::vector<uint8_t> buf;
+  std::vector<uint8_t> decoded;
+  TelemetryFrame f;
+  std::string error;
+  uint64_t frames_ = 0;
+  uint64_t damaged_ = 0;
+  uint64_t lost_ = 0;
+  bool haveSeq = false;
+  uint8_t lastSeq = 0;
+
+  template <class FrameFn, class TextFn>
+  void finish(FrameFn &frame, TextFn &text) {
+    decoded.resize(buf.size());
+    long n = buf.size() <= MAX_FRAME
+                 ? cobsDecode(buf.data(), buf.size(), decoded.data())
+                 : -1;
+    if (n >= 0 && parseTelemetry(decoded.data(), n, f, error)) {
+      if (haveSeq)
+        lost_ += uint8_t(f.seq - lastSeq - 1);
+      haveSeq = true;
+      lastSeq = f.seq;
+      frames_++;
+      frame(f);
+      return;
+    }
+    // Text is printable, frames are binary
+    bool printable = std::all_of(buf.begin(), buf.end(), [](uint8_t c) {
+      return c >= 0x20 || c == '\r' || c == '\n' || c == '\t';
+    });
+    if (!printable) {
+      damaged_++;
+      return;
+    }
+    size_t start = 0;
+    std::string s(buf.begin(), buf.end());
+    while (start < s.size()) {
+      size_t end = s.find_first_of("\r\n", start);
+      if (end == std::string::npos)
+        end = s.size();
+      if (end > start)
+        text(s.substr(start, end - start));
+      start = end + 1;
+    }
+  }
+};
+
+} // namespace templog
+
+#endif
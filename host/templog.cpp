@@ -0,0 +1,1531 @@
+// templog.cpp
+//
+// Command line tool for the log files of the temperature monitor, built on
+// templog.h.
+//
+//   templog info FILE...  check the files and print what they hold
+//   templog dump FILE...  print the records as CSV
+//   templog dump --follow FILE
+//                         print the records as CSV, and those added to the
+//                         file as it grows, until ^C, with a status line on
+//                         stderr each time. Keeps the time index of the file
+//                         up to date. See follow.h.
+//   templog merge FILE... print the records of all files as CSV, in order of
+//                         time, without duplicates
+//   templog index [-n N] FILE...
+//                         create or extend the time index of the files, an
+//                         entry at least every N records (default 1024)
+//   templog query [--from TIME] [--to TIME] [--last DURATION]
+//                 [--above SENSOR:DEGREES] [--below SENSOR:DEGREES] FILE...
+//                         print the records in a time window as CSV, using
+//                         and updating the time index. TIME is
+//                         "YYYY-MM-DD hh:mm:ss", DURATION a number of
+//                         seconds with the suffix s, m, h or d, back from the
+//                         last record. query also reads archives, by the
+//                         chunk statistics instead of the index.
+//   templog downsample [-n POINTS] [--from TIME] [--to TIME]
+//                      [--last DURATION] FILE...
+//                         merge the files as merge does and reduce the time
+//                         window to POINTS buckets (default 1000) for
+//                         plotting, a record per sensor from each that keeps
+//                         the peaks, and the first and last heater step of
+//                         each with the record before it. At most POINTS *
+//                         (sensors + 5) records. See downsample.h.
+//   templog control [-s SENSOR] [--target DEGREES] [--band DEGREES]
+//                   [--step DEGREES] FILE...
+//                         merge the files as merge does and print how the
+//                         heater held the temperature of SENSOR (default 0),
+//                         a CSV row per heater session and setpoint: the
+//                         target, estimated unless given, overshoot,
+//                         undershoot, settling time until the peaks and
+//                         bottoms of the cycles hold within band (default
+//                         3), empty if they never did, period, duty cycle
+//                         and switches of the relay. See control.h.
+//   templog archive [-n N] FILE...
+//                         write the records of each log to a columnar
+//                         archive next to it, FILE.arc, in chunks of at most
+//                         N records (default 8192) and a day. See archive.h.
+//   templog unarchive ARCHIVE FILE
+//                         write the records of an archive to a version 3 log
+//   templog telemetry [-v] [-l FILE] [PORT]
+//                         print the records of the binary telemetry of the
+//                         firmware (TELEMETRY_BINARY) as CSV as they arrive,
+//                         from the serial port PORT, set to 115200 baud, or
+//                         stdin. -v adds the fields that are not in the log,
+//                         -l also writes the records to the version 3 log
+//                         FILE. Text from the firmware goes to stderr.
+//   templog convert [-j N] [-o DIR] FILE|DIR...
+//                         check the files and convert them to CSV, on N
+//                         threads (default one per core). A directory stands
+//                         for the TempLog_*.bin files below it. The CSV goes
+//                         next to each file, or below DIR in the layout of
+//                         the input. A file that fails is reported and
+//                         skipped.
+//   templog bench [-n N] [FILE]
+//                         time the column kernels of columns.h on N
+//                         generated version 1 records (default 10000000),
+//                         or the records of a version 1 FILE
+//   templog generate [-s SENSORS] [-d DURATION] [-m MiB] [--noise DEGREES]
+//                    [--errors SHARE] [--segment MiB] [--seed N]
+//                    [--start TIME] DIR
+//                         write the logs of a simulated oven to DIR, named
+//                         and split into segments of at most --segment MiB
+//                         (default 100) as the firmware does, for DURATION
+//                         (default 1d) or until they hold MiB. See
+//                         generate.h.
+//   templog benchmark [-m MiB] [-s SENSORS] [-j N] [-f FILTER]
+//                     [--save FILE] [--compare FILE] DIR
+//                         time decoding, merging, indexing and exporting the
+//                         logs in DIR, in MB and records per second, after
+//                         generating MiB (default 1024) of logs there if it
+//                         has none. --save writes the results to FILE,
+//                         --compare shows the change from those in FILE and
+//                         fails if a benchmark is more than 10% slower.
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#include <atomic>
+#include <csignal>
+#include <chrono>
+#include <filesystem>
+#include <memory>
+#include <random>
+
+#include "archive.h"
+#include "columns.h"
+#include "control.h"
+#include "downsample.h"
+#include "follow.h"
+#include "generate.h"
+#include "pool.h"
+#include "telemetry.h"
+#include "templog.h"
+#include "timeindex.h"
+
+#include <termios.h>
+
+using namespace templog;
+
+static void usage() {
+  fprintf(stderr, "usage: templog info FILE...\n"
+                  "       templog dump FILE...\n"
+                  "       templog dump --follow FILE\n"
+                  "       templog merge FILE...\n"
+                  "       templog index [-n N] FILE...\n"
+                  "       templog query [--from TIME] [--to TIME] "
+                  "[--last DURATION]\n"
+                  "                     [--above SENSOR:DEGREES] "
+                  "[--below SENSOR:DEGREES] FILE...\n"
+                  "       templog downsample [-n POINTS] [--from TIME] "
+                  "[--to TIME] [--last DURATION]\n"
+                  "                          FILE...\n"
+                  "       templog control [-s SENSOR] [--target DEGREES] "
+                  "[--band DEGREES]\n"
+                  "                       [--step DEGREES] FILE...\n"
+                  "       templog archive [-n N] FILE...\n"
+                  "       templog unarchive ARCHIVE FILE\n"
+                  "       templog telemetry [-v] [-l FILE] [PORT]\n"
+                  "       templog convert [-j N] [-o DIR] FILE|DIR...\n"
+                  "       templog bench [-n N] [FILE]\n"
+                  "       templog generate [-s SENSORS] [-d DURATION] "
+                  "[-m MiB] [--noise DEGREES]\n"
+                  "                        [--errors SHARE] [--segment MiB] "
+                  "[--seed N] [--start TIME] DIR\n"
+                  "       templog benchmark [-m MiB] [-s SENSORS] [-j N] "
+                  "[-f FILTER]\n"
+                  "                         [--save FILE] [--compare FILE] "
+                  "DIR\n");
+  exit(2);
+}
+
+static bool openLog(LogFile &f, const char *path) {
+  if (f.open(path))
+    return true;
+  fprintf(stderr, "%s: %s\n", path, f.error().c_str());
+  return false;
+}
+
+static int info(int argc, char **argv) {
+  int ret = 0;
+  for (int i = 0; i < argc; i++) {
+    LogFile f;
+    if (!openLog(f, argv[i])) {
+      ret = 1;
+      continue;
+    }
+    const Header &h = f.header();
+    char buf[20];
+    printf("%s: version %u, %u sensors, started %s\n", argv[i], h.version,
+           h.numSensors, formatTime(toEpoch(h.start), buf));
+    Cursor c = f.records();
+    uint64_t n = 0;
+    int64_t first = 0, last = 0;
+    while (c.next()) {
+      if (!n++)
+        first = c.time();
+      last = c.time();
+    }
+    printf("  %llu records", (unsigned long long)n);
+    if (n) {
+      printf(" from %s", formatTime(first, buf));
+      printf(" to %s", formatTime(last, buf));
+    }
+    printf("\n");
+    if (c.invalidBlocks() || c.corruptBlocks() || f.truncated()) {
+      printf("  %u invalid blocks, %u corrupt%s\n", c.invalidBlocks(),
+             c.corruptBlocks(), f.truncated() ? ", truncated" : "");
+      ret = 1;
+    }
+  }
+  return ret;
+}
+
+static void appendCsvHeader(std::string &out, uint8_t numSensors) {
+  out += "time,status";
+  for (uint8_t s = 0; s < numSensors; s++)
+    out += ",t" + std::to_string(s);
+  out += "\n";
+}
+
+// A record, a Cursor or the like, as a CSV row with columns for numSensors
+// temperatures
+template <class Record>
+static void appendCsv(std::string &out, const Record &c, uint8_t numSensors) {
+  char buf[24];
+  out += formatTime(c.time(), buf);
+  snprintf(buf, sizeof(buf), ",%u", c.status());
+  out += buf;
+  for (uint8_t s = 0; s < numSensors; s++) {
+    double t = s < c.numSensors() ? c.temperature(s) : NAN;
+    if (std::isnan(t))
+      out += ",";
+    else if (fabs(t) < 1e15)
+      out.append(buf, snprintf(buf, sizeof(buf), ",%.2f", t));
+    else
+      out.append(buf, snprintf(buf, sizeof(buf), ",%g", t));
+  }
+  out += "\n";
+}
+
+static void printCsvHeader(uint8_t numSensors) {
+  std::string line;
+  appendCsvHeader(line, numSensors);
+  fputs(line.c_str(), stdout);
+}
+
+template <class Record>
+static void printCsv(const Record &c, uint8_t numSensors) {
+  static std::string line;
+  line.clear();
+  appendCsv(line, c, numSensors);
+  fwrite(line.data(), 1, line.size(), stdout);
+}
+
+static const uint32_t INDEX_EVERY = 1024;
+
+static volatile sig_atomic_t stopping = 0;
+
+static void stop(int) { stopping = 1; }
+
+// Stop on ^C, to finish properly
+static void catchStop() {
+  struct sigaction sa = {};
+  sa.sa_handler = stop;
+  sigaction(SIGINT, &sa, nullptr);
+  sigaction(SIGTERM, &sa, nullptr);
+}
+
+static void printLiveStats(const LiveStats &l) {
+  char buf[20];
+  std::string line = formatTime(l.last, buf);
+  char s[96];
+  snprintf(s, sizeof(s), "  %llu records, heating %.0f%%",
+           (unsigned long long)l.records, l.duty() * 100);
+  line += s;
+  for (size_t i = 0; i < l.current.size(); i++) {
+    snprintf(s, sizeof(s), ", t%zu %.2f (%.2f to %.2f, mean %.2f)", i,
+             l.current[i], l.min[i], l.max[i], l.mean(uint8_t(i)));
+    line += s;
+  }
+  fprintf(stderr, "%s\n", line.c_str());
+}
+
+static int follow(const char *path) {
+  catchStop();
+  // Wait for the file and its header to be written, as tail -F does
+  Follower f;
+  for (bool told = false; !f.open(path); told = true) {
+    if (!told)
+      fprintf(stderr, "%s: %s, waiting\n", path, f.file().error().c_str());
+    std::this_thread::sleep_for(std::chrono::seconds(1));
+    if (stopping)
+      return 1;
+  }
+  TimeIndex idx;
+  LiveStats live;
+  std::string error;
+  bool indexed = false;
+  int numSensors = f.file().header().numSensors;
+  printCsvHeader(numSensors);
+  int ret = 0;
+  while (!stopping) {
+    long n = f.poll([&](const Cursor &c) {
+      if (c.numSensors() != numSensors) {
+        numSensors = c.numSensors();
+        printCsvHeader(numSensors);
+      }
+      printCsv(c, numSensors);
+      live.add(c);
+    });
+    if (n < 0) {
+      fprintf(stderr, "%s\n", f.error().c_str());
+      ret = 1;
+      break;
+    }
+    if (f.restarted()) {
+      fprintf(stderr, "%s: replaced, reading it again\n", path);
+      live = LiveStats();
+      indexed = false;
+    }
+    if (n > 0 || !indexed) {
+      fflush(stdout);
+      if (!(indexed ? idx.extend(f.file(), error)
+                    : idx.update(f.file(), INDEX_EVERY, error))) {
+        fprintf(stderr, "%s\n", error.c_str());
+        ret = 1;
+        break;
+      }
+      indexed = true;
+      if (n > 0)
+        printLiveStats(live);
+    }
+    if (!stopping)
+      std::this_thread::sleep_for(std::chrono::seconds(1));
+  }
+  return ret;
+}
+
+static int dump(int argc, char **argv) {
+  if (argc >= 1 && !strcmp(argv[0], "--follow")) {
+    if (argc != 2)
+      usage();
+    return follow(argv[1]);
+  }
+  int ret = 0;
+  for (int i = 0; i < argc; i++) {
+    LogFile f;
+    if (!openLog(f, argv[i])) {
+      ret = 1;
+      continue;
+    }
+    printCsvHeader(f.header().numSensors);
+    Cursor c = f.records();
+    while (c.next())
+      printCsv(c, f.header().numSensors);
+  }
+  return ret;
+}
+
+static int merge(int argc, char **argv) {
+  int ret = 0;
+  std::vector<std::unique_ptr<LogFile>> files;
+  std::vector<const LogFile *> logs;
+  uint8_t numSensors = 0;
+  for (int i = 0; i < argc; i++) {
+    files.emplace_back(new LogFile);
+    if (!openLog(*files.back(), argv[i])) {
+      files.pop_back();
+      ret = 1;
+      continue;
+    }
+    logs.push_back(files.back().get());
+    numSensors = std::max(numSensors, files.back()->header().numSensors);
+  }
+  Merger m(logs);
+  uint64_t n = 0;
+  printCsvHeader(numSensors);
+  while (m.next()) {
+    printCsv(m.current(), numSensors);
+    n++;
+  }
+  fprintf(stderr, "%llu records from %zu files, %llu duplicates dropped\n",
+          (unsigned long long)n, logs.size(),
+          (unsigned long long)m.duplicates());
+  return ret;
+}
+
+static int index(int argc, char **argv) {
+  uint32_t every = INDEX_EVERY;
+  int i = 0;
+  if (i + 1 < argc && !strcmp(argv[i], "-n")) {
+    every = strtoul(argv[i + 1], nullptr, 0);
+    i += 2;
+  }
+  int ret = 0;
+  for (; i < argc; i++) {
+    LogFile f;
+    TimeIndex idx;
+    std::string error;
+    if (!openLog(f, argv[i])) {
+      ret = 1;
+    } else if (!idx.update(f, every, error)) {
+      fprintf(stderr, "%s: %s\n", argv[i], error.c_str());
+      ret = 1;
+    } else {
+      printf("%s: %zu entries\n", TimeIndex::pathFor(argv[i]).c_str(),
+             idx.size());
+    }
+  }
+  return ret;
+}
+
+// "3h" and the like, in seconds
+static bool parseDuration(const char *s, int64_t &seconds) {
+  char *end;
+  double v = strtod(s, &end);
+  const char *units = "smhd";
+  const int64_t scale[] = {1, 60, 3600, 86400};
+  const char *u = *end ? strchr(units, *end) : units;
+  if (end == s || !u || (*end && end[1]))
+    return false;
+  seconds = int64_t(v * scale[u - units]);
+  return true;
+}
+
+static bool parseThreshold(const char *s, bool above, Threshold &t) {
+  unsigned sensor;
+  double degrees;
+  if (sscanf(s, "%u:%lf", &sensor, &degrees) != 2 || sensor > 255)
+    return false;
+  t = {uint8_t(sensor), above, degrees};
+  return true;
+}
+
+static bool isArchive(const char *path) {
+  size_t n = strlen(path);
+  return n > 4 && !strcmp(path + n - 4, ".arc");
+}
+
+static bool checkSensors(const char *path, uint8_t numSensors,
+                         const std::vector<Threshold> &thresholds) {
+  for (const Threshold &t : thresholds) {
+    if (t.sensor >= numSensors) {
+      fprintf(stderr, "%s: has %u sensors\n", path, numSensors);
+      return false;
+    }
+  }
+  return true;
+}
+
+static bool queryArchive(const char *path, int64_t from, int64_t to,
+                         int64_t lastFor,
+                         const std::vector<Threshold> &thresholds) {
+  Archive a;
+  if (!a.open(path)) {
+    fprintf(stderr, "%s: %s\n", path, a.error().c_str());
+    return false;
+  }
+  uint8_t numSensors = a.numSensors();
+  if (!checkSensors(path, numSensors, thresholds))
+    return false;
+  if (lastFor >= 0) {
+    int64_t last = INT64_MIN;
+    for (size_t i = 0; i < a.chunkCount(); i++)
+      last = std::max(last, a.chunk(i).last);
+    from = std::max(from, last - lastFor);
+  }
+  printCsvHeader(numSensors);
+  uint64_t n = 0;
+  size_t skipped, damaged;
+  size_t decoded = a.query(
+      from, to, thresholds,
+      [&](const ArchiveRecord &r) {
+        printCsv(r, numSensors);
+        n++;
+      },
+      &skipped, &damaged);
+  fprintf(stderr, "%s: %llu records, %zu of %zu chunks decoded, %zu skipped "
+          "by thresholds\n", path, (unsigned long long)n, decoded,
+          a.chunkCount(), skipped);
+  if (damaged)
+    fprintf(stderr, "%s: %zu damaged chunks\n", path, damaged);
+  return !damaged;
+}
+
+static int query(int argc, char **argv) {
+  int64_t from = INT64_MIN, to = INT64_MAX, lastFor = -1;
+  std::vector<Threshold> thresholds;
+  int i = 0;
+  for (; i + 1 < argc && argv[i][0] == '-'; i += 2) {
+    Threshold t;
+    bool ok;
+    if (!strcmp(argv[i], "--from"))
+      ok = parseTime(argv[i + 1], from);
+    else if (!strcmp(argv[i], "--to"))
+      ok = parseTime(argv[i + 1], to);
+    else if (!strcmp(argv[i], "--last"))
+      ok = parseDuration(argv[i + 1], lastFor);
+    else if (!strcmp(argv[i], "--above") || !strcmp(argv[i], "--below"))
+      ok = parseThreshold(argv[i + 1], argv[i][2] == 'a', t) &&
+           (thresholds.push_back(t), true);
+    else
+      usage();
+    if (!ok) {
+      fprintf(stderr, "invalid %s %s\n", argv[i], argv[i + 1]);
+      return 2;
+    }
+  }
+  int ret = 0;
+  for (; i < argc; i++) {
+    if (isArchive(argv[i])) {
+      if (!queryArchive(argv[i], from, to, lastFor, thresholds))
+        ret = 1;
+      continue;
+    }
+    LogFile f;
+    TimeIndex idx;
+    std::string error;
+    if (!openLog(f, argv[i])) {
+      ret = 1;
+      continue;
+    }
+    if (!idx.update(f, INDEX_EVERY, error)) {
+      fprintf(stderr, "%s: %s\n", argv[i], error.c_str());
+      ret = 1;
+      continue;
+    }
+    uint8_t numSensors = f.header().numSensors;
+    if (!checkSensors(argv[i], numSensors, thresholds)) {
+      ret = 1;
+      continue;
+    }
+    int64_t start = from;
+    if (lastFor >= 0) {
+      // Back from the last record of the file
+      start = std::max(from, idx.lastTime() - lastFor);
+    }
+    printCsvHeader(numSensors);
+    uint64_t n = 0;
+    size_t skipped;
+    size_t decoded = idx.query(
+        f, start, to, thresholds,
+        [&](const Cursor &c) {
+          printCsv(c, numSensors);
+          n++;
+        },
+        &skipped);
+    fprintf(stderr, "%s: %llu records, %zu of %zu index entries decoded, "
+            "%zu skipped by thresholds\n", argv[i], (unsigned long long)n,
+            decoded, idx.size(), skipped);
+  }
+  return ret;
+}
+
+static int downsample(int argc, char **argv) {
+  int64_t from = INT64_MIN, to = INT64_MAX, lastFor = -1;
+  size_t points = 1000;
+  int i = 0;
+  for (; i + 1 < argc && argv[i][0] == '-'; i += 2) {
+    bool ok = true;
+    if (!strcmp(argv[i], "-n"))
+      ok = (points = strtoul(argv[i + 1], nullptr, 0)) > 0;
+    else if (!strcmp(argv[i], "--from"))
+      ok = parseTime(argv[i + 1], from);
+    else if (!strcmp(argv[i], "--to"))
+      ok = parseTime(argv[i + 1], to);
+    else if (!strcmp(argv[i], "--last"))
+      ok = parseDuration(argv[i + 1], lastFor);
+    else
+      usage();
+    if (!ok) {
+      fprintf(stderr, "invalid %s %s\n", argv[i], argv[i + 1]);
+      return 2;
+    }
+  }
+  int ret = 0;
+  std::vector<std::unique_ptr<LogFile>> files;
+  std::vector<const LogFile *> logs;
+  uint8_t numSensors = 0;
+  // The time range of the files, from their indexes
+  int64_t first = INT64_MAX, last = INT64_MIN;
+  for (; i < argc; i++) {
+    files.emplace_back(new LogFile);
+    TimeIndex idx;
+    std::string error;
+    if (!openLog(*files.back(), argv[i])) {
+      files.pop_back();
+      ret = 1;
+      continue;
+    }
+    if (!idx.update(*files.back(), INDEX_EVERY, error)) {
+      fprintf(stderr, "%s: %s\n", argv[i], error.c_str());
+      files.pop_back();
+      ret = 1;
+      continue;
+    }
+    first = std::min(first, idx.firstTime());
+    last = std::max(last, idx.lastTime());
+    logs.push_back(files.back().get());
+    numSensors = std::max(numSensors, files.back()->header().numSensors);
+  }
+  if (lastFor >= 0)
+    from = std::max(from, last - lastFor);
+  from = std::max(from, first);
+  to = std::min(to, last);
+
+  printCsvHeader(numSensors);
+  uint64_t in = 0, out = 0;
+  if (from <= to) {
+    Lttb lttb(numSensors, from, to, points, [&](const Sample &r) {
+      printCsv(r, numSensors);
+      out++;
+    });
+    Merger m(logs);
+    while (m.next()) {
+      lttb.add(m.current());
+      in++;
+    }
+    lttb.finish();
+  }
+  fprintf(stderr, "%llu records from %zu files to %llu\n",
+          (unsigned long long)in, logs.size(), (unsigned long long)out);
+  return ret;
+}
+
+// A CSV field, empty for NAN
+static void appendField(std::string &out, const char *format, double v) {
+  char buf[32];
+  out += ",";
+  if (!std::isnan(v))
+    out.append(buf, snprintf(buf, sizeof(buf), format, v));
+}
+
+static int control(int argc, char **argv) {
+  ControlOptions opt;
+  int i = 0;
+  for (; i + 1 < argc && argv[i][0] == '-'; i += 2) {
+    char *end;
+    double v = strtod(argv[i + 1], &end);
+    if (end == argv[i + 1] || *end) {
+      fprintf(stderr, "invalid %s %s\n", argv[i], argv[i + 1]);
+      return 2;
+    }
+    if (!strcmp(argv[i], "-s"))
+      opt.sensor = uint8_t(v);
+    else if (!strcmp(argv[i], "--target"))
+      opt.target = v;
+    else if (!strcmp(argv[i], "--band"))
+      opt.band = v;
+    else if (!strcmp(argv[i], "--step"))
+      opt.step = v;
+    else
+      usage();
+  }
+  int ret = 0;
+  std::vector<std::unique_ptr<LogFile>> files;
+  std::vector<const LogFile *> logs;
+  for (; i < argc; i++) {
+    files.emplace_back(new LogFile);
+    if (!openLog(*files.back(), argv[i])) {
+      files.pop_back();
+      ret = 1;
+      continue;
+    }
+    logs.push_back(files.back().get());
+  }
+
+  printf("session,start,seconds,target,overshoot,undershoot,settling,period,"
+         "duty,switches,per_hour\n");
+  uint64_t epochs = 0;
+  std::string line;
+  ControlAnalyzer analyzer(opt, [&](const ControlStats &s) {
+    char buf[32];
+    line.clear();
+    line.append(buf, snprintf(buf, sizeof(buf), "%u,", s.session));
+    line += formatTime(s.start, buf);
+    line.append(buf, snprintf(buf, sizeof(buf), ",%lld",
+                              (long long)s.seconds()));
+    appendField(line, "%.2f", s.target);
+    appendField(line, "%.2f", s.overshoot);
+    appendField(line, "%.2f", s.undershoot);
+    appendField(line, "%.0f", s.settling < 0 ? NAN : s.settling);
+    appendField(line, "%.0f", s.period);
+    appendField(line, "%.3f", s.duty());
+    line.append(buf, snprintf(buf, sizeof(buf), ",%u", s.switches));
+    appendField(line, "%.1f", s.switchesPerHour());
+    line += "\n";
+    fputs(line.c_str(), stdout);
+    epochs++;
+  });
+  Merger m(logs);
+  uint64_t n = 0;
+  while (m.next()) {
+    analyzer.add(m.current());
+    n++;
+  }
+  analyzer.finish();
+  fprintf(stderr, "%llu records from %zu files, %u sessions, %llu setpoints\n",
+          (unsigned long long)n, logs.size(), analyzer.sessions(),
+          (unsigned long long)epochs);
+  return ret;
+}
+
+static int archive(int argc, char **argv) {
+  uint32_t chunkRecords = ArchiveWriter::CHUNK_RECORDS;
+  int i = 0;
+  if (i + 1 < argc && !strcmp(argv[i], "-n")) {
+    chunkRecords = strtoul(argv[i + 1], nullptr, 0);
+    i += 2;
+  }
+  int ret = 0;
+  for (; i < argc; i++) {
+    LogFile f;
+    if (!openLog(f, argv[i])) {
+      ret = 1;
+      continue;
+    }
+    std::string out = std::string(argv[i]) + ".arc";
+    ArchiveWriter w;
+    bool ok = w.open(out, f.header(), chunkRecords);
+    Cursor c = f.records();
+    uint64_t n = 0;
+    while (ok && c.next()) {
+      ok = w.add(c);
+      n++;
+    }
+    ok = w.close() && ok;
+    if (!ok) {
+      fprintf(stderr, "%s: %s\n", out.c_str(), w.error().c_str());
+      remove(out.c_str());
+      ret = 1;
+      continue;
+    }
+    printf("%s: %llu records, %zu to %llu bytes, %.1f bytes a record, "
+           "%.1fx smaller\n", out.c_str(), (unsigned long long)n, f.size(),
+           (unsigned long long)w.bytes(), n ? double(w.bytes()) / n : 0.0,
+           double(f.size()) / w.bytes());
+    if (c.invalidBlocks() || c.corruptBlocks() || f.truncated()) {
+      printf("  %u invalid blocks, %u corrupt%s\n", c.invalidBlocks(),
+             c.corruptBlocks(), f.truncated() ? ", truncated" : "");
+      ret = 1;
+    }
+  }
+  return ret;
+}
+
+static int unarchive(int argc, char **argv) {
+  if (argc != 2)
+    usage();
+  Archive a;
+  if (!a.open(argv[0])) {
+    fprintf(stderr, "%s: %s\n", argv[0], a.error().c_str());
+    return 1;
+  }
+  LogWriter w;
+  bool ok = w.open(argv[1], a.numSensors(), a.start());
+  ArchiveChunk chunk;
+  std::vector<double> temps(a.numSensors());
+  size_t damaged = 0;
+  for (size_t i = 0; ok && i < a.chunkCount(); i++) {
+    if (!a.decode(i, chunk)) {
+      damaged++;
+      continue;
+    }
+    for (size_t k = 0; ok && k < chunk.times.size(); k++) {
+      ArchiveRecord r(chunk, a.numSensors(), k);
+      for (uint8_t s = 0; s < a.numSensors(); s++)
+        temps[s] = r.temperature(s);
+      ok = w.add(r.time(), r.status(), temps.data());
+    }
+  }
+  ok = w.close() && ok;
+  if (!ok) {
+    fprintf(stderr, "%s: %s\n", argv[1], w.error().c_str());
+    return 1;
+  }
+  if (damaged) {
+    fprintf(stderr, "%s: %zu damaged chunks left out\n", argv[0], damaged);
+    return 1;
+  }
+  return 0;
+}
+
+// Raw 115200 baud, if fd is a serial port
+static bool setupPort(int fd, const char *path) {
+  struct termios t;
+  if (!isatty(fd))
+    return true;
+  if (tcgetattr(fd, &t) != 0) {
+    fprintf(stderr, "%s: %s\n", path, strerror(errno));
+    return false;
+  }
+  cfmakeraw(&t);
+  cfsetispeed(&t, B115200);
+  cfsetospeed(&t, B115200);
+  t.c_cc[VMIN] = 1;
+  t.c_cc[VTIME] = 0;
+  if (tcsetattr(fd, TCSANOW, &t) != 0) {
+    fprintf(stderr, "%s: %s\n", path, strerror(errno));
+    return false;
+  }
+  return true;
+}
+
+static int telemetry(int argc, char **argv) {
+  bool verbose = false;
+  const char *logPath = nullptr;
+  int i = 0;
+  for (; i < argc && argv[i][0] == '-' && argv[i][1]; i++) {
+    if (!strcmp(argv[i], "-v"))
+      verbose = true;
+    else if (!strcmp(argv[i], "-l") && i + 1 < argc)
+      logPath = argv[++i];
+    else
+      usage();
+  }
+  if (argc - i > 1)
+    usage();
+  const char *path = i < argc ? argv[i] : "-";
+  int fd = strcmp(path, "-") ? open(path, O_RDONLY | O_NOCTTY) : 0;
+  if (fd < 0) {
+    fprintf(stderr, "%s: %s\n", path, strerror(errno));
+    return 1;
+  }
+  if (!setupPort(fd, path))
+    return 1;
+  // Stop reading on ^C, and close the log properly
+  catchStop();
+
+  TelemetryReceiver rx;
+  LogWriter log;
+  bool logOpen = false;
+  int ret = 0;
+  int numSensors = -1;
+  std::string line;
+  auto frame = [&](const TelemetryFrame &f) {
+    if (f.numSensors() != numSensors) {
+      numSensors = f.numSensors();
+      line.clear();
+      appendCsvHeader(line, f.numSensors());
+      if (verbose)
+        line.insert(line.size() - 1, ",target,until_disable,log_file,"
+                                     "max_log_us,queue,max_wait_avoided_us");
+      fputs(line.c_str(), stdout);
+    }
+    line.clear();
+    appendCsv(line, f, f.numSensors());
+    if (verbose) {
+      char buf[96], id[20] = "";
+      if (f.fileId)
+        formatTime(toEpoch(f.fileId), id);
+      snprintf(buf, sizeof(buf), ",%.2f,%u,%s", f.targetTemperature(),
+               f.untilDisable, id);
+      line.insert(line.size() - 1, buf);
+      if (f.hasStats()) {
+        snprintf(buf, sizeof(buf), ",%u,%u,%u", f.maxLogMicros, f.queueDepth,
+                 f.maxWaitAvoided);
+        line.insert(line.size() - 1, buf);
+      } else {
+        line.insert(line.size() - 1, ",,,");
+      }
+    }
+    fputs(line.c_str(), stdout);
+    if (logPath && !logOpen && ret == 0) {
+      if (!(logOpen = log.open(logPath, f.numSensors(), f.timestamp()))) {
+        fprintf(stderr, "%s\n", log.error().c_str());
+        ret = 1;
+      }
+    }
+    if (logOpen && f.numSensors() == numSensors) {
+      std::vector<double> t(f.numSensors());
+      for (uint8_t s = 0; s < f.numSensors(); s++)
+        t[s] = f.temperature(s);
+      if (!log.add(f.time(), f.status(), t.data())) {
+        fprintf(stderr, "%s\n", log.error().c_str());
+        logOpen = false;
+        ret = 1;
+      }
+    }
+  };
+  auto text = [](const std::string &s) { fprintf(stderr, "%s\n", s.c_str()); };
+
+  uint8_t buf[4096];
+  while (!stopping) {
+    ssize_t n = read(fd, buf, sizeof(buf));
+    if (n < 0 && errno == EINTR)
+      continue;
+    if (n < 0) {
+      fprintf(stderr, "%s: %s\n", path, strerror(errno));
+      ret = 1;
+    }
+    if (n <= 0)
+      break;
+    rx.feed(buf, n, frame, text);
+    fflush(stdout);
+    // For templog dump --follow on the log
+    if (logOpen && !log.sync()) {
+      fprintf(stderr, "%s\n", log.error().c_str());
+      logOpen = false;
+      ret = 1;
+    }
+  }
+  if (logOpen && !log.close()) {
+    fprintf(stderr, "%s\n", log.error().c_str());
+    ret = 1;
+  }
+  fprintf(stderr, "%llu frames, %llu lost, %llu damaged\n",
+          (unsigned long long)rx.frames(), (unsigned long long)rx.lost(),
+          (unsigned long long)rx.damaged());
+  return ret;
+}
+
+namespace fs = std::filesystem;
+
+// Chunks a log is split into for convert: version 1 records and version 3
+// blocks (512 KiB). Version 2 can only be decoded from the start.
+static const size_t CHUNK_RECORDS = 1 << 16;
+static const size_t CHUNK_BLOCKS = 1024;
+
+// A log being converted. Its chunks are decoded in parallel into CSV, and
+// written in order by whichever chunk completes the next one to write.
+struct Conversion {
+  std::string in;
+  std::string out;
+  std::unique_ptr<LogFile> f;
+  FILE *csv = nullptr;
+  std::vector<size_t> offset; // where each chunk starts
+
+  std::mutex lock; // the rest
+  std::vector<std::string> text;
+  std::vector<bool> decoded;
+  size_t written = 0;
+  uint64_t records = 0;
+  uint32_t invalid = 0;
+  uint32_t corrupt = 0;
+  std::string error;
+  std::string report; // when done
+};
+
+// The TempLog_*.bin files below dir, in order of name, with where their CSV
+// goes
+static void findLogs(const fs::path &dir, const char *outDir,
+                     std::vector<std::unique_ptr<Conversion>> &todo) {
+  std::vector<fs::path> found;
+  std::error_code ec;
+  for (fs::recursive_directory_iterator it(dir, ec), end; !ec && it != end;
+       it.increment(ec)) {
+    std::string name = it->path().filename().string();
+    if (it->is_regular_file(ec) && name.compare(0, 8, "TempLog_") == 0 &&
+        name.size() > 4 && name.compare(name.size() - 4, 4, ".bin") == 0)
+      found.push_back(it->path());
+  }
+  if (ec)
+    fprintf(stderr, "%s: %s\n", dir.c_str(), ec.message().c_str());
+  std::sort(found.begin(), found.end());
+  for (const fs::path &p : found) {
+    todo.emplace_back(new Conversion);
+    todo.back()->in = p.string();
+    fs::path out = outDir ? fs::path(outDir) / p.lexically_relative(dir) : p;
+    todo.back()->out = out.replace_extension(".csv").string();
+  }
+}
+
+static void finish(Conversion &c) {
+  char buf[64];
+  c.report = c.in + " -> " + c.out + ": ";
+  if (c.error.empty()) {
+    snprintf(buf, sizeof(buf), "%llu records", (unsigned long long)c.records);
+    c.report += buf;
+    if (c.invalid || c.corrupt || c.f->truncated()) {
+      snprintf(buf, sizeof(buf), ", %u invalid blocks, %u corrupt%s",
+               c.invalid, c.corrupt, c.f->truncated() ? ", truncated" : "");
+      c.report += buf;
+    }
+  } else {
+    c.report += c.error;
+  }
+  c.f.reset();
+}
+
+// Decode chunk k and write what is ready
+static void convertChunk(Conversion &c, size_t k) {
+  const LogFile &f = *c.f;
+  uint8_t n = f.header().numSensors;
+  size_t stop = k + 1 < c.offset.size() ? c.offset[k + 1] : SIZE_MAX;
+  std::string text;
+  if (k == 0)
+    appendCsvHeader(text, n);
+  Cursor cur(f, c.offset[k], stop);
+  uint64_t records = 0;
+  while (cur.next()) {
+    appendCsv(text, cur, n);
+    records++;
+  }
+
+  std::lock_guard<std::mutex> g(c.lock);
+  c.text[k].swap(text);
+  c.decoded[k] = true;
+  c.records += records;
+  c.invalid += cur.invalidBlocks();
+  c.corrupt += cur.corruptBlocks();
+  for (; c.written < c.offset.size() && c.decoded[c.written]; c.written++) {
+    std::string &t = c.text[c.written];
+    if (c.error.empty() && fwrite(t.data(), 1, t.size(), c.csv) != t.size())
+      c.error = std::string("cannot write: ") + strerror(errno);
+    std::string().swap(t);
+  }
+  if (c.written < c.offset.size())
+    return;
+  if (fclose(c.csv) != 0 && c.error.empty())
+    c.error = std::string("cannot write: ") + strerror(errno);
+  if (!c.error.empty())
+    remove(c.out.c_str());
+  finish(c);
+}
+
+// Open the log and queue its chunks
+static void convertFile(Pool &pool, Conversion &c) {
+  c.f.reset(new LogFile);
+  if (!c.f->open(c.in)) {
+    c.error = c.f->error();
+    finish(c);
+    return;
+  }
+  std::error_code ec;
+  fs::path dir = fs::path(c.out).parent_path();
+  if (!dir.empty())
+    fs::create_directories(dir, ec);
+  if (!(c.csv = fopen(c.out.c_str(), "wb"))) {
+    c.error = std::string("cannot write: ") + strerror(errno);
+    finish(c);
+    return;
+  }
+  const LogFile &f = *c.f;
+  const Header &h = f.header();
+  c.offset.push_back(0);
+  if (h.version == 1) {
+    size_t step = CHUNK_RECORDS * h.recordSize;
+    for (size_t o = h.dataOffset + step; o < f.size(); o += step)
+      c.offset.push_back(o);
+  } else if (h.version == 3) {
+    for (size_t b = 1 + CHUNK_BLOCKS; b < f.blockCount(); b += CHUNK_BLOCKS)
+      c.offset.push_back(b * BLOCK_SIZE);
+  }
+  c.text.resize(c.offset.size());
+  c.decoded.resize(c.offset.size());
+  // The last queued runs first on this worker, so queue backwards: the
+  // chunks are then written as they are decoded, and other workers steal
+  // from the end.
+  for (size_t k = c.offset.size(); k-- > 0;)
+    pool.submit([&c, k] { convertChunk(c, k); });
+}
+
+static int convert(int argc, char **argv) {
+  unsigned threads = 0;
+  const char *outDir = nullptr;
+  int i = 0;
+  for (; i + 1 < argc && argv[i][0] == '-'; i += 2) {
+    if (!strcmp(argv[i], "-j"))
+      threads = strtoul(argv[i + 1], nullptr, 0);
+    else if (!strcmp(argv[i], "-o"))
+      outDir = argv[i + 1];
+    else
+      usage();
+  }
+  std::vector<std::unique_ptr<Conversion>> todo;
+  for (; i < argc; i++) {
+    std::error_code ec;
+    if (fs::is_directory(argv[i], ec)) {
+      findLogs(argv[i], outDir, todo);
+      continue;
+    }
+    todo.emplace_back(new Conversion);
+    todo.back()->in = argv[i];
+    fs::path out = outDir ? fs::path(outDir) / fs::path(argv[i]).filename()
+                          : fs::path(argv[i]);
+    todo.back()->out = out.replace_extension(".csv").string();
+  }
+
+  auto t0 = std::chrono::steady_clock::now();
+  unsigned used;
+  {
+    Pool pool(threads);
+    used = pool.size();
+    for (auto &c : todo)
+      pool.submit([&pool, &c] { convertFile(pool, *c); });
+    pool.wait();
+  }
+  double seconds = std::chrono::duration<double>(
+                       std::chrono::steady_clock::now() - t0).count();
+
+  int ret = 0;
+  uint64_t records = 0;
+  size_t failed = 0;
+  for (auto &c : todo) {
+    printf("%s\n", c->report.c_str());
+    records += c->records;
+    if (!c->error.empty() || c->invalid || c->corrupt) {
+      failed++;
+      ret = 1;
+    }
+  }
+  fprintf(stderr, "%zu files, %llu records, %zu with errors, %.2f s on %u "
+          "threads\n", todo.size(), (unsigned long long)records, failed,
+          seconds, used);
+  return ret;
+}
+
+// Records per second of fn() over n records, the best of a few runs
+template <class Fn> static double rate(size_t n, Fn &&fn) {
+  double best = 0;
+  for (int run = 0; run < 5; run++) {
+    auto t0 = std::chrono::steady_clock::now();
+    fn();
+    double s = std::chrono::duration<double>(
+                   std::chrono::steady_clock::now() - t0).count();
+    best = std::max(best, n / s);
+  }
+  return best;
+}
+
+static int bench(int argc, char **argv) {
+  using namespace columns;
+  size_t n = 10000000;
+  int i = 0;
+  if (i + 1 < argc && !strcmp(argv[i], "-n")) {
+    n = strtoull(argv[i + 1], nullptr, 0);
+    i += 2;
+  }
+  // Records of one sensor, 9 bytes each, from a file or generated
+  LogFile f;
+  Header h;
+  std::vector<uint8_t> data;
+  const uint8_t *records;
+  if (i < argc) {
+    if (!openLog(f, argv[i]))
+      return 1;
+    if (f.header().version != 1 || f.header().tempSize != 4) {
+      fprintf(stderr, "%s: not a version 1 log with floats\n", argv[i]);
+      return 1;
+    }
+    h = f.header();
+    n = f.fixedRecords().size();
+    records = f.fixedRecords().data();
+  } else {
+    h = Header();
+    h.version = 1;
+    h.numSensors = 1;
+    h.tempSize = 4;
+    h.recordSize = 9;
+    data.resize(n * h.recordSize);
+    std::mt19937 rng(1);
+    for (size_t r = 0; r < n; r++) {
+      uint8_t *p = &data[r * h.recordSize];
+      float t = 20 + rng() % 4000 / 4.0f;
+      uint32_t ts = packTime({2000 + int(rng() % 64), 1 + int(rng() % 12),
+                              1 + int(rng() % 28), int(rng() % 24),
+                              int(rng() % 60), int(rng() % 60)});
+      memcpy(p, &t, 4);
+      p[4] = rng() % 2;
+      memcpy(p + 5, &ts, 4);
+    }
+    records = data.data();
+  }
+  FixedRecords r(records, n, h);
+  printf("%zu records of %zu bytes, best %s\n", n, r.stride(),
+         isaName(bestIsa()));
+
+  // The baseline: one record at a time through the view and toEpoch()
+  std::vector<int64_t> expect(n);
+  double base = rate(n, [&] {
+    for (size_t k = 0; k < n; k++)
+      expect[k] = toEpoch(r[k].timestamp());
+  });
+  printf("%-28s %8.1f M records/s\n", "per record", base / 1e6);
+
+  int ret = 0;
+  Columns ref, c;
+  gather(r, h.numSensors, ref, SCALAR);
+  std::vector<int64_t> times(n);
+  for (Isa isa : {SCALAR, SSE41, AVX2}) {
+    if (isa > bestIsa())
+      break;
+    double g = rate(n, [&] { gather(r, h.numSensors, c, isa); });
+    double d = rate(n, [&] { decodeTimes(c.timestamps.data(), times.data(),
+                                         n, isa); });
+    double both = 1 / (1 / g + 1 / d);
+    printf("gather %-6s %8.1f, decodeTimes %8.1f, both %8.1f M records/s, "
+           "%.1fx\n", isaName(isa), g / 1e6, d / 1e6, both / 1e6,
+           both / base);
+    if (c.temperatures != ref.temperatures || c.heater != ref.heater ||
+        c.timestamps != ref.timestamps || times != expect) {
+      printf("  %s results differ\n", isaName(isa));
+      ret = 1;
+    }
+  }
+  return ret;
+}
+
+static const uint64_t MiB = 1 << 20;
+
+// Write the logs of a Generator to dir, segments of at most segment bytes
+// named as Log::init() and Log::nextLogFileName() do, for duration seconds
+// or until they hold bytes
+static bool generateLogs(const fs::path &dir, const GeneratorOptions &opt,
+                         int64_t start, int64_t duration, uint64_t bytes,
+                         uint64_t segment, uint64_t &records,
+                         uint64_t &written, unsigned &segments) {
+  std::error_code ec;
+  fs::create_directories(dir, ec);
+  if (ec) {
+    fprintf(stderr, "%s: %s\n", dir.c_str(), ec.message().c_str());
+    return false;
+  }
+  DateTime d = unpackTime(fromEpoch(start));
+  char prefix[32];
+  snprintf(prefix, sizeof(prefix), "TempLog_%02d%02d%02d_%02d%02d%02d_",
+           d.year % 100, d.month, d.day, d.hour, d.minute, d.second);
+  Generator g(opt, start);
+  LogWriter w;
+  std::vector<double> temps(opt.numSensors);
+  records = written = 0;
+  segments = 0;
+  bool ok = true;
+  for (int64_t i = 0; ok && i < duration && written + w.size() < bytes;
+       i++) {
+    int64_t t;
+    uint8_t status;
+    g.next(t, status, temps.data());
+    // A new file before the next block would grow it beyond its size, as
+    // Log::isFileSizeExceeded()
+    if (!segments || w.size() + BLOCK_SIZE > segment) {
+      if (segments) {
+        ok = w.close();
+        written += w.size();
+      }
+      char name[64];
+      snprintf(name, sizeof(name), "%s%02u.bin", prefix, segments++);
+      ok = ok && w.open((dir / name).string(), opt.numSensors, fromEpoch(t));
+    }
+    ok = ok && w.add(t, status, temps.data());
+    records++;
+  }
+  if (segments) {
+    ok = w.close() && ok;
+    written += w.size();
+  }
+  if (!ok)
+    fprintf(stderr, "%s\n", w.error().c_str());
+  return ok;
+}
+
+static int generate(int argc, char **argv) {
+  GeneratorOptions opt;
+  int64_t duration = -1, start;
+  uint64_t bytes = UINT64_MAX, segment = 100 * MiB;
+  parseTime("2025-01-01", start);
+  int i = 0;
+  for (; i + 1 < argc && argv[i][0] == '-'; i += 2) {
+    char *end;
+    double v = strtod(argv[i + 1], &end);
+    bool ok = end != argv[i + 1] && !*end;
+    if (!strcmp(argv[i], "-s"))
+      ok = ok && v >= 1 && v <= 255 && (opt.numSensors = uint8_t(v));
+    else if (!strcmp(argv[i], "-d"))
+      ok = parseDuration(argv[i + 1], duration);
+    else if (!strcmp(argv[i], "-m"))
+      ok = ok && v > 0 && (bytes = uint64_t(v * MiB));
+    else if (!strcmp(argv[i], "--noise"))
+      opt.noise = v;
+    else if (!strcmp(argv[i], "--errors"))
+      opt.errors = v;
+    else if (!strcmp(argv[i], "--segment"))
+      ok = ok && v * MiB >= 2 * BLOCK_SIZE && (segment = uint64_t(v * MiB));
+    else if (!strcmp(argv[i], "--seed"))
+      opt.seed = uint32_t(v);
+    else if (!strcmp(argv[i], "--start"))
+      ok = parseTime(argv[i + 1], start);
+    else
+      usage();
+    if (!ok) {
+      fprintf(stderr, "invalid %s %s\n", argv[i], argv[i + 1]);
+      return 2;
+    }
+  }
+  if (i + 1 != argc)
+    usage();
+  if (duration < 0)
+    duration = bytes == UINT64_MAX ? 86400 : INT64_MAX;
+  uint64_t records, written;
+  unsigned segments;
+  auto t0 = std::chrono::steady_clock::now();
+  if (!generateLogs(argv[i], opt, start, duration, bytes, segment, records,
+                    written, segments))
+    return 1;
+  double seconds = std::chrono::duration<double>(
+                       std::chrono::steady_clock::now() - t0).count();
+  fprintf(stderr, "%llu records, %.1f MiB in %u files, %.2f s\n",
+          (unsigned long long)records, double(written) / MiB, segments,
+          seconds);
+  return 0;
+}
+
+// A benchmark of the suite: the best time of its runs
+struct BenchResult {
+  std::string name;
+  double seconds;
+  unsigned runs;
+  double mbs;     // MB of log per second
+  double records; // M records per second
+};
+
+static int benchmark(int argc, char **argv) {
+  GeneratorOptions opt;
+  opt.numSensors = 4;
+  uint64_t bytes = 1024 * MiB;
+  unsigned threads = 0;
+  const char *filter = "", *save = nullptr, *compare = nullptr;
+  int i = 0;
+  for (; i + 1 < argc && argv[i][0] == '-'; i += 2) {
+    if (!strcmp(argv[i], "-m"))
+      bytes = uint64_t(strtod(argv[i + 1], nullptr) * MiB);
+    else if (!strcmp(argv[i], "-s"))
+      opt.numSensors = uint8_t(strtoul(argv[i + 1], nullptr, 0));
+    else if (!strcmp(argv[i], "-j"))
+      threads = strtoul(argv[i + 1], nullptr, 0);
+    else if (!strcmp(argv[i], "-f"))
+      filter = argv[i + 1];
+    else if (!strcmp(argv[i], "--save"))
+      save = argv[i + 1];
+    else if (!strcmp(argv[i], "--compare"))
+      compare = argv[i + 1];
+    else
+      usage();
+  }
+  if (i + 1 != argc || !bytes || !opt.numSensors)
+    usage();
+  fs::path dir = argv[i];
+
+  std::vector<std::unique_ptr<Conversion>> found;
+  std::error_code ec;
+  if (fs::is_directory(dir, ec))
+    findLogs(dir, nullptr, found);
+  if (found.empty()) {
+    uint64_t records, written;
+    unsigned segments;
+    int64_t start;
+    parseTime("2025-01-01", start);
+    fprintf(stderr, "generating %.0f MiB of logs in %s\n",
+            double(bytes) / MiB, dir.c_str());
+    if (!generateLogs(dir, opt, start, INT64_MAX, bytes, 100 * MiB, records,
+                      written, segments))
+      return 1;
+    findLogs(dir, nullptr, found);
+  }
+  std::vector<std::unique_ptr<LogFile>> files;
+  std::vector<const LogFile *> logs;
+  uint64_t size = 0;
+  for (auto &c : found) {
+    files.emplace_back(new LogFile);
+    if (!openLog(*files.back(), c->in.c_str()))
+      return 1;
+    logs.push_back(files.back().get());
+    size += files.back()->size();
+  }
+  uint64_t records = 0;
+  for (const LogFile *f : logs) {
+    Cursor c(*f);
+    while (c.next())
+      records++;
+  }
+  printf("%zu files, %.1f MiB, %llu records\n", logs.size(),
+         double(size) / MiB, (unsigned long long)records);
+  printf("%-20s %10s %6s %10s %13s\n", "Benchmark", "Time", "Runs", "MB/s",
+         "M records/s");
+
+  // Run fn, which returns the records it saw, until it ran for 3 seconds,
+  // and keep the best time
+  std::vector<BenchResult> results;
+  int ret = 0;
+  auto run = [&](const char *name, auto &&fn) {
+    if (!strstr(name, filter))
+      return;
+    BenchResult r = {name, 1e300, 0, 0, 0};
+    double total = 0;
+    while (total < 3) {
+      auto t0 = std::chrono::steady_clock::now();
+      uint64_t n = fn();
+      double s = std::chrono::duration<double>(
+                     std::chrono::steady_clock::now() - t0).count();
+      if (n != records) {
+        printf("%s: %llu records, not %llu\n", name, (unsigned long long)n,
+               (unsigned long long)records);
+        ret = 1;
+        return;
+      }
+      r.seconds = std::min(r.seconds, s);
+      total += s;
+      r.runs++;
+    }
+    r.mbs = size / r.seconds / 1e6;
+    r.records = records / r.seconds / 1e6;
+    printf("%-20s %7.0f ms %6u %10.1f %13.2f\n", name, r.seconds * 1e3,
+           r.runs, r.mbs, r.records);
+    fflush(stdout);
+    results.push_back(r);
+  };
+
+  // The sum of the readings keeps the decoding from being optimized away
+  volatile double sink = 0;
+  run("decode", [&] {
+    uint64_t n = 0;
+    double sum = 0;
+    for (const LogFile *f : logs) {
+      Cursor c(*f);
+      while (c.next()) {
+        sum += c.quarterDegrees(0);
+        n++;
+      }
+    }
+    sink = sum;
+    return n;
+  });
+  run("decode/parallel", [&] {
+    std::atomic<uint64_t> n{0};
+    Pool pool(threads);
+    for (const LogFile *f : logs)
+      pool.submit([&n, f] {
+        uint64_t k = 0;
+        Cursor c(*f);
+        while (c.next())
+          k++;
+        n += k;
+      });
+    pool.wait();
+    return n.load();
+  });
+  run("merge", [&] {
+    uint64_t n = 0;
+    Merger m(logs);
+    while (m.next())
+      n++;
+    return n + m.duplicates();
+  });
+  run("index", [&] {
+    uint64_t n = 0;
+    for (const LogFile *f : logs) {
+      fs::remove(TimeIndex::pathFor(f->path()), ec);
+      TimeIndex idx;
+      std::string error;
+      if (!idx.update(*f, INDEX_EVERY, error))
+        fprintf(stderr, "%s: %s\n", f->path().c_str(), error.c_str());
+      n += idx.totalRecords();
+    }
+    return n;
+  });
+  run("export/csv", [&] {
+    uint64_t n = 0;
+    std::string out;
+    for (const LogFile *f : logs) {
+      Cursor c(*f);
+      while (c.next()) {
+        appendCsv(out, c, f->header().numSensors);
+        n++;
+        if (out.size() >= MiB)
+          out.clear();
+      }
+    }
+    return n;
+  });
+  std::string arc = (dir / "benchmark.arc").string();
+  run("export/archive", [&] {
+    uint64_t n = 0;
+    for (const LogFile *f : logs) {
+      ArchiveWriter w;
+      bool ok = w.open(arc, f->header());
+      Cursor c(*f);
+      while (ok && c.next()) {
+        ok = w.add(c);
+        n++;
+      }
+      if (!w.close() || !ok)
+        fprintf(stderr, "%s\n", w.error().c_str());
+    }
+    return n;
+  });
+  fs::remove(arc, ec);
+  for (const LogFile *f : logs)
+    fs::remove(TimeIndex::pathFor(f->path()), ec);
+
+  if (compare) {
+    FILE *in = fopen(compare, "r");
+    if (!in) {
+      fprintf(stderr, "%s: %s\n", compare, strerror(errno));
+      return 1;
+    }
+    char name[64];
+    double seconds, mbs, recs;
+    printf("\nchange from %s\n", compare);
+    while (fscanf(in, "%63s %lf %lf %lf", name, &seconds, &mbs, &recs) == 4) {
+      for (const BenchResult &r : results) {
+        if (r.name != name)
+          continue;
+        double change = (r.records / recs - 1) * 100;
+        printf("%-20s %+9.1f%%%s\n", name, change,
+               change < -10 ? "  slower" : "");
+        if (change < -10)
+          ret = 1;
+      }
+    }
+    fclose(in);
+  }
+  if (save) {
+    FILE *out = fopen(save, "w");
+    if (!out) {
+      fprintf(stderr, "%s: %s\n", save, strerror(errno));
+      return 1;
+    }
+    for (const BenchResult &r : results)
+      fprintf(out, "%s %.6f %.3f %.4f\n", r.name.c_str(), r.seconds, r.mbs,
+              r.records);
+    fclose(out);
+  }
+  return ret;
+}
+
+int main(int argc, char **argv) {
+  static char out[1 << 16];
+  setvbuf(stdout, out, _IOFBF, sizeof(out));
+  if (argc >= 2 && !strcmp(argv[1], "bench"))
+    return bench(argc - 2, argv + 2);
+  if (argc >= 2 && !strcmp(argv[1], "telemetry"))
+    return telemetry(argc - 2, argv + 2);
+  if (argc < 3)
+    usage();
+  if (!strcmp(argv[1], "info"))
+    return info(argc - 2, argv + 2);
+  if (!strcmp(argv[1], "dump"))
+    return dump(argc - 2, argv + 2);
+  if (!strcmp(argv[1], "merge"))
+    return merge(argc - 2, argv + 2);
+  if (!strcmp(argv[1], "index"))
+    return index(argc - 2, argv + 2);
+  if (!strcmp(argv[1], "query"))
+    return query(argc - 2, argv + 2);
+  if (!strcmp(argv[1], "downsample"))
+    return downsample(argc - 2, argv + 2);
+  if (!strcmp(argv[1], "control"))
+    return control(argc - 2, argv + 2);
+  if (!strcmp(argv[1], "archive"))
+    return archive(argc - 2, argv + 2);
+  if (!strcmp(argv[1], "unarchive"))
+    return unarchive(argc - 2, argv + 2);
+  if (!strcmp(argv[1], "convert"))
+    return convert(argc - 2, argv + 2);
+  if (!strcmp(argv[1], "generate"))
+    return generate(argc - 2, argv + 2);
+  if (!strcmp(argv[1], "benchmark"))
+    return benchmark(argc - 2, argv + 2);
+  usage();
+}
@@ -0,0 +1,833 @@
+// templog.h
+//
+// Header-only C++17 reader for the log files of the temperature monitor, for
+// host tools. See Log in log.h for the file formats.
+//
+// A LogFile maps the whole file read-only and validates its header. Nothing
+// is copied out of the mapping: version 1 records have a fixed size and are
+// exposed as strided views into it, and the delta encoded records of version
+// 2 and 3 are decoded in place by a Cursor, which also reads version 1.
+// LogWriter writes version 3 files as the firmware does.
+//
+// Values are little endian on the card, and read with memcpy on the host,
+// which is assumed to be little endian as well.
+#ifndef TEMPLOG_H
+#define TEMPLOG_H
+
+#include <cerrno>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <algorithm>
+#include <string>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace templog {
+
+// Bits of the status byte, as in Log
+const uint8_t HEATER_ENABLED = 0x01;
+const uint8_t HEATING = 0x02;
+const uint8_t SENSOR_ERROR = 0x04;
+const uint8_t SAME_INTERVAL = 0x10;
+const uint8_t RECORD = 0x40;
+const uint8_t KEYFRAME = 0x80;
+const uint8_t RESERVED = 0x28;
+
+const int16_t NO_TEMPERATURE = -32767 - 1;
+const size_t BLOCK_SIZE = 512;
+const size_t BLOCK_HEADER_SIZE = 8;
+
+template <class T> inline T load(const uint8_t *p) {
+  T v;
+  memcpy(&v, p, sizeof(v));
+  return v;
+}
+
+// Fields of a packed RTC timestamp, see Log::encodeTimestamp()
+struct DateTime {
+  int year; // 2000 - 2063
+  int month, day, hour, minute, second;
+};
+
+inline DateTime unpackTime(uint32_t t) {
+  return {2000 + int(t >> 26), int(t >> 22 & 0x0F), int(t >> 17 & 0x1F),
+          int(t >> 12 & 0x1F), int(t >> 6 & 0x3F), int(t & 0x3F)};
+}
+
+inline uint32_t packTime(const DateTime &d) {
+  return uint32_t(d.year - 2000) << 26 | uint32_t(d.month) << 22 |
+         uint32_t(d.day) << 17 | uint32_t(d.hour) << 12 |
+         uint32_t(d.minute) << 6 | uint32_t(d.second);
+}
+
+// Days since 1970-01-01 of a date in the proleptic Gregorian calendar
+inline int64_t daysFromCivil(int y, int m, int d) {
+  y -= m <= 2;
+  int64_t era = (y >= 0 ? y : y - 399) / 400;
+  int64_t yoe = y - era * 400;
+  int64_t doy = (153 * (m + (m > 2 ? -3 : 9)) + 2) / 5 + d - 1;
+  int64_t doe = yoe * 365 + yoe / 4 - yoe / 100 + doy;
+  return era * 146097 + doe - 719468;
+}
+
+inline DateTime civilFromDays(int64_t z, DateTime d = DateTime()) {
+  z += 719468;
+  int64_t era = (z >= 0 ? z : z - 146096) / 146097;
+  int64_t doe = z - era * 146097;
+  int64_t yoe = (doe - doe / 1460 + doe / 36524 - doe / 146096) / 365;
+  int64_t doy = doe - (365 * yoe + yoe / 4 - yoe / 100);
+  int64_t mp = (5 * doy + 2) / 153;
+  d.day = int(doy - (153 * mp + 2) / 5 + 1);
+  d.month = int(mp < 10 ? mp + 3 : mp - 9);
+  d.year = int(yoe + era * 400 + (d.month <= 2));
+  return d;
+}
+
+// Seconds since 1970-01-01 00:00:00 of a packed timestamp, in the time zone
+// the RTC was set to
+inline int64_t toEpoch(uint32_t t) {
+  DateTime d = unpackTime(t);
+  return ((daysFromCivil(d.year, d.month, d.day) * 24 + d.hour) * 60 +
+          d.minute) * 60 + d.second;
+}
+
+inline uint32_t fromEpoch(int64_t seconds) {
+  int64_t days = (seconds >= 0 ? seconds : seconds - 86399) / 86400;
+  int64_t s = seconds - days * 86400;
+  DateTime d = civilFromDays(days);
+  d.hour = int(s / 3600);
+  d.minute = int(s / 60 % 60);
+  d.second = int(s % 60);
+  return packTime(d);
+}
+
+// "YYYY-MM-DD hh:mm:ss", buf must hold 20 bytes
+inline char *formatTime(int64_t seconds, char *buf) {
+  DateTime d = unpackTime(fromEpoch(seconds));
+  snprintf(buf, 20, "%04d-%02d-%02d %02d:%02d:%02d", d.year, d.month, d.day,
+           d.hour, d.minute, d.second);
+  return buf;
+}
+
+// Parse "YYYY-MM-DD hh:mm:ss", or with a T between date and time, to
+// seconds since 1970
+inline bool parseTime(const char *s, int64_t &seconds) {
+  DateTime d = DateTime();
+  char sep;
+  int n = sscanf(s, "%d-%d-%d%c%d:%d:%d", &d.year, &d.month, &d.day, &sep,
+                 &d.hour, &d.minute, &d.second);
+  if (n != 3 && n != 7)
+    return false;
+  if (d.month < 1 || d.month > 12 || d.day < 1 || d.day > 31)
+    return false;
+  seconds = ((daysFromCivil(d.year, d.month, d.day) * 24 + d.hour) * 60 +
+             d.minute) * 60 + d.second;
+  return true;
+}
+
+// CRC-16/CCITT, as Log::crc16()
+inline uint16_t crc16(uint16_t crc, const void *data, size_t n) {
+  const uint8_t *p = static_cast<const uint8_t *>(data);
+  while (n--) {
+    crc ^= uint16_t(*p++) << 8;
+    for (int i = 0; i < 8; i++)
+      crc = crc & 0x8000 ? (crc << 1) ^ 0x1021 : crc << 1;
+  }
+  return crc;
+}
+
+// Read-only memory mapping of a whole file
+class MappedFile {
+public:
+  MappedFile() = default;
+  MappedFile(const MappedFile &) = delete;
+  MappedFile &operator=(const MappedFile &) = delete;
+  ~MappedFile() { close(); }
+
+  bool open(const std::string &path, std::string &error) {
+    close();
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+      error = "cannot open " + path + ": " + strerror(errno);
+      return false;
+    }
+    struct stat st;
+    if (fstat(fd, &st) < 0) {
+      error = "cannot stat " + path + ": " + strerror(errno);
+      ::close(fd);
+      return false;
+    }
+    size_ = st.st_size;
+    if (size_) {
+      void *p = mmap(nullptr, size_, PROT_READ, MAP_PRIVATE, fd, 0);
+      if (p == MAP_FAILED) {
+        error = "cannot map " + path + ": " + strerror(errno);
+        ::close(fd);
+        size_ = 0;
+        return false;
+      }
+      // Decoding reads the file front to back
+      madvise(p, size_, MADV_SEQUENTIAL);
+      data_ = static_cast<const uint8_t *>(p);
+    }
+    ::close(fd);
+    return true;
+  }
+
+  void close() {
+    if (data_)
+      munmap(const_cast<uint8_t *>(data_), size_);
+    data_ = nullptr;
+    size_ = 0;
+  }
+
+  const uint8_t *data() const { return data_; }
+  size_t size() const { return size_; }
+
+private:
+  const uint8_t *data_ = nullptr;
+  size_t size_ = 0;
+};
+
+// The validated file header
+struct Header {
+  uint8_t version;
+  uint8_t numSensors;
+  uint8_t tempSize;   // Version 1: bytes of a temperature, 4 or 8
+  uint32_t start;     // Packed timestamp, the file id of version 3
+  size_t dataOffset;  // The first record, or block of version 3
+  size_t recordSize;  // Version 1: bytes of a record
+};
+
+inline bool parseHeader(const uint8_t *p, size_t size, Header &h,
+                        std::string &error) {
+  h = Header();
+  if (size >= 13 && memcmp(p, "HEADER\n", 7) == 0) {
+    // "HEADER\n", numSensors, start timestamp, size of a temperature
+    h.version = 1;
+    h.numSensors = p[7];
+    h.start = load<uint32_t>(p + 8);
+    h.tempSize = p[12];
+    h.dataOffset = 13;
+    if (h.tempSize != 4 && h.tempSize != 8) {
+      error = "invalid temperature size " + std::to_string(h.tempSize);
+      return false;
+    }
+    h.recordSize = h.numSensors * h.tempSize + 1 + 4;
+  } else if (size >= 13 && memcmp(p, "TEMPLOG", 7) == 0) {
+    h.version = p[7];
+    h.numSensors = p[8];
+    h.start = load<uint32_t>(p + 9);
+    if (h.version == 2) {
+      h.dataOffset = 13;
+    } else if (h.version == 3) {
+      h.dataOffset = BLOCK_SIZE;
+    } else {
+      error = "unsupported format version " + std::to_string(h.version);
+      return false;
+    }
+  } else {
+    error = "not a log file";
+    return false;
+  }
+  if (h.numSensors == 0) {
+    error = "no sensors";
+    return false;
+  }
+  DateTime d = unpackTime(h.start);
+  if (d.month < 1 || d.month > 12 || d.day < 1 || d.day > 31 || d.hour > 23 ||
+      d.minute > 59 || d.second > 59) {
+    error = "invalid start timestamp";
+    return false;
+  }
+  return true;
+}
+
+// A version 1 record, in place
+class FixedRecord {
+public:
+  FixedRecord(const uint8_t *p, const Header &h) : p(p), h(&h) {}
+
+  double temperature(uint8_t i) const {
+    const uint8_t *t = p + i * h->tempSize;
+    return h->tempSize == 4 ? load<float>(t) : load<double>(t);
+  }
+  bool heater() const { return p[h->numSensors * h->tempSize] != 0; }
+  uint32_t timestamp() const {
+    return load<uint32_t>(p + h->numSensors * h->tempSize + 1);
+  }
+  const uint8_t *data() const { return p; }
+
+private:
+  const uint8_t *p;
+  const Header *h;
+};
+
+// The version 1 records of a file, a strided view into the mapping
+class FixedRecords {
+public:
+  FixedRecords(const uint8_t *p, size_t count, const Header &h)
+      : p(p), count(count), h(&h) {}
+
+  size_t size() const { return count; }
+  size_t stride() const { return h->recordSize; }
+  const uint8_t *data() const { return p; }
+  FixedRecord operator[](size_t i) const {
+    return FixedRecord(p + i * h->recordSize, *h);
+  }
+
+  class iterator {
+  public:
+    iterator(const uint8_t *p, const Header *h) : p(p), h(h) {}
+    FixedRecord operator*() const { return FixedRecord(p, *h); }
+    iterator &operator++() {
+      p += h->recordSize;
+      return *this;
+    }
+    bool operator!=(const iterator &o) const { return p != o.p; }
+
+  private:
+    const uint8_t *p;
+    const Header *h;
+  };
+  iterator begin() const { return iterator(p, h); }
+  iterator end() const { return iterator(p + count * h->recordSize, h); }
+
+private:
+  const uint8_t *p;
+  size_t count;
+  const Header *h;
+};
+
+// A version 3 block, in place
+struct Block {
+  enum State { VALID, EMPTY, INVALID };
+  State state;
+  const uint8_t *records; // record bytes of a valid block
+  uint16_t used;
+};
+
+class Cursor;
+
+class LogFile {
+public:
+  // Map and validate path. error() tells why it failed.
+  bool open(const std::string &path) {
+    path_ = path;
+    error_.clear();
+    return map.open(path, error_) &&
+           parseHeader(map.data(), map.size(), header_, error_);
+  }
+
+  const std::string &path() const { return path_; }
+  const std::string &error() const { return error_; }
+  const Header &header() const { return header_; }
+  const uint8_t *data() const { return map.data(); }
+  size_t size() const { return map.size(); }
+
+  // Version 1: the records
+  FixedRecords fixedRecords() const {
+    size_t n = header_.version == 1
+                   ? (size() - header_.dataOffset) / header_.recordSize
+                   : 0;
+    return FixedRecords(data() + header_.dataOffset, n, header_);
+  }
+  // The last version 1 record or version 3 block is cut off
+  bool truncated() const {
+    if (header_.version == 1)
+      return (size() - header_.dataOffset) % header_.recordSize;
+    return header_.version == 3 && size() % BLOCK_SIZE;
+  }
+
+  // Version 3: the blocks, index 1 is the first one
+  size_t blockCount() const {
+    return header_.version == 3 ? size() / BLOCK_SIZE : 0;
+  }
+  Block block(size_t index) const {
+    const uint8_t *p = data() + index * BLOCK_SIZE;
+    uint32_t seq = load<uint32_t>(p);
+    uint16_t used = load<uint16_t>(p + 4);
+    uint16_t crc = load<uint16_t>(p + 6);
+    if (seq == 0 && used == 0 && crc == 0)
+      return {Block::EMPTY, nullptr, 0};
+    if (seq != index || used > BLOCK_SIZE - BLOCK_HEADER_SIZE)
+      return {Block::INVALID, nullptr, 0};
+    uint16_t c = crc16(0xFFFF, &header_.start, sizeof(header_.start));
+    c = crc16(c, &seq, sizeof(seq));
+    c = crc16(c, p + BLOCK_HEADER_SIZE, used);
+    c = crc16(c, &used, sizeof(used));
+    if (c != crc)
+      return {Block::INVALID, nullptr, 0};
+    return {Block::VALID, p + BLOCK_HEADER_SIZE, used};
+  }
+
+  // Decode the records from the start
+  inline Cursor records() const;
+
+private:
+  std::string path_;
+  std::string error_;
+  MappedFile map;
+  Header header_;
+};
+
+// Reads the records of a file of any version in order. For version 2 and 3
+// the state of the delta decoding is the only copy; temperatures are kept in
+// quarter degrees as on the card.
+class Cursor {
+public:
+  // Start at byte offset of a record, 0 for the first. Version 2 can only
+  // start at a keyframe, version 3 at a block. The records end at byte offset
+  // stop, a record or block like offset, or at the end of the file.
+  Cursor(const LogFile &file, size_t offset = 0, size_t stop = SIZE_MAX)
+      : f(&file), h(&file.header()), temps(file.header().numSensors) {
+    pos = offset ? offset : h->dataOffset;
+    limit = std::min(stop, file.size());
+    end = h->version == 3 ? pos : limit;
+    block = pos / BLOCK_SIZE;
+  }
+
+  // Move to the next record. Returns false at the end of the file.
+  bool next() {
+    if (h->version == 1)
+      return nextFixed();
+    while (true) {
+      if (pos < end && decode())
+        return true;
+      if (h->version == 2 || !nextBlock())
+        return false;
+    }
+  }
+
+  // Seconds since 1970, see toEpoch()
+  int64_t time() const { return seconds; }
+  uint32_t timestamp() const { return fromEpoch(seconds); }
+  uint8_t status() const { return status_; }
+  uint8_t numSensors() const { return h->numSensors; }
+  // Degrees, NaN without a reading
+  double temperature(uint8_t i) const {
+    if (h->version == 1)
+      return FixedRecord(f->data() + recordPos, *h).temperature(i);
+    return temps[i] == NO_TEMPERATURE ? NAN : temps[i] / 4.0;
+  }
+  // Quarter degrees, NO_TEMPERATURE without a reading
+  int16_t quarterDegrees(uint8_t i) const {
+    if (h->version != 1)
+      return temps[i];
+    double t = temperature(i) * 4;
+    return std::isfinite(t) && t > -32767 && t < 32767 ? int16_t(lround(t))
+                                                        : NO_TEMPERATURE;
+  }
+  // Byte offset of the current record, and of the block holding it
+  size_t recordOffset() const { return recordPos; }
+  size_t blockOffset() const {
+    return h->version == 3 ? block * BLOCK_SIZE : recordPos;
+  }
+
+  // Problems seen so far: version 3 blocks that failed their check, blocks
+  // or a version 1/2 tail that could not be decoded
+  uint32_t invalidBlocks() const { return invalid; }
+  uint32_t corruptBlocks() const { return corrupt; }
+
+private:
+  const LogFile *f;
+  const Header *h;
+  std::vector<int16_t> temps;
+  size_t pos;       // next byte to decode
+  size_t end;       // end of the records of the block, or the file
+  size_t limit;     // where the records end
+  size_t recordPos = 0;
+  size_t block;
+  int64_t seconds = 0;
+  int64_t interval = 0;
+  bool haveKeyframe = false;
+  bool blockLoaded = false;
+  uint8_t status_ = 0;
+  uint32_t invalid = 0;
+  uint32_t corrupt = 0;
+
+  bool nextFixed() {
+    if (pos + h->recordSize > limit) {
+      if (pos < limit)
+        corrupt++, pos = limit;
+      return false;
+    }
+    FixedRecord r(f->data() + pos, *h);
+    recordPos = pos;
+    pos += h->recordSize;
+    seconds = toEpoch(r.timestamp());
+    status_ = RECORD | (r.heater() ? HEATER_ENABLED : 0);
+    return true;
+  }
+
+  bool nextBlock() {
+    if (blockLoaded)
+      block++;
+    blockLoaded = true;
+    for (; block < f->blockCount() && block * BLOCK_SIZE < limit; block++) {
+      Block b = f->block(block);
+      if (b.state == Block::INVALID)
+        invalid++;
+      if (b.state != Block::VALID || b.used == 0)
+        continue;
+      pos = block * BLOCK_SIZE + BLOCK_HEADER_SIZE;
+      end = pos + b.used;
+      haveKeyframe = false;
+      return true;
+    }
+    pos = end = limit;
+    return false;
+  }
+
+  bool varint(int32_t &value) {
+    uint32_t v = 0;
+    for (int shift = 0; shift < 35; shift += 7) {
+      if (pos >= end)
+        return false;
+      uint8_t b = f->data()[pos++];
+      v |= uint32_t(b & 0x7F) << shift;
+      if (!(b & 0x80)) {
+        value = int32_t(v >> 1) ^ -int32_t(v & 1);
+        return true;
+      }
+    }
+    return false;
+  }
+
+  // Decode the record at pos. A bad record ends the block, or a version 2
+  // file: the status byte without RECORD is where version 2 ends normally.
+  bool decode() {
+    const uint8_t *d = f->data();
+    uint8_t s = d[pos];
+    if (!(s & RECORD) || (s & RESERVED)) {
+      if (h->version == 3)
+        corrupt++;
+      pos = end;
+      return false;
+    }
+    size_t at = pos++;
+    bool ok = true;
+    if (s & KEYFRAME) {
+      if (pos + 4 + 2 * h->numSensors > end) {
+        ok = false;
+      } else {
+        seconds = toEpoch(load<uint32_t>(d + pos));
+        for (uint8_t i = 0; i < h->numSensors; i++)
+          temps[i] = load<int16_t>(d + pos + 4 + 2 * i);
+        pos += 4 + 2 * h->numSensors;
+        interval = 0;
+        haveKeyframe = true;
+      }
+    } else if (!haveKeyframe) {
+      ok = false;
+    } else {
+      int32_t v = 0;
+      if (!(s & SAME_INTERVAL) && (ok = varint(v)))
+        interval = v;
+      for (uint8_t i = 0; ok && i < h->numSensors; i++) {
+        ok = varint(v);
+        temps[i] += v;
+      }
+      seconds += interval;
+    }
+    if (!ok) {
+      corrupt++;
+      pos = end;
+      return false;
+    }
+    recordPos = at;
+    status_ = s;
+    return true;
+  }
+};
+
+inline Cursor LogFile::records() const { return Cursor(*this); }
+
+// Merges the records of several files, e.g. the rotated segments of one or
+// more recordings, into one stream ordered by time. Memory does not grow with
+// the files: a heap holds the next record of each of them. Records with the
+// same time come in the order the files were given.
+//
+// Where files overlap, as a segment and a copy of it, or two segments that
+// both got the records around the rotation, a record is dropped if an
+// earlier file had as many equal records at the same time: the same status
+// bits and temperatures, whether they were encoded as keyframes or steps.
+// Equal records within one file are all kept.
+class Merger {
+public:
+  explicit Merger(const std::vector<const LogFile *> &files) {
+    for (const LogFile *f : files)
+      cursors.emplace_back(*f);
+    for (size_t i = 0; i < cursors.size(); i++) {
+      if (cursors[i].next())
+        heap.push_back(i);
+    }
+    std::make_heap(heap.begin(), heap.end(), Later{&cursors});
+  }
+
+  // Move to the next record. Returns false when all files are done.
+  bool next() {
+    Later later{&cursors};
+    while (true) {
+      if (started && cursors[cur].next()) {
+        heap.push_back(cur);
+        std::push_heap(heap.begin(), heap.end(), later);
+      }
+      started = true;
+      if (heap.empty())
+        return false;
+      std::pop_heap(heap.begin(), heap.end(), later);
+      cur = heap.back();
+      heap.pop_back();
+      if (!isDuplicate())
+        return true;
+      duplicates_++;
+    }
+  }
+
+  // The current record, and the index of the file it is from
+  const Cursor &current() const { return cursors[cur]; }
+  size_t source() const { return cur; }
+  uint64_t duplicates() const { return duplicates_; }
+  const Cursor &cursor(size_t i) const { return cursors[i]; }
+
+private:
+  // Heap order: the earliest record on top, then the first file
+  struct Later {
+    const std::vector<Cursor> *c;
+    bool operator()(size_t a, size_t b) const {
+      int64_t ta = (*c)[a].time(), tb = (*c)[b].time();
+      return ta != tb ? ta > tb : a > b;
+    }
+  };
+
+  std::vector<Cursor> cursors;
+  std::vector<size_t> heap;
+  size_t cur = 0;
+  bool started = false;
+  uint64_t duplicates_ = 0;
+
+  // The different records of each file at the current time, and how often
+  // each occurred. Only a second of records is kept, their temperatures in
+  // one buffer that keeps its capacity from second to second.
+  struct Seen {
+    size_t source;
+    uint8_t status;
+    size_t temps; // offset in seenTemps, numSensors of the source
+    uint32_t count;
+  };
+  std::vector<Seen> seen;
+  std::vector<int16_t> seenTemps;
+  int64_t seenTime = 0;
+
+  // The bits of a record that are data, not how it was encoded: the same
+  // record can be a keyframe in one file and a step in another
+  static uint8_t data(uint8_t status) {
+    return status & (HEATER_ENABLED | HEATING | SENSOR_ERROR);
+  }
+  bool equal(const Seen &s, const Cursor &c) const {
+    if (s.status != data(c.status()) ||
+        cursors[s.source].numSensors() != c.numSensors())
+      return false;
+    for (uint8_t i = 0; i < c.numSensors(); i++) {
+      if (seenTemps[s.temps + i] != c.quarterDegrees(i))
+        return false;
+    }
+    return true;
+  }
+
+  bool isDuplicate() {
+    const Cursor &c = cursors[cur];
+    if (seen.empty() || c.time() != seenTime) {
+      seen.clear();
+      seenTemps.clear();
+      seenTime = c.time();
+    }
+    uint32_t n = 0;
+    for (Seen &s : seen) {
+      if (s.source == cur && equal(s, c))
+        n = ++s.count;
+    }
+    if (!n) {
+      seen.push_back({cur, data(c.status()), seenTemps.size(), 1});
+      for (uint8_t i = 0; i < c.numSensors(); i++)
+        seenTemps.push_back(c.quarterDegrees(i));
+      n = 1;
+    }
+    for (const Seen &s : seen) {
+      if (s.source != cur && s.count >= n && equal(s, c))
+        return true;
+    }
+    return false;
+  }
+};
+
+// Writes a version 3 log as Log::logData() does: a block per sector, each
+// starting with a keyframe, and a keyframe every KEYFRAME_INTERVAL records.
+class LogWriter {
+public:
+  static const uint32_t KEYFRAME_INTERVAL = 60; // LOG_KEYFRAME_INTERVAL
+
+  ~LogWriter() {
+    if (out)
+      fclose(out);
+  }
+
+  // Create path and write the header. start is the packed timestamp of the
+  // header, which is the file id of the blocks.
+  bool open(const std::string &path, uint8_t numSensors, uint32_t start) {
+    this->numSensors = numSensors;
+    this->start = start;
+    temps.assign(numSensors, 0);
+    fill = 0;
+    blockIndex = 1;
+    if (!(out = fopen(path.c_str(), "wb")))
+      return fail("cannot create " + path);
+    uint8_t header[BLOCK_SIZE] = {'T', 'E', 'M', 'P', 'L', 'O', 'G', 3,
+                                  numSensors};
+    memcpy(header + 9, &start, sizeof(start));
+    if (fwrite(header, 1, sizeof(header), out) != sizeof(header))
+      return fail("cannot write " + path);
+    return true;
+  }
+
+  // Add a record: seconds since 1970, the status bits HEATER_ENABLED, HEATING
+  // and SENSOR_ERROR, and numSensors temperatures, NaN without a reading
+  bool add(int64_t seconds, uint8_t status, const double *temperatures) {
+    // Records do not span blocks
+    if (fill + 1 + 5 + 3 * numSensors > BLOCK_SIZE && !flush())
+      return false;
+    if (fill == 0) {
+      fill = BLOCK_HEADER_SIZE;
+      sinceKeyframe = KEYFRAME_INTERVAL;
+    }
+    int64_t delta = seconds - this->seconds;
+    bool keyframe =
+        sinceKeyframe >= KEYFRAME_INTERVAL || delta != int32_t(delta);
+    status = (status & (HEATER_ENABLED | HEATING | SENSOR_ERROR)) | RECORD;
+    if (keyframe)
+      status |= KEYFRAME;
+    else if (delta == interval)
+      status |= SAME_INTERVAL;
+    block[fill++] = status;
+    if (keyframe) {
+      uint32_t timestamp = fromEpoch(seconds);
+      memcpy(block + fill, &timestamp, sizeof(timestamp));
+      fill += sizeof(timestamp);
+      sinceKeyframe = 0;
+      delta = 0;
+    } else if (!(status & SAME_INTERVAL)) {
+      varint(int32_t(delta));
+    }
+    for (uint8_t i = 0; i < numSensors; i++) {
+      // Quarter degrees, rounded as on the card
+      float t = float(temperatures[i]) * 4;
+      int16_t q = (t > -32767 && t < 32767) ? int16_t(lroundf(t))
+                                            : NO_TEMPERATURE;
+      if (keyframe) {
+        memcpy(block + fill, &q, sizeof(q));
+        fill += sizeof(q);
+      } else {
+        varint(int32_t(q) - temps[i]);
+      }
+      temps[i] = q;
+    }
+    this->seconds = seconds;
+    interval = delta;
+    sinceKeyframe++;
+    return true;
+  }
+
+  // Write the block being filled as well, as far as it is, as Log::update()
+  // syncs. It is written again in its place when more records are added.
+  bool sync() {
+    if (!out)
+      return true;
+    if (fill) {
+      seal();
+      if (fwrite(block, 1, BLOCK_SIZE, out) != BLOCK_SIZE ||
+          fseek(out, -long(BLOCK_SIZE), SEEK_CUR) != 0)
+        return fail("cannot write");
+    }
+    if (fflush(out) != 0)
+      return fail("cannot write");
+    return true;
+  }
+
+  // Write the last block and close the file
+  bool close() {
+    bool ok = flush();
+    if (out && fclose(out) != 0 && ok)
+      ok = fail("cannot write");
+    out = nullptr;
+    return ok;
+  }
+
+  const std::string &error() const { return error_; }
+  // The size of the file, with the block being filled
+  uint64_t size() const {
+    return uint64_t(blockIndex + (fill ? 1 : 0)) * BLOCK_SIZE;
+  }
+
+private:
+  FILE *out = nullptr;
+  std::string error_;
+  uint8_t numSensors = 0;
+  uint32_t start = 0;
+  uint8_t block[BLOCK_SIZE];
+  size_t fill = 0; // bytes of block used, 0 before its header
+  uint32_t blockIndex = 1;
+  uint32_t sinceKeyframe = 0;
+  int64_t seconds = 0;
+  int64_t interval = 0;
+  std::vector<int16_t> temps;
+
+  bool fail(const std::string &what) {
+    error_ = what + ": " + strerror(errno);
+    return false;
+  }
+
+  void varint(int32_t value) {
+    uint32_t v = (uint32_t(value) << 1) ^ uint32_t(value >> 31);
+    while (v >= 0x80) {
+      block[fill++] = uint8_t(v) | 0x80;
+      v >>= 7;
+    }
+    block[fill++] = uint8_t(v);
+  }
+
+  // Fill in the header of the block being filled, as Log::sealBlock()
+  void seal() {
+    uint16_t used = uint16_t(fill - BLOCK_HEADER_SIZE);
+    uint16_t crc = crc16(0xFFFF, &start, sizeof(start));
+    crc = crc16(crc, &blockIndex, sizeof(blockIndex));
+    crc = crc16(crc, block + BLOCK_HEADER_SIZE, used);
+    crc = crc16(crc, &used, sizeof(used));
+    memcpy(block, &blockIndex, sizeof(blockIndex));
+    memcpy(block + 4, &used, sizeof(used));
+    memcpy(block + 6, &crc, sizeof(crc));
+    memset(block + fill, 0, BLOCK_SIZE - fill);
+  }
+
+  // Seal the block being filled and write it
+  bool flush() {
+    if (fill == 0)
+      return true;
+    seal();
+    fill = 0;
+    blockIndex++;
+    if (fwrite(block, 1, BLOCK_SIZE, out) != BLOCK_SIZE)
+      return fail("cannot write");
+    return true;
+  }
+};
+
+} // namespace templog
+
+#endif
@@ -0,0 +1,283 @@
+// The column codecs of the archive, queries with thresholds against a full
+// scan of the log, and a damaged directory
+#include "ArduinoUnitTests.h"
+#include "archive.h"
+#include "test/tempFile.h"
+
+using namespace templog;
+
+const int64_t START = 1735646400; // 2024-12-31 12:00:00
+
+static bool sameValue(double a, double b) {
+  return std::isnan(a) ? std::isnan(b) : a == b;
+}
+
+static void checkTimes(const std::vector<int64_t> &t, int64_t first) {
+  BitWriter w;
+  Archive::encodeTimes(t.data(), t.size(), first, w);
+  std::vector<uint8_t> &bits = w.finish();
+  std::vector<int64_t> decoded(t.size());
+  assertTrue(Archive::decodeTimes(bits.data(), bits.size(), first,
+                                  decoded.data(), decoded.size()));
+  assertTrue(t == decoded);
+}
+
+static void checkValues(const std::vector<double> &v) {
+  BitWriter w;
+  Archive::encodeValues(v.data(), v.size(), w);
+  std::vector<uint8_t> &bits = w.finish();
+  std::vector<double> decoded(v.size());
+  assertTrue(Archive::decodeValues(bits.data(), bits.size(), decoded.data(),
+                                   decoded.size()));
+  bool same = true;
+  for (size_t i = 0; i < v.size(); i++)
+    same = same && sameValue(v[i], decoded[i]);
+  assertTrue(same);
+}
+
+static void checkStatus(const std::vector<uint8_t> &s) {
+  std::vector<uint8_t> runs;
+  Archive::encodeStatus(s.data(), s.size(), runs);
+  std::vector<uint8_t> decoded(s.size());
+  assertTrue(Archive::decodeStatus(runs.data(), runs.size(), decoded.data(),
+                                   decoded.size()));
+  // RECORD is implied
+  for (size_t i = 0; i < s.size(); i++)
+    assertEqual(s[i] | RECORD, decoded[i]);
+}
+
+unittest(times_round_trip) {
+  // One record, steady, steps of every width, back in time, and extremes
+  checkTimes({START}, START);
+  checkTimes({START + 5}, START);
+  std::vector<int64_t> t;
+  for (int i = 0; i < 100; i++)
+    t.push_back(START + i);
+  for (int64_t step : {2, 60, 200, 3000, 86400 * 40})
+    t.push_back(t.back() + step);
+  t.push_back(t.back() - 7200);
+  t.push_back(t.back() - 1);
+  t.push_back(t.back());
+  t.push_back(INT64_MAX);
+  t.push_back(INT64_MIN);
+  t.push_back(0);
+  checkTimes(t, START);
+}
+
+unittest(values_round_trip) {
+  checkValues({21.25});
+  checkValues({NAN});
+  std::vector<double> v = {20, 20, 20, NAN, NAN, 20.25, -10.75, -10.75};
+  for (int i = 0; i < 200; i++)
+    v.push_back(150 + (i * 37 % 11 - 5) * 0.25);
+  v.push_back(INFINITY);
+  v.push_back(-0.0);
+  v.push_back(1e-300);
+  v.push_back(8191.75);
+  v.push_back(NAN);
+  checkValues(v);
+}
+
+unittest(status_round_trip) {
+  checkStatus({HEATER_ENABLED});
+  std::vector<uint8_t> s(300, HEATER_ENABLED | HEATING);
+  s.insert(s.end(), 20000, HEATER_ENABLED);
+  s.push_back(SENSOR_ERROR);
+  s.push_back(0);
+  s.push_back(HEATER_ENABLED | SENSOR_ERROR);
+  checkStatus(s);
+}
+
+// A log of two sensors, the second one failing now and then
+static bool writeLog(const std::string &path, int records) {
+  LogWriter w;
+  if (!w.open(path, 2, fromEpoch(START)))
+    return false;
+  for (int i = 0; i < records; i++) {
+    double t[2] = {100 + 80 * std::sin(i / 500.0) + (i % 7) * 0.25,
+                   i / 900 % 3 == 2 ? NAN : 20 + i % 13 * 0.25};
+    uint8_t status = t[0] < 120 ? HEATER_ENABLED | HEATING : HEATER_ENABLED;
+    if (std::isnan(t[1]))
+      status |= SENSOR_ERROR;
+    if (!w.add(START + i + i / 1000 * 60, status, t))
+      return false;
+  }
+  return w.close();
+}
+
+static bool writeArchive(const LogFile &f, const std::string &path,
+                         uint32_t chunkRecords) {
+  ArchiveWriter w;
+  bool ok = w.open(path, f.header(), chunkRecords);
+  Cursor c = f.records();
+  while (ok && c.next())
+    ok = w.add(c);
+  return w.close() && ok;
+}
+
+unittest(one_record_chunks) {
+  test::TempFile log, arc;
+  assertTrue(writeLog(log.path(), 30));
+  LogFile f;
+  assertTrue(f.open(log.path()));
+  assertTrue(writeArchive(f, arc.path(), 1));
+  Archive a;
+  assertTrue(a.open(arc.path()));
+  assertEqual(size_t(30), a.chunkCount());
+  ArchiveChunk chunk;
+  Cursor c = f.records();
+  for (size_t i = 0; i < a.chunkCount() && c.next(); i++) {
+    assertTrue(a.decode(i, chunk));
+    assertEqual(size_t(1), chunk.times.size());
+    assertEqual(c.time(), chunk.times[0]);
+    assertTrue(sameValue(c.temperature(0), chunk.temperatures[0]));
+    assertTrue(sameValue(c.temperature(1), chunk.temperatures[1]));
+  }
+}
+
+struct Row {
+  int64_t time;
+  uint8_t status;
+  double t[2];
+};
+
+template <class Record> static Row row(const Record &r) {
+  return {r.time(),
+          uint8_t(r.status() & (HEATER_ENABLED | HEATING | SENSOR_ERROR)),
+          {r.temperature(0), r.temperature(1)}};
+}
+
+static bool sameRows(const std::vector<Row> &a, const std::vector<Row> &b) {
+  if (a.size() != b.size())
+    return false;
+  for (size_t i = 0; i < a.size(); i++) {
+    if (a[i].time != b[i].time || a[i].status != b[i].status ||
+        !sameValue(a[i].t[0], b[i].t[0]) || !sameValue(a[i].t[1], b[i].t[1]))
+      return false;
+  }
+  return true;
+}
+
+// The thresholds and time window applied to every record of the log
+static std::vector<Row> scan(const LogFile &f, int64_t from, int64_t to,
+                             const std::vector<Threshold> &thresholds) {
+  std::vector<Row> rows;
+  Cursor c = f.records();
+  while (c.next()) {
+    bool pass = c.time() >= from && c.time() <= to;
+    for (const Threshold &t : thresholds)
+      pass = pass && t.passes(c);
+    if (pass)
+      rows.push_back(row(c));
+  }
+  return rows;
+}
+
+unittest(pushdown_matches_full_scan) {
+  test::TempFile log, arc;
+  assertTrue(writeLog(log.path(), 20000));
+  LogFile f;
+  assertTrue(f.open(log.path()));
+  assertTrue(writeArchive(f, arc.path(), 500));
+  Archive a;
+  assertTrue(a.open(arc.path()));
+  assertEqual(uint64_t(20000), a.records());
+
+  struct Query {
+    int64_t from, to;
+    std::vector<Threshold> thresholds;
+  };
+  std::vector<Query> queries = {
+      {INT64_MIN, INT64_MAX, {}},
+      {START + 3000, START + 9000, {}},
+      {INT64_MIN, INT64_MAX, {{0, true, 170}}},
+      {INT64_MIN, INT64_MAX, {{0, false, 25.5}}},
+      {INT64_MIN, INT64_MAX, {{1, true, 22.75}}},
+      {START + 1000, START + 15000, {{0, true, 100}, {1, false, 21}}},
+      // Nothing passes
+      {INT64_MIN, INT64_MAX, {{0, true, 1000}}},
+  };
+  size_t skippedAny = 0;
+  for (const Query &q : queries) {
+    std::vector<Row> rows;
+    size_t skipped, damaged;
+    a.query(q.from, q.to, q.thresholds,
+            [&](const ArchiveRecord &r) { rows.push_back(row(r)); }, &skipped,
+            &damaged);
+    assertEqual(size_t(0), damaged);
+    assertTrue(sameRows(scan(f, q.from, q.to, q.thresholds), rows));
+    skippedAny += skipped;
+  }
+  // The directory ruled out chunks
+  assertMore(skippedAny, size_t(0));
+}
+
+// The records of one chunk in the directory set to a count the chunk can
+// not hold
+unittest(damaged_record_count) {
+  test::TempFile log, arc;
+  assertTrue(writeLog(log.path(), 5000));
+  LogFile f;
+  assertTrue(f.open(log.path()));
+  assertTrue(writeArchive(f, arc.path(), 1000));
+  // The directory entry of the second chunk
+  size_t entry;
+  {
+    Archive a;
+    assertTrue(a.open(arc.path()));
+    assertEqual(size_t(5), a.chunkCount());
+    entry = a.size() - Archive::FOOTER_SIZE -
+            (a.chunkCount() - 1) * a.entrySize();
+  }
+
+  std::vector<uint8_t> data;
+  assertTrue(arc.read(data));
+  uint32_t records = 0xFFFFFFF0;
+  memcpy(&data[entry + 8], &records, sizeof(records));
+  assertTrue(arc.write(data));
+  Archive a;
+  assertTrue(a.open(arc.path()));
+  assertFalse(a.chunk(0).damaged);
+  assertTrue(a.chunk(1).damaged);
+  assertEqual(uint64_t(4000), a.records());
+  ArchiveChunk chunk;
+  assertFalse(a.decode(1, chunk));
+  assertTrue(a.decode(2, chunk));
+
+  uint64_t n = 0;
+  size_t damaged;
+  a.query(INT64_MIN, INT64_MAX, {}, [&](const ArchiveRecord &) { n++; },
+          nullptr, &damaged);
+  assertEqual(uint64_t(4000), n);
+  assertEqual(size_t(1), damaged);
+}
+
+// A header, 20 bytes and a footer whose directory offset and count only
+// add up to where the footer starts when the sum wraps around
+unittest(forged_footer) {
+  const uint8_t SENSORS = 6; // directory entries of 56 bytes
+  std::vector<uint8_t> data = {'T', 'E', 'M', 'P', 'A', 'R', 'C',
+                               Archive::VERSION, SENSORS, 3};
+  data.resize(Archive::HEADER_SIZE + 20);
+  uint64_t dir = uint64_t(0) - 20;
+  uint32_t n = 1;
+  data.insert(data.end(), (uint8_t *)&dir, (uint8_t *)&dir + 8);
+  data.insert(data.end(), (uint8_t *)&n, (uint8_t *)&n + 4);
+  data.insert(data.end(), {'T', 'A', 'R', 'C'});
+  assertEqual(size_t(52), data.size());
+  test::TempFile arc;
+  assertTrue(arc.write(data));
+  Archive a;
+  assertFalse(a.open(arc.path()));
+  assertEqual(std::string("invalid directory"), a.error());
+
+  // More entries than the file has room for
+  dir = Archive::HEADER_SIZE;
+  n = 0xFFFFFFFF;
+  memcpy(&data[data.size() - Archive::FOOTER_SIZE], &dir, 8);
+  memcpy(&data[data.size() - Archive::FOOTER_SIZE + 8], &n, 4);
+  assertTrue(arc.write(data));
+  assertFalse(a.open(arc.path()));
+}
+
+unittest_main()
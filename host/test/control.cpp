@@ -0,0 +1,139 @@
+// ControlAnalyzer on the trace of a heater switched with hysteresis, whose
+// element heats and cools with a lag, so the temperature runs past the
+// switching points. A long lag first rings, a short one after holds a steady
+// oscillation wider than the band around the target.
+#include "ArduinoUnitTests.h"
+#include "control.h"
+
+#include <deque>
+#include <functional>
+
+using namespace templog;
+
+const int64_t START = 1735646400; // 2024-12-31 12:00:00
+const uint32_t STEADY =
+    ControlAnalyzer<void (*)(const ControlStats &)>::STEADY_CYCLES;
+
+struct Reading {
+  int64_t time_;
+  uint8_t status_;
+  double temp;
+
+  int64_t time() const { return time_; }
+  uint8_t status() const { return status_; }
+  uint8_t numSensors() const { return 1; }
+  double temperature(uint8_t) const { return temp; }
+};
+
+struct Trace {
+  std::vector<Reading> readings;
+  std::vector<int64_t> switches; // the times the heater switched, from 1
+};
+
+// Seconds of a heater switching on at 198 and off at 202, so the target is
+// 200. The element follows switch n after lag(n) seconds, switch 0 is the
+// start, and then heats by 0.5 or cools by 0.25 degrees a second.
+static Trace trace(int seconds, std::function<int(size_t)> lag) {
+  Trace tr;
+  double temp = 20;
+  bool heating = true, power = false;
+  std::deque<std::pair<int64_t, bool>> element = {{START + lag(0), true}};
+  for (int i = 0; i < seconds; i++) {
+    int64_t t = START + i;
+    bool was = heating;
+    if (temp >= 202)
+      heating = false;
+    else if (temp <= 198)
+      heating = true;
+    if (heating != was) {
+      tr.switches.push_back(t);
+      element.push_back({t + lag(tr.switches.size()), heating});
+    }
+    tr.readings.push_back(
+        {t, uint8_t(HEATER_ENABLED | (heating ? HEATING : 0)), temp});
+    while (!element.empty() && element.front().first <= t) {
+      power = element.front().second;
+      element.pop_front();
+    }
+    temp += power ? 0.5 : -0.25;
+  }
+  return tr;
+}
+
+static std::vector<ControlStats> analyze(const Trace &tr,
+                                         const ControlOptions &opt = {}) {
+  std::vector<ControlStats> stats;
+  ControlAnalyzer analyzer(
+      opt, [&](const ControlStats &s) { stats.push_back(s); });
+  for (const Reading &r : tr.readings)
+    analyzer.add(r);
+  analyzer.finish();
+  return stats;
+}
+
+// 20 seconds of lag until switch 6, 4 after
+static int ringing(size_t n) { return n < 6 ? 20 : 4; }
+
+unittest(overshoot_and_settling) {
+  Trace tr = trace(3000, ringing);
+  assertMore(tr.switches.size(), size_t(40));
+  std::vector<ControlStats> stats = analyze(tr);
+  assertEqual(size_t(1), stats.size());
+  const ControlStats &s = stats[0];
+  assertEqual(200.0, s.target);
+  // 202 + 20 * 0.5 after the first switch off, 198 - 20 * 0.25 after the
+  // switch on
+  assertEqual(12.0, s.overshoot);
+  assertEqual(7.0, s.undershoot);
+  // Steady from switch 6 on, between 197 and 204, outside 200 +- 3
+  assertEqual(tr.switches[5] - START, s.settling);
+  assertEqual(int64_t(2999), s.seconds());
+
+  // Known to the analyzer the same
+  ControlOptions opt;
+  opt.target = 200;
+  std::vector<ControlStats> known = analyze(tr, opt);
+  assertEqual(size_t(1), known.size());
+  assertEqual(s.settling, known[0].settling);
+}
+
+// The lag swings between long and short every other cycle
+unittest(never_settled) {
+  Trace tr = trace(3000, [](size_t n) { return n / 4 % 2 ? 20 : 4; });
+  std::vector<ControlStats> stats = analyze(tr);
+  assertEqual(size_t(1), stats.size());
+  assertEqual(int64_t(-1), stats[0].settling);
+  assertEqual(200.0, stats[0].target);
+}
+
+// Disabled before the oscillation held STEADY_CYCLES cycles
+unittest(too_short_to_settle) {
+  Trace tr = trace(3000, ringing);
+  // Cycles from switch 6 on, each ended by the switch after next, until
+  // the one before STEADY
+  int64_t end = tr.switches[5 + STEADY];
+  std::vector<Reading> cut;
+  for (const Reading &r : tr.readings)
+    if (r.time() <= end)
+      cut.push_back(r);
+  cut.push_back({end + 1, 0, cut.back().temp});
+  tr.readings = cut;
+  std::vector<ControlStats> stats = analyze(tr);
+  assertEqual(size_t(1), stats.size());
+  assertEqual(int64_t(-1), stats[0].settling);
+
+  // One more cycle is enough
+  tr = trace(3000, ringing);
+  end = tr.switches[5 + STEADY + 1];
+  cut.clear();
+  for (const Reading &r : tr.readings)
+    if (r.time() <= end)
+      cut.push_back(r);
+  cut.push_back({end + 1, 0, cut.back().temp});
+  tr.readings = cut;
+  stats = analyze(tr);
+  assertEqual(size_t(1), stats.size());
+  assertEqual(tr.switches[5] - START, stats[0].settling);
+}
+
+unittest_main()
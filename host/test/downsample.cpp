@@ -0,0 +1,189 @@
+// Lttb against LTTB over all records at once, as it is defined in
+// downsample.h, on a deterministic run with heater steps, and the number of
+// records it keeps of a heater that switches all the time
+#include "ArduinoUnitTests.h"
+#include "downsample.h"
+
+#include <set>
+
+using namespace templog;
+
+const int64_t START = 1735646400; // 2024-12-31 12:00:00
+const uint8_t SENSORS = 2;
+
+struct Run {
+  std::vector<Sample> records;
+  int64_t from, to;
+};
+
+// Irregular times, two sensors that wander with some noise, and the heater
+// switching, the element in cycles and heating off for a while
+static Run run(int n) {
+  Run r;
+  int64_t t = START;
+  for (int i = 0; i < n; i++) {
+    t += 1 + (i % 50 == 0 ? 20 : 0) + (i % 7 == 3);
+    Sample s;
+    s.time_ = t;
+    s.status_ = RECORD | (i >= 500 && i < 520 ? 0 : HEATER_ENABLED) |
+                (i / 83 % 2 ? HEATING : 0);
+    s.temps = {100 + 50 * std::sin(i / 37.0) + (i * 7919 % 13 - 6) * 0.5,
+               20 + (i * 104729 % 17) * 0.25 + i / 100};
+    r.records.push_back(s);
+  }
+  r.from = r.records.front().time();
+  r.to = r.records.back().time();
+  return r;
+}
+
+// The indices of the records LTTB keeps with points buckets
+// The records of each bucket that has any, in order
+static std::vector<std::vector<size_t>> buckets(const Run &r, size_t points) {
+  double scale = double(points) / (double(r.to) - double(r.from) + 1);
+  std::vector<std::vector<size_t>> buckets;
+  int64_t index = -1;
+  for (size_t i = 0; i < r.records.size(); i++) {
+    int64_t k = int64_t((double(r.records[i].time()) - double(r.from)) * scale);
+    if (k != index)
+      buckets.emplace_back();
+    index = k;
+    buckets.back().push_back(i);
+  }
+  return buckets;
+}
+
+static bool isStep(const std::vector<Sample> &rec, size_t i) {
+  uint8_t bits = HEATER_ENABLED | HEATING;
+  return i && (rec[i].status() & bits) != (rec[i - 1].status() & bits);
+}
+
+// The first and the last heater step of each bucket
+static std::set<size_t> steps(const Run &r, size_t points) {
+  std::set<size_t> steps;
+  for (const std::vector<size_t> &b : buckets(r, points)) {
+    std::vector<size_t> in;
+    for (size_t i : b)
+      if (isStep(r.records, i))
+        in.push_back(i);
+    if (!in.empty()) {
+      steps.insert(in.front());
+      steps.insert(in.back());
+    }
+  }
+  return steps;
+}
+
+static std::set<size_t> bruteForce(const Run &r, size_t points) {
+  const std::vector<Sample> &rec = r.records;
+  std::vector<std::vector<size_t>> buckets = ::buckets(r, points);
+  auto time = [&](size_t i) { return double(rec[i].time() - r.from); };
+
+  std::set<size_t> keep = {0, rec.size() - 1};
+  for (size_t i : steps(r, points)) {
+    keep.insert(i - 1);
+    keep.insert(i);
+  }
+  for (uint8_t s = 0; s < SENSORS; s++) {
+    double at = time(0), ay = rec[0].temperature(s);
+    for (size_t b = 0; b < buckets.size(); b++) {
+      // The mean of the next bucket, or the last record
+      double ct = 0, cy = 0;
+      if (b + 1 < buckets.size()) {
+        for (size_t i : buckets[b + 1]) {
+          ct += time(i);
+          cy += rec[i].temperature(s);
+        }
+        ct /= buckets[b + 1].size();
+        cy /= buckets[b + 1].size();
+      } else {
+        ct = time(rec.size() - 1);
+        cy = rec.back().temperature(s);
+      }
+      double best = -1;
+      size_t picked = 0;
+      for (size_t i : buckets[b]) {
+        double area = std::fabs((at - ct) * (rec[i].temperature(s) - ay) -
+                                (at - time(i)) * (cy - ay));
+        if (area > best) {
+          best = area;
+          picked = i;
+        }
+      }
+      keep.insert(picked);
+      at = time(picked);
+      ay = rec[picked].temperature(s);
+    }
+  }
+  return keep;
+}
+
+static std::vector<Sample> downsample(const Run &r, size_t points) {
+  std::vector<Sample> out;
+  Lttb lttb(SENSORS, r.from, r.to, points,
+            [&](const Sample &s) { out.push_back(s); });
+  for (const Sample &s : r.records)
+    lttb.add(s);
+  lttb.finish();
+  return out;
+}
+
+unittest(matches_brute_force) {
+  Run r = run(3000);
+  for (size_t points : {1, 7, 50, 400}) {
+    std::vector<Sample> picked = downsample(r, points);
+    std::set<size_t> expected = bruteForce(r, points);
+    assertEqual(expected.size(), picked.size());
+    size_t k = 0;
+    for (size_t i : expected) {
+      if (k == picked.size())
+        break;
+      assertEqual(r.records[i].time(), picked[k].time());
+      assertEqual(r.records[i].temperature(0), picked[k].temperature(0));
+      k++;
+    }
+  }
+}
+
+unittest(keeps_ends_and_heater_steps) {
+  Run r = run(3000);
+  std::vector<Sample> picked = downsample(r, 20);
+  assertMore(picked.size(), size_t(20));
+  assertEqual(r.records.front().time(), picked.front().time());
+  assertEqual(r.records.back().time(), picked.back().time());
+  // The steps of the run are far enough apart that with 1000 points no
+  // bucket has more than one, and all of them are kept
+  std::set<size_t> all;
+  for (size_t i = 0; i < r.records.size(); i++)
+    if (isStep(r.records, i))
+      all.insert(i);
+  assertMore(all.size(), size_t(30));
+  assertTrue(all == steps(r, 1000));
+  for (size_t points : {20, 1000}) {
+    std::set<int64_t> times;
+    for (const Sample &s : downsample(r, points))
+      times.insert(s.time());
+    for (size_t i : steps(r, points)) {
+      assertTrue(times.count(r.records[i].time()));
+      assertTrue(times.count(r.records[i - 1].time()));
+    }
+  }
+  // In order of time, each once
+  for (size_t i = 1; i < picked.size(); i++)
+    assertLess(picked[i - 1].time(), picked[i].time());
+}
+
+// The heater switching on every record: the output is bounded by the
+// buckets, not by the steps
+unittest(bounded_by_points) {
+  Run r = run(20000);
+  for (size_t i = 0; i < r.records.size(); i++)
+    r.records[i].status_ = RECORD | HEATER_ENABLED | (i % 2 ? HEATING : 0);
+  for (size_t points : {1, 10, 100, 1000}) {
+    std::vector<Sample> picked = downsample(r, points);
+    assertLessOrEqual(picked.size(), points * (SENSORS + 5) + 1);
+    assertMore(picked.size(), points);
+    assertEqual(bruteForce(r, points).size(), picked.size());
+  }
+}
+
+unittest_main()
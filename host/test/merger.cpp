@@ -0,0 +1,86 @@
+// Merger over segments that overlap and copies of segments
+#include "ArduinoUnitTests.h"
+#include "templog.h"
+#include "test/tempFile.h"
+
+#include <map>
+#include <tuple>
+
+using namespace templog;
+
+const int64_t START = 1735646400; // 2024-12-31 12:00:00
+
+struct Record {
+  int64_t time;
+  uint8_t status;
+  int16_t q[2];
+  auto key() const { return std::tie(time, status, q[0], q[1]); }
+  bool operator<(const Record &o) const { return key() < o.key(); }
+  bool operator==(const Record &o) const { return key() == o.key(); }
+};
+
+// Records a second apart, and two equal ones in the same second at 50
+static std::vector<Record> recording() {
+  std::vector<Record> r;
+  for (int i = 0; i < 300; i++) {
+    uint8_t status = i / 40 % 2 ? HEATER_ENABLED | HEATING : HEATER_ENABLED;
+    r.push_back({START + i, status,
+                 {int16_t(80 + i % 17), int16_t(i % 23 ? 600 - i
+                                                       : NO_TEMPERATURE)}});
+    if (i == 50)
+      r.push_back(r.back());
+  }
+  return r;
+}
+
+// A log of records [from, to) of r. Each file starts with a keyframe, so
+// where segments overlap a record is encoded differently in each.
+static bool write(const test::TempFile &file, const std::vector<Record> &r,
+                  size_t from, size_t to) {
+  LogWriter w;
+  if (!w.open(file.path(), 2, fromEpoch(r[from].time)))
+    return false;
+  for (size_t i = from; i < to; i++) {
+    double t[2];
+    for (int s = 0; s < 2; s++)
+      t[s] = r[i].q[s] == NO_TEMPERATURE ? NAN : r[i].q[s] / 4.0;
+    if (!w.add(r[i].time, r[i].status, t))
+      return false;
+  }
+  return w.close();
+}
+
+unittest(overlapping_and_duplicated_segments) {
+  std::vector<Record> r = recording();
+  // A and B overlap by 50 records, C is a copy of A. B is given first.
+  test::TempFile a, b, c;
+  assertTrue(write(a, r, 0, 201));
+  assertTrue(write(b, r, 151, r.size()));
+  assertTrue(write(c, r, 0, 201));
+  LogFile fa, fb, fc;
+  assertTrue(fa.open(a.path()) && fb.open(b.path()) && fc.open(c.path()));
+
+  Merger m({&fb, &fa, &fc});
+  std::map<Record, int> count;
+  size_t n = 0;
+  int64_t last = INT64_MIN;
+  while (m.next()) {
+    const Cursor &cur = m.current();
+    assertLessOrEqual(last, cur.time());
+    last = cur.time();
+    Record rec = {cur.time(), uint8_t(cur.status() & (HEATER_ENABLED | HEATING |
+                                                      SENSOR_ERROR)),
+                  {cur.quarterDegrees(0), cur.quarterDegrees(1)}};
+    count[rec]++;
+    n++;
+  }
+  // Every record once, and the two equal ones in A both
+  assertEqual(r.size(), n);
+  std::map<Record, int> expected;
+  for (const Record &rec : r)
+    expected[rec]++;
+  assertTrue(count == expected);
+  assertEqual(50u + 201u, m.duplicates());
+}
+
+unittest_main()
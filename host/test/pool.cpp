@@ -0,0 +1,53 @@
+// Pool::wait() with tasks that queue more tasks, as convert queues the
+// chunks of a file: it may only return when all of them have run
+#include "ArduinoUnitTests.h"
+#include "pool.h"
+
+#include <atomic>
+
+using namespace templog;
+
+// A task that queues width tasks of the next depth, finishing some of its
+// own work between them so that the others can steal them
+static void tree(Pool &pool, std::atomic<long> &done, int depth, int width) {
+  for (int i = 0; depth > 0 && i < width; i++) {
+    pool.submit([&pool, &done, depth, width] {
+      tree(pool, done, depth - 1, width);
+    });
+    std::this_thread::yield();
+  }
+  done++;
+}
+
+// 1 + width + width^2 + ... + width^depth
+static long treeSize(int depth, int width) {
+  long n = 1, level = 1;
+  for (int d = 0; d < depth; d++)
+    n += level *= width;
+  return n;
+}
+
+unittest(wait_includes_tasks_queued_by_tasks) {
+  for (unsigned threads : {1u, 2u, 4u, 8u}) {
+    Pool pool(threads);
+    assertEqual(threads, pool.size());
+    for (int round = 0; round < 50; round++) {
+      std::atomic<long> done(0);
+      pool.submit([&] { tree(pool, done, 3, 4); });
+      pool.wait();
+      assertEqual(treeSize(3, 4), done.load());
+    }
+  }
+}
+
+unittest(destructor_runs_all_tasks) {
+  std::atomic<long> done(0);
+  {
+    Pool pool(3);
+    for (int i = 0; i < 10; i++)
+      pool.submit([&] { tree(pool, done, 2, 5); });
+  }
+  assertEqual(10 * treeSize(2, 5), done.load());
+}
+
+unittest_main()
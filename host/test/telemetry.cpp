@@ -0,0 +1,156 @@
+// cobsDecode() against a COBS encoder of any length, runs of 254 bytes
+// without a zero among them, and TelemetryReceiver on frames between text,
+// damaged and lost where the sequence number wraps around. The frames of the
+// firmware itself are tested in ../sim/test/telemetry.cpp.
+#include "ArduinoUnitTests.h"
+#include "telemetry.h"
+
+using namespace templog;
+
+// COBS as it is defined, with 0xFF codes for runs of 254 bytes
+static std::vector<uint8_t> cobs(const std::vector<uint8_t> &in) {
+  std::vector<uint8_t> out(1);
+  size_t code = 0;
+  for (uint8_t b : in) {
+    if (b) {
+      out.push_back(b);
+      if (out.size() - code < 0xFF)
+        continue;
+    }
+    out[code] = uint8_t(out.size() - code);
+    code = out.size();
+    out.push_back(0);
+  }
+  out[code] = uint8_t(out.size() - code);
+  return out;
+}
+
+static bool roundTrips(const std::vector<uint8_t> &in) {
+  std::vector<uint8_t> enc = cobs(in);
+  if (std::find(enc.begin(), enc.end(), 0) != enc.end())
+    return false;
+  std::vector<uint8_t> out(enc.size());
+  long n = cobsDecode(enc.data(), enc.size(), out.data());
+  return n == long(in.size()) && std::equal(in.begin(), in.end(), out.begin());
+}
+
+unittest(cobs_round_trip) {
+  assertTrue(roundTrips({}));
+  assertTrue(roundTrips({0}));
+  assertTrue(roundTrips({0, 0, 0}));
+  assertTrue(roundTrips({1, 0, 2}));
+  // Runs without a zero up to, at and past the 254 of a 0xFF code, alone,
+  // followed by a zero or by more bytes
+  for (size_t run : {253, 254, 255, 508, 509}) {
+    std::vector<uint8_t> in(run);
+    for (size_t i = 0; i < run; i++)
+      in[i] = uint8_t(1 + i % 255);
+    assertTrue(roundTrips(in));
+    in.push_back(0);
+    assertTrue(roundTrips(in));
+    in.push_back(7);
+    assertTrue(roundTrips(in));
+    in.insert(in.begin(), 0);
+    assertTrue(roundTrips(in));
+  }
+  std::vector<uint8_t> code = cobs(std::vector<uint8_t>(254, 9));
+  assertEqual(0xFF, code[0]);
+}
+
+unittest(cobs_rejects_damage) {
+  uint8_t out[8];
+  // A code past the end, and a zero
+  const uint8_t past[] = {5, 1, 2};
+  assertEqual(-1, cobsDecode(past, sizeof(past), out));
+  const uint8_t zero[] = {2, 1, 0, 1};
+  assertEqual(-1, cobsDecode(zero, sizeof(zero), out));
+}
+
+// A frame as the firmware sends it, with the delimiters
+static std::vector<uint8_t> frame(uint8_t seq, int16_t temp) {
+  std::vector<uint8_t> f = {TelemetryFrame::VERSION, seq,
+                            HEATER_ENABLED | HEATING};
+  uint32_t timestamp = fromEpoch(1735646400 + seq);
+  f.insert(f.end(), (uint8_t *)&timestamp, (uint8_t *)&timestamp + 4);
+  f.insert(f.end(), {0x5D, 0x02, 0xD0, 0x02, 0, 0, 0, 0, 1});
+  f.insert(f.end(), (uint8_t *)&temp, (uint8_t *)&temp + 2);
+  uint16_t crc = crc16(0xFFFF, f.data(), f.size());
+  f.insert(f.end(), (uint8_t *)&crc, (uint8_t *)&crc + 2);
+  std::vector<uint8_t> wire = cobs(f);
+  wire.insert(wire.begin(), 0);
+  wire.push_back(0);
+  return wire;
+}
+
+struct Received {
+  std::vector<TelemetryFrame> frames;
+  std::vector<std::string> text;
+};
+
+static Received receive(TelemetryReceiver &rx,
+                        const std::vector<uint8_t> &wire, size_t piece) {
+  Received r;
+  for (size_t i = 0; i < wire.size(); i += piece)
+    rx.feed(
+        wire.data() + i, std::min(piece, wire.size() - i),
+        [&](const TelemetryFrame &f) { r.frames.push_back(f); },
+        [&](const std::string &s) { r.text.push_back(s); });
+  return r;
+}
+
+unittest(frames_between_text) {
+  std::vector<uint8_t> wire;
+  auto text = [&](const std::string &s) {
+    wire.insert(wire.end(), s.begin(), s.end());
+  };
+  text("setup done\r\n");
+  for (int i = 0; i < 5; i++) {
+    std::vector<uint8_t> f = frame(uint8_t(i), int16_t(600 + i));
+    wire.insert(wire.end(), f.begin(), f.end());
+    if (i == 2)
+      text("heater is on\r\nauto disable\r\n");
+  }
+  // A line longer than any frame
+  text(std::string(300, 'x') + "\n");
+  // Byte by byte, as from a slow port, and all at once
+  for (size_t piece : {size_t(1), wire.size()}) {
+    TelemetryReceiver rx;
+    Received r = receive(rx, wire, piece);
+    assertEqual(size_t(5), r.frames.size());
+    assertEqual(uint64_t(0), rx.damaged());
+    assertEqual(uint64_t(0), rx.lost());
+    std::vector<std::string> lines = {"setup done", "heater is on",
+                                      "auto disable", std::string(300, 'x')};
+    assertTrue(lines == r.text);
+    for (size_t i = 0; i < r.frames.size(); i++) {
+      assertEqual(uint8_t(i), r.frames[i].seq);
+      assertEqual(double(150 + i / 4.0), r.frames[i].temperature(0));
+      assertEqual(151.25, r.frames[i].targetTemperature());
+    }
+  }
+}
+
+unittest(lost_frames_when_seq_wraps) {
+  std::vector<uint8_t> wire;
+  // 250 to 255, then 3 to 5: 0, 1 and 2 lost
+  for (int seq : {250, 251, 252, 253, 254, 255, 3, 4, 5}) {
+    std::vector<uint8_t> f = frame(uint8_t(seq), 600);
+    wire.insert(wire.end(), f.begin(), f.end());
+  }
+  // A damaged frame, lost as well
+  std::vector<uint8_t> f = frame(6, 600);
+  f[9] ^= 0x10;
+  wire.insert(wire.end(), f.begin(), f.end());
+  f = frame(7, 600);
+  wire.insert(wire.end(), f.begin(), f.end());
+
+  TelemetryReceiver rx;
+  Received r = receive(rx, wire, wire.size());
+  assertEqual(size_t(10), r.frames.size());
+  assertEqual(uint64_t(10), rx.frames());
+  assertEqual(uint64_t(1), rx.damaged());
+  assertEqual(uint64_t(4), rx.lost());
+  assertEqual(size_t(0), r.text.size());
+}
+
+unittest_main()
@@ -0,0 +1,52 @@
+// A file in the temporary directory for the tests, removed again with the
+// object. The tests of the firmware, ../../sim/test, use it as well, to hand
+// the logs from the simulated card to the host tools and readBinary.py.
+#ifndef HOST_TEST_TEMP_FILE_H
+#define HOST_TEST_TEMP_FILE_H
+
+#include <stdint.h>
+#include <stdio.h>
+#include <unistd.h>
+
+#include <string>
+#include <vector>
+
+namespace test {
+
+class TempFile {
+public:
+  TempFile() {
+    char name[] = "/tmp/temp-monitor-testXXXXXX";
+    int fd = mkstemp(name);
+    if (fd >= 0)
+      close(fd);
+    path_ = name;
+  }
+  ~TempFile() { unlink(path_.c_str()); }
+  const std::string &path() const { return path_; }
+
+  bool write(const std::vector<uint8_t> &data) const {
+    FILE *f = fopen(path_.c_str(), "wb");
+    bool ok = f && fwrite(data.data(), 1, data.size(), f) == data.size();
+    return f && fclose(f) == 0 && ok;
+  }
+  bool read(std::vector<uint8_t> &data) const {
+    FILE *f = fopen(path_.c_str(), "rb");
+    if (!f)
+      return false;
+    data.clear();
+    uint8_t buf[4096];
+    size_t n;
+    while ((n = fread(buf, 1, sizeof(buf), f)) > 0)
+      data.insert(data.end(), buf, buf + n);
+    fclose(f);
+    return true;
+  }
+
+private:
+  std::string path_;
+};
+
+} // namespace test
+
+#endif
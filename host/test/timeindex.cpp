@@ -0,0 +1,157 @@
+// The time index against decoding the whole log, also after the log changed
+// and when the clock was set back
+#include "ArduinoUnitTests.h"
+#include "test/tempFile.h"
+#include "timeindex.h"
+
+using namespace templog;
+
+const int64_t START = 1735646400; // 2024-12-31 12:00:00
+
+// records a second, with the clock set back by setBack seconds after each
+// setBackEvery records
+static bool writeLog(const std::string &path, int records, int setBack = 0,
+                     int setBackEvery = 0) {
+  LogWriter w;
+  if (!w.open(path, 1, fromEpoch(START)))
+    return false;
+  int64_t time = START;
+  for (int i = 0; i < records; i++) {
+    double t = 20 + i % 40;
+    if (!w.add(time, HEATER_ENABLED, &t))
+      return false;
+    time += setBackEvery && i % setBackEvery == setBackEvery - 1 ? -setBack
+                                                                 : 1;
+  }
+  return w.close();
+}
+
+// The records of f between from and to, through the index and by decoding
+// it all
+static void checkQuery(const LogFile &f, const TimeIndex &idx, int64_t from,
+                       int64_t to) {
+  std::vector<int64_t> indexed, all;
+  idx.query(f, from, to, {}, [&](const Cursor &c) {
+    indexed.push_back(c.time());
+  });
+  Cursor c = f.records();
+  while (c.next()) {
+    if (c.time() >= from && c.time() <= to)
+      all.push_back(c.time());
+  }
+  assertEqual(all.size(), indexed.size());
+  assertTrue(all == indexed);
+}
+
+unittest(query_after_the_log_shrinks) {
+  test::TempFile log;
+  assertTrue(writeLog(log.path(), 5000));
+  std::string sidecar = TimeIndex::pathFor(log.path());
+  std::string error;
+  {
+    LogFile f;
+    assertTrue(f.open(log.path()));
+    TimeIndex idx;
+    assertTrue(idx.update(f, 64, error));
+    assertEqual(5000u, idx.totalRecords());
+    assertFalse(idx.unordered());
+    checkQuery(f, idx, START + 1000, START + 4000);
+  }
+
+  // Recovered, or truncated by hand, after the last valid block of a
+  // shorter recording. The file and its start are the same.
+  assertEqual(0, truncate(log.path().c_str(), 6 * BLOCK_SIZE));
+  LogFile f;
+  assertTrue(f.open(log.path()));
+  uint64_t left = 0;
+  int64_t last = 0;
+  for (Cursor c = f.records(); c.next(); left++)
+    last = c.time();
+  assertLess(left, uint64_t(5000));
+
+  TimeIndex stale;
+  assertFalse(stale.read(sidecar, f));
+  TimeIndex idx;
+  assertTrue(idx.update(f, 64, error));
+  assertEqual(left, idx.totalRecords());
+  assertEqual(last, idx.lastTime());
+  checkQuery(f, idx, START, START + 5000);
+
+  // Grown again: extended, and the same as indexing it anew
+  assertTrue(writeLog(log.path(), 3000));
+  LogFile grown;
+  assertTrue(grown.open(log.path()));
+  TimeIndex extended;
+  assertTrue(extended.read(sidecar, grown));
+  assertTrue(extended.extend(grown, error));
+  assertEqual(3000u, extended.totalRecords());
+  checkQuery(grown, extended, START + 100, START + 2900);
+  unlink(sidecar.c_str());
+}
+
+// The clock set back by an hour twice, at two places in the entries
+unittest(query_after_the_clock_was_set_back) {
+  test::TempFile log;
+  std::string sidecar = TimeIndex::pathFor(log.path());
+  std::string error;
+  for (int setBackEvery : {5000, 4931}) {
+    assertTrue(writeLog(log.path(), 12000, 3600, setBackEvery));
+    LogFile f;
+    assertTrue(f.open(log.path()));
+    TimeIndex idx;
+    unlink(sidecar.c_str());
+    assertTrue(idx.update(f, 64, error));
+    assertTrue(idx.unordered());
+    assertEqual(START, idx.firstTime());
+    int64_t latest = INT64_MIN;
+    for (Cursor c = f.records(); c.next();)
+      latest = std::max(latest, c.time());
+    assertEqual(latest, idx.lastTime());
+    // Windows in the hour recorded twice, before it, after it and all
+    checkQuery(f, idx, START + 1500, START + 4800);
+    checkQuery(f, idx, START + 4000, START + 4100);
+    checkQuery(f, idx, START + 100, START + 1000);
+    checkQuery(f, idx, START + 7000, START + 9000);
+    checkQuery(f, idx, INT64_MIN, INT64_MAX);
+
+    // Read back
+    TimeIndex read;
+    assertTrue(read.read(sidecar, f));
+    assertTrue(read.unordered());
+    checkQuery(f, read, START + 1500, START + 4800);
+  }
+  unlink(sidecar.c_str());
+}
+
+// The set-back in the part of the log an extension indexes
+unittest(set_back_after_the_index_was_made) {
+  test::TempFile log;
+  std::string sidecar = TimeIndex::pathFor(log.path());
+  std::string error;
+  assertTrue(writeLog(log.path(), 3000));
+  {
+    LogFile f;
+    assertTrue(f.open(log.path()));
+    TimeIndex idx;
+    assertTrue(idx.update(f, 64, error));
+    assertFalse(idx.unordered());
+  }
+  // The same recording, on to where the clock was set back, and after
+  assertTrue(writeLog(log.path(), 8000, 3600, 5000));
+  LogFile f;
+  assertTrue(f.open(log.path()));
+  TimeIndex idx;
+  assertTrue(idx.read(sidecar, f));
+  assertFalse(idx.unordered());
+  assertTrue(idx.extend(f, error));
+  assertTrue(idx.unordered());
+  assertEqual(8000u, idx.totalRecords());
+  checkQuery(f, idx, START + 1500, START + 4800);
+  TimeIndex read;
+  assertTrue(read.read(sidecar, f));
+  assertTrue(read.unordered());
+  checkQuery(f, read, START + 1400, START + 2000);
+  unlink(sidecar.c_str());
+}
+
+unittest_main()
@@ -0,0 +1,322 @@
+// timeindex.h
+//
+// Sparse time index of a log file, kept in a sidecar file next to it: the
+// name of the log file with the extension .idx.
+//
+// An entry starts at a record the decoding can start from, a version 3 block
+// or a version 2 keyframe, at least every N records. It holds the byte offset
+// of that record, the earliest and latest time of the records it covers, the
+// number of records and the min and max of each sensor. A query binary
+// searches the entries for a time window and decodes only the entries that
+// overlap it, and skips entries whose min and max show that no record can
+// pass a threshold.
+//
+// The firmware lets the clock be set back, so the times of a log need not be
+// in order. The index notes when they are not, and a query then tries every
+// entry, and every record of the entries it decodes, instead of stopping at
+// the first one past the window.
+//
+// A log only grows while it is written. One that is now shorter than when it
+// was indexed was recovered, truncated or replaced, and its index is rebuilt.
+//
+// Index file, little endian:
+//   "TEMPIDX", version (uint8_t), format version of the log (uint8_t),
+//   numSensors (uint8_t), flags (uint16_t, UNORDERED), N (uint32_t), start
+//   timestamp of the log (uint32_t), size of the log when it was indexed
+//   (uint64_t)
+// followed by the entries:
+//   offset (uint64_t), earliest and latest time (int64_t, see toEpoch()),
+//   records (uint32_t), numSensors times min and max (int16_t, quarter
+//   degrees; min > max for a sensor without readings)
+#ifndef TIMEINDEX_H
+#define TIMEINDEX_H
+
+#include "templog.h"
+
+#include <numeric>
+
+namespace templog {
+
+// Keeps the records of one sensor above or below a temperature
+struct Threshold {
+  uint8_t sensor;
+  bool above;     // keep records at or above degrees, else at or below
+  double degrees;
+
+  // A Cursor or the like
+  template <class Record> bool passes(const Record &r) const {
+    double t = r.temperature(sensor);
+    return above ? t >= degrees : t <= degrees;
+  }
+  // Can a record between min and max, in quarter degrees, pass?
+  bool mayPass(int16_t min, int16_t max) const {
+    if (min > max)
+      return false;
+    return above ? max >= degrees * 4 : min <= degrees * 4;
+  }
+};
+
+class TimeIndex {
+public:
+  static const uint8_t VERSION = 3;
+  static const size_t HEADER_SIZE = 28;
+  // A record of the log is earlier than the one before it
+  static const uint16_t UNORDERED = 0x0001;
+
+  // Sidecar name of a log file
+  static std::string pathFor(const std::string &logPath) {
+    size_t dot = logPath.rfind('.');
+    size_t slash = logPath.rfind('/');
+    if (dot == std::string::npos || (slash != std::string::npos && dot < slash))
+      return logPath + ".idx";
+    return logPath.substr(0, dot) + ".idx";
+  }
+
+  // Bring the index of f up to date, every records per entry, and write it
+  // to its sidecar. An existing index of the same file is extended: only
+  // its last entry, which may have been cut short by the end of the data
+  // at the time, and the data after it are indexed again.
+  bool update(const LogFile &f, uint32_t every, std::string &error) {
+    if (!read(pathFor(f.path()), f) || this->every != every)
+      reset(f, every);
+    return extend(f, error);
+  }
+
+  // Index the records f has gained since the index was read or last
+  // extended, and add them to the sidecar, without reading it again. f is
+  // the same file, mapped again when it has grown.
+  bool extend(const LogFile &f, std::string &error) {
+    size_t keep = offset.empty() ? 0 : offset.size() - 1;
+    size_t resume = keep < offset.size() ? offset[keep] : 0;
+    truncate(keep);
+    scan(f, resume);
+    logSize = f.size();
+    return write(pathFor(f.path()), keep, error);
+  }
+
+  // Read the sidecar of f. Fails if it is missing, belongs to another file,
+  // or f is shorter than the log it was made from.
+  bool read(const std::string &path, const LogFile &f) {
+    FILE *in = fopen(path.c_str(), "rb");
+    if (!in)
+      return false;
+    uint8_t h[HEADER_SIZE];
+    bool ok = fread(h, 1, sizeof(h), in) == sizeof(h) &&
+              memcmp(h, "TEMPIDX", 7) == 0 && h[7] == VERSION &&
+              h[8] == f.header().version && h[9] == f.header().numSensors &&
+              load<uint32_t>(h + 16) == f.header().start &&
+              load<uint64_t>(h + 20) <= f.size();
+    if (ok) {
+      reset(f, load<uint32_t>(h + 12));
+      flags = load<uint16_t>(h + 10);
+      logSize = load<uint64_t>(h + 20);
+      std::vector<uint8_t> e(entrySize());
+      while (fread(e.data(), 1, e.size(), in) == e.size())
+        append(e.data());
+    }
+    fclose(in);
+    return ok;
+  }
+
+  size_t size() const { return offset.size(); }
+  // Records of all entries
+  uint64_t totalRecords() const {
+    return std::accumulate(records.begin(), records.end(), uint64_t(0));
+  }
+  // The times of the records are not in order
+  bool unordered() const { return flags & UNORDERED; }
+  // Time of the earliest and the latest record
+  int64_t firstTime() const {
+    if (first.empty())
+      return INT64_MAX;
+    return unordered() ? *std::min_element(first.begin(), first.end())
+                       : first[0];
+  }
+  int64_t lastTime() const {
+    if (last.empty())
+      return INT64_MIN;
+    return unordered() ? *std::max_element(last.begin(), last.end())
+                       : last.back();
+  }
+
+  // Call fn(cursor) for each record from time from to to, inclusive, that
+  // passes the thresholds. Returns the number of entries decoded; skipped
+  // counts those that the thresholds ruled out.
+  template <class Fn>
+  size_t query(const LogFile &f, int64_t from, int64_t to,
+               const std::vector<Threshold> &thresholds, Fn &&fn,
+               size_t *skipped = nullptr) const {
+    // The first entry that may end at or after from, when the entries are in
+    // order of time
+    bool ordered = !unordered();
+    size_t i = ordered ? std::lower_bound(last.begin(), last.end(), from) -
+                             last.begin()
+                       : 0;
+    size_t decoded = 0;
+    if (skipped)
+      *skipped = 0;
+    for (; i < offset.size() && (first[i] <= to || !ordered); i++) {
+      if (last[i] < from || first[i] > to)
+        continue;
+      bool may = true;
+      for (const Threshold &t : thresholds)
+        may = may && t.mayPass(min[i * numSensors + t.sensor],
+                               max[i * numSensors + t.sensor]);
+      if (!may) {
+        if (skipped)
+          ++*skipped;
+        continue;
+      }
+      decoded++;
+      size_t end = i + 1 < offset.size() ? offset[i + 1] : f.size();
+      Cursor c(f, offset[i]);
+      while (c.next() && c.recordOffset() < end) {
+        if (c.time() < from || (c.time() > to && !ordered))
+          continue;
+        if (c.time() > to)
+          break;
+        bool pass = true;
+        for (const Threshold &t : thresholds)
+          pass = pass && t.passes(c);
+        if (pass)
+          fn(c);
+      }
+    }
+    return decoded;
+  }
+
+private:
+  uint8_t logVersion = 0;
+  uint8_t numSensors = 0;
+  uint32_t every = 0;
+  uint32_t start = 0;
+  uint64_t logSize = 0; // of the log the entries were made from
+  uint16_t flags = 0;
+  // The entries, one column each
+  std::vector<uint64_t> offset;
+  std::vector<int64_t> first;
+  std::vector<int64_t> last;
+  std::vector<uint32_t> records;
+  std::vector<int16_t> min; // numSensors per entry
+  std::vector<int16_t> max;
+
+  size_t entrySize() const { return 28 + 4 * numSensors; }
+
+  void reset(const LogFile &f, uint32_t every) {
+    logVersion = f.header().version;
+    numSensors = f.header().numSensors;
+    start = f.header().start;
+    this->every = every ? every : 1;
+    logSize = 0;
+    flags = 0;
+    truncate(0);
+  }
+
+  void truncate(size_t n) {
+    offset.resize(n);
+    first.resize(n);
+    last.resize(n);
+    records.resize(n);
+    min.resize(n * numSensors);
+    max.resize(n * numSensors);
+  }
+
+  void append(const uint8_t *e) {
+    offset.push_back(load<uint64_t>(e));
+    first.push_back(load<int64_t>(e + 8));
+    last.push_back(load<int64_t>(e + 16));
+    records.push_back(load<uint32_t>(e + 24));
+    for (uint8_t s = 0; s < numSensors; s++) {
+      min.push_back(load<int16_t>(e + 28 + 4 * s));
+      max.push_back(load<int16_t>(e + 30 + 4 * s));
+    }
+  }
+
+  // Index the records from byte offset resume, 0 for the start
+  void scan(const LogFile &f, size_t resume) {
+    Cursor c(f, resume);
+    uint32_t count = every;
+    size_t block = SIZE_MAX;
+    // The record before, the latest of the entries before while they are in
+    // order
+    int64_t before = last.empty() ? INT64_MIN : last.back();
+    while (c.next()) {
+      if (c.time() < before)
+        flags |= UNORDERED;
+      before = c.time();
+      // A new entry can only start where decoding can
+      bool restart = logVersion == 1 ||
+                     (logVersion == 2 ? (c.status() & KEYFRAME) != 0
+                                      : c.blockOffset() != block);
+      block = c.blockOffset();
+      if (count >= every && restart) {
+        offset.push_back(logVersion == 3 ? c.blockOffset() : c.recordOffset());
+        first.push_back(c.time());
+        last.push_back(c.time());
+        records.push_back(0);
+        min.insert(min.end(), numSensors, 32767);
+        max.insert(max.end(), numSensors, NO_TEMPERATURE);
+        count = 0;
+      }
+      count++;
+      first.back() = std::min(first.back(), c.time());
+      last.back() = std::max(last.back(), c.time());
+      records.back()++;
+      int16_t *mn = &min[min.size() - numSensors];
+      int16_t *mx = &max[max.size() - numSensors];
+      for (uint8_t s = 0; s < numSensors; s++) {
+        int16_t t = c.quarterDegrees(s);
+        if (t == NO_TEMPERATURE)
+          continue;
+        mn[s] = std::min(mn[s], t);
+        mx[s] = std::max(mx[s], t);
+      }
+    }
+  }
+
+  // Write the entries from keep on after the first keep in the file
+  bool write(const std::string &path, size_t keep, std::string &error) {
+    FILE *out = fopen(path.c_str(), keep ? "r+b" : "wb");
+    if (!out) {
+      error = "cannot write " + path + ": " + strerror(errno);
+      return false;
+    }
+    bool ok = true;
+    if (keep) {
+      ok = fseek(out, 10, SEEK_SET) == 0 &&
+           fwrite(&flags, 1, sizeof(flags), out) == sizeof(flags) &&
+           fseek(out, 20, SEEK_SET) == 0 &&
+           fwrite(&logSize, 1, sizeof(logSize), out) == sizeof(logSize) &&
+           fseek(out, HEADER_SIZE + keep * entrySize(), SEEK_SET) == 0 &&
+           ftruncate(fileno(out), HEADER_SIZE + keep * entrySize()) == 0;
+    } else {
+      uint8_t h[HEADER_SIZE] = {'T', 'E', 'M', 'P', 'I', 'D', 'X', VERSION,
+                                logVersion, numSensors};
+      memcpy(h + 10, &flags, sizeof(flags));
+      memcpy(h + 12, &every, sizeof(every));
+      memcpy(h + 16, &start, sizeof(start));
+      memcpy(h + 20, &logSize, sizeof(logSize));
+      ok = fwrite(h, 1, sizeof(h), out) == sizeof(h);
+    }
+    std::vector<uint8_t> e(entrySize());
+    for (size_t i = keep; ok && i < offset.size(); i++) {
+      memcpy(&e[0], &offset[i], 8);
+      memcpy(&e[8], &first[i], 8);
+      memcpy(&e[16], &last[i], 8);
+      memcpy(&e[24], &records[i], 4);
+      for (uint8_t s = 0; s < numSensors; s++) {
+        memcpy(&e[28 + 4 * s], &min[i * numSensors + s], 2);
+        memcpy(&e[30 + 4 * s], &max[i * numSensors + s], 2);
+      }
+      ok = fwrite(e.data(), 1, e.size(), out) == e.size();
+    }
+    ok = fclose(out) == 0 && ok;
+    if (!ok)
+      error = "cannot write " + path + ": " + strerror(errno);
+    return ok;
+  }
+};
+
+} // namespace templog
+
+#endif
@@ -2,20 +2,30 @@
 #include "log.h"
 
 Log::Log(uint8_t numSensors)
-    : numSensors(numSensors), loggingEnabled(false), loggingStartet(false)
+    : numSensors(numSensors < LOG_MAX_SENSORS ? numSensors : LOG_MAX_SENSORS),
+      loggingEnabled(false), loggingStartet(false),
+      maxLogMicros(0), syncPending(false), cardWaiting(false),
+      maxWaitAvoided(0), manifestIndex(NO_MANIFEST_ENTRY), recordCount(0)
+#if LOG_SUMMARY
+      ,
+      minuteRollup(0, 60, this->numSensors),
+      hourRollup(1, 3600, this->numSensors)
+#endif // LOG_SUMMARY
 #if USE_RTC
       ,
       rtc(RTC_ADDRESS, RTC_MODEL) // Initialize the RTC object here
 #endif                            // USE_RTC
 {
-  data.temperatures = new float[numSensors];
-  memset(data.temperatures, 0, numSensors * sizeof(float));
+  memset(data.temperatures, 0, sizeof(data.temperatures));
+  data.timestamp = 0;
+  data.seconds = 0;
+  data.interval = 0;
+  data.sinceKeyframe = LOG_KEYFRAME_INTERVAL;
+  data.status = 0;
   memset(errorMessage, 0, sizeof(errorMessage));
   memset(logFileName, 0, sizeof(logFileName));
 }
 
-Log::~Log() { delete[] data.temperatures; }
-
 int Log::init(uint8_t SD_CS_PIN) {
   _SD_CS_PIN = SD_CS_PIN;
 
@@ -76,6 +86,8 @@ int Log::enableLogging() {
   }
   Serial.println(F("Found FAT partition."));
 
+  recoverLogFiles();
+
 #ifndef  USE_RTC
   // if a file with logFileName already exists (ie. probably an old logfile),
   // move it
@@ -116,23 +128,24 @@ int Log::startLogging() {
     return 0;
   }
 
-  if (sd.exists(logFileName)) {
-    if (!logFile.open(logFileName, O_RDWR | O_CREAT)) {
-      loggingEnabled = false;
-      Serial.println(F("Error opening already existing file"));
-    }
-    Serial.println(F("Logging started to already existing file"));
-    return 0;
-  } else {
-    Serial.println(F("Logging to new file"));
-    return openNewLogFile();
-  }
+  // Every recording gets a new file, preallocated and erased, even after a
+  // stop: a stopped file was truncated to its data, and appending to it would
+  // allocate clusters while logging. openNewLogFile() moves on to the next
+  // name if logFileName is taken.
+  Serial.println(F("Logging to new file"));
+  return openNewLogFile();
 }
 
 int Log::stopLogging() {
   if (loggingEnabled && logFile.isOpen()) {
-    logFile.truncate();
-    logFile.close();
+#if LOG_SUMMARY
+    // Keep the minute and hour cut short
+    writeSummary();
+    minuteRollup.finish();
+    hourRollup.finish();
+#endif // LOG_SUMMARY
+    if (!closeLogFile())
+      Serial.println(F("Error closing logfile"));
     Serial.println(F("Logging stopped."));
   }
   return 0;
@@ -152,36 +165,59 @@ int Log::openNewLogFile() {
     return 0;
   logFile.close();
 
-  while (sd.exists(logFileName)) {
-    char *p = strchr(logFileName, '.');
-    if (!p) {
-      strcpy_P(errorMessage, PSTR("no dot in filename"));
-      return -1;
-    }
-    while (true) {
-      p--;
-      if (p < logFileName || *p < '0' || *p > '9') {
-        strcpy_P(errorMessage, PSTR("cant create file name"));
+  // The manifest lists the files in the order they were created. If the last
+  // one has this name, the next file takes the following number, without
+  // searching the directory for each candidate.
+  file_t manifest;
+  ManifestEntry last;
+  int32_t n = openManifest(manifest);
+  bool taken = n > 0 && readManifestEntry(manifest, n - 1, last) &&
+               strncmp(last.name, logFileName, sizeof(last.name)) == 0;
+  manifest.close();
+  if (taken && !nextLogFileName())
+    return -1;
+  // A file the manifest does not know about, e.g. from before there was one,
+  // still has to be found by trying the names in turn
+  if (!logFile.open(logFileName, O_RDWR | O_CREAT | O_EXCL)) {
+    while (sd.exists(logFileName)) {
+      if (!nextLogFileName())
         return -1;
-      }
-      if (p[0] != '9') {
-        p[0]++;
-        break;
-      }
-      p[0] = '0';
+    }
+    if (!logFile.open(logFileName, O_RDWR | O_CREAT)) {
+      strcpy_P(errorMessage, PSTR("open Logfile failed"));
+      loggingEnabled = false;
+      return -1;
     }
   }
-
-  if (!logFile.open(logFileName, O_RDWR | O_CREAT)) {
-    strcpy_P(errorMessage, PSTR("open Logfile failed"));
+  // Reserve the whole file as one contiguous range of clusters
+  if (!logFile.preAllocate(PREALLOCATE_SIZE)) {
+    strcpy_P(errorMessage, PSTR("preAllocate failed"));
+    // Most likely the card is too full for a contiguous file
+    logFile.remove();
     loggingEnabled = false;
     return -1;
   }
-  if (!logFile.preAllocate(PREALLOCATE_SIZE_MiB)) {
-    strcpy_P(errorMessage, PSTR("preAllocate failed"));
+#if LOG_PRE_ERASE
+  // Not fatal, the card just has to erase the sectors itself while logging
+  if (!preErase())
+    Serial.println(F("Pre-erase of logfile failed"));
+#endif // LOG_PRE_ERASE
+  // Before raw mode takes over the card
+  data.fileId = getCurrentTimestamp();
+  addManifestEntry();
+  openSummary();
+#if LOG_RAW_SECTORS
+  uint32_t bgnSector, endSector;
+  if (!logFile.contiguousRange(&bgnSector, &endSector)) {
+    strcpy_P(errorMessage, PSTR("contiguousRange failed"));
     loggingEnabled = false;
     return -1;
   }
+  rawFile.begin(sd.card(), bgnSector, PREALLOCATE_SIZE / 512);
+  logBuf.begin(&rawFile);
+#else
+  logBuf.begin(&logFile);
+#endif // LOG_RAW_SECTORS
 
   writeHeader();
   Serial.print(F("Logging to: "));
@@ -189,61 +225,512 @@ int Log::openNewLogFile() {
   return 0;
 }
 
+// Write what is buffered, release the unused part of the preallocated file and
+// close it. In raw mode this is when the directory entry gets the file length.
+bool Log::closeLogFile() {
+  finishBlock();
+  bool ok = logBuf.sync();
+#if LOG_RAW_SECTORS
+  ok = rawFile.close() && ok;
+#endif // LOG_RAW_SECTORS
+  ok = logFile.truncate(logBuf.position()) && ok;
+  ok = logFile.close() && ok;
+  closeManifestEntry();
+#if LOG_SUMMARY
+  // The rollups go on in the summary of the next file
+  writeSummary();
+  sumFile.close();
+#endif // LOG_SUMMARY
+  return ok;
+}
+
+// Open the summary file of logFileName, and continue after the records
+// already in it. Logging goes on without one.
+void Log::openSummary() {
+#if LOG_SUMMARY
+  char name[sizeof(logFileName)];
+  strcpy(name, logFileName);
+  char *p = strrchr(name, '.');
+  if (!p || strlen(p) != 4) {
+    Serial.println(F("Error naming summary file"));
+    return;
+  }
+  strcpy_P(p, PSTR(".sum"));
+  if (!sumFile.open(name, O_RDWR | O_CREAT)) {
+    Serial.println(F("Error opening summary file"));
+    return;
+  }
+  bool ok;
+  if (sumFile.fileSize() < SUMMARY_HEADER_SIZE) {
+    uint8_t header[SUMMARY_HEADER_SIZE];
+    memcpy_P(header, PSTR("TEMPSUM"), 7);
+    header[7] = SUMMARY_VERSION;
+    header[8] = numSensors;
+    memcpy(header + 9, &data.fileId, sizeof(data.fileId));
+    ok = sumFile.truncate(0) &&
+         sumFile.write(header, sizeof(header)) == sizeof(header) &&
+         sumFile.sync();
+  } else {
+    // Drop a record cut short by a reset
+    uint32_t n = (sumFile.fileSize() - SUMMARY_HEADER_SIZE) /
+                 minuteRollup.recordSize();
+    ok = sumFile.truncate(SUMMARY_HEADER_SIZE +
+                          n * minuteRollup.recordSize()) &&
+         sumFile.seekEnd();
+  }
+  if (!ok) {
+    Serial.println(F("Error opening summary file"));
+    sumFile.close();
+  }
+#endif // LOG_SUMMARY
+}
+
+bool Log::isSummaryPending() {
+#if LOG_SUMMARY
+  return minuteRollup.isPending() || hourRollup.isPending();
+#else
+  return false;
+#endif // LOG_SUMMARY
+}
+
+// Append the finished buckets to the summary file. They are dropped if it
+// can not be written; the log file has all the data.
+void Log::writeSummary() {
+#if LOG_SUMMARY
+  if (!isSummaryPending())
+    return;
+#if LOG_RAW_SECTORS
+  if (logFile.isOpen())
+    rawFile.release();
+#endif // LOG_RAW_SECTORS
+  Rollup *rollups[] = {&minuteRollup, &hourRollup};
+  bool ok = sumFile.isOpen();
+  for (uint8_t i = 0; i < 2; i++) {
+    if (!rollups[i]->isPending())
+      continue;
+    uint8_t n = rollups[i]->recordSize();
+    ok = ok && sumFile.write(rollups[i]->record(), n) == n;
+    rollups[i]->clearPending();
+  }
+  ok = ok && sumFile.sync();
+  if (!ok && sumFile.isOpen())
+    Serial.println(F("Error writing summary"));
+#endif // LOG_SUMMARY
+}
+
+// Increment the number before the dot of logFileName
+bool Log::nextLogFileName() {
+  char *p = strchr(logFileName, '.');
+  if (!p) {
+    strcpy_P(errorMessage, PSTR("no dot in filename"));
+    return false;
+  }
+  while (true) {
+    p--;
+    if (p < logFileName || *p < '0' || *p > '9') {
+      strcpy_P(errorMessage, PSTR("cant create file name"));
+      return false;
+    }
+    if (p[0] != '9') {
+      p[0]++;
+      return true;
+    }
+    p[0] = '0';
+  }
+}
+
+// Open the manifest, and create it if there is none. Returns the number of
+// entries, or -1 if it can not be used.
+int32_t Log::openManifest(file_t &manifest) {
+  char header[MANIFEST_HEADER_SIZE];
+  if (!manifest.open(LOG_MANIFEST_NAME, O_RDWR | O_CREAT))
+    return -1;
+  if (manifest.fileSize() == 0) {
+    strcpy_P(header, PSTR("TEMPMAN"));
+    header[7] = MANIFEST_VERSION;
+    if (manifest.write(header, sizeof(header)) != sizeof(header))
+      return -1;
+    return 0;
+  }
+  if (manifest.read(header, sizeof(header)) != sizeof(header) ||
+      memcmp_P(header, PSTR("TEMPMAN"), 7) != 0 ||
+      header[7] != MANIFEST_VERSION)
+    return -1;
+  // An entry cut short by a reset is overwritten by the next one
+  return (manifest.fileSize() - MANIFEST_HEADER_SIZE) / sizeof(ManifestEntry);
+}
+
+bool Log::readManifestEntry(file_t &manifest, uint16_t index,
+                            ManifestEntry &entry) {
+  return manifest.seekSet(MANIFEST_HEADER_SIZE +
+                          (uint32_t)index * sizeof(ManifestEntry)) &&
+         manifest.read(&entry, sizeof(entry)) == sizeof(entry);
+}
+
+// Add an entry for the new log file. Logging goes on without one, the
+// manifest only saves looking through the files.
+void Log::addManifestEntry() {
+  manifestIndex = NO_MANIFEST_ENTRY;
+  recordCount = 0;
+  file_t manifest;
+  int32_t n = openManifest(manifest);
+  ManifestEntry entry;
+  memset(&entry, 0, sizeof(entry));
+  strncpy(entry.name, logFileName, sizeof(entry.name));
+  entry.version = FORMAT_VERSION;
+  entry.numSensors = numSensors;
+  entry.start = data.fileId;
+  if (n >= 0 && n < NO_MANIFEST_ENTRY &&
+      manifest.seekSet(MANIFEST_HEADER_SIZE + n * sizeof(entry)) &&
+      manifest.write(&entry, sizeof(entry)) == sizeof(entry) &&
+      manifest.sync())
+    manifestIndex = n;
+  else
+    Serial.println(F("Error adding logfile to manifest"));
+  manifest.close();
+}
+
+// Complete the entry of the log file that was just closed
+void Log::closeManifestEntry() {
+  if (manifestIndex == NO_MANIFEST_ENTRY)
+    return;
+  file_t manifest;
+  ManifestEntry entry;
+  if (openManifest(manifest) > manifestIndex &&
+      readManifestEntry(manifest, manifestIndex, entry)) {
+    entry.end = recordCount ? data.timestamp : entry.start;
+    entry.records = recordCount;
+    if (!manifest.seekSet(MANIFEST_HEADER_SIZE +
+                          (uint32_t)manifestIndex * sizeof(entry)) ||
+        manifest.write(&entry, sizeof(entry)) != sizeof(entry))
+      Serial.println(F("Error updating manifest"));
+  }
+  manifest.close();
+  manifestIndex = NO_MANIFEST_ENTRY;
+}
+
+// A recording that was never stopped, e.g. by a power loss, still has the size
+// of the preallocation, a whole number of MiB, in its directory entry. Find
+// where the data ends and truncate it, as stopLogging() would have.
+void Log::recoverLogFiles() {
+  file_t root, file;
+  char name[sizeof(logFileName)];
+  if (!root.open("/"))
+    return;
+  while (file.openNext(&root, O_RDWR)) {
+    if (file.isFile() && file.fileSize() &&
+        file.fileSize() % (1024UL * 1024UL) == 0 &&
+        file.getName(name, sizeof(name)) &&
+        strncmp_P(name, PSTR("TempLog_"), 8) == 0) {
+      Serial.print(F("Recovering unclosed logfile "));
+      Serial.println(name);
+      uint32_t length;
+      if (!findLogEnd(file, length) || !file.truncate(length))
+        Serial.println(F("Recovery failed"));
+    }
+    file.close();
+  }
+  root.close();
+}
+
+// Binary search for the last valid block. Blocks are written in order, so the
+// valid ones come first. After them are erased sectors, or stale data from an
+// earlier file, which fail the sequence number or CRC check.
+bool Log::findLogEnd(file_t &file, uint32_t &length) {
+  char magic[7];
+  uint8_t version;
+  uint32_t fileId;
+  if (!file.seekSet(0) || file.read(magic, 7) != 7 ||
+      memcmp_P(magic, PSTR("TEMPLOG"), 7) != 0 ||
+      file.read(&version, 1) != 1 || version != FORMAT_VERSION ||
+      !file.seekSet(9) || file.read(&fileId, 4) != 4 ||
+      file.fileSize() < 512)
+    return false;
+
+  // Blocks before lo are valid, blocks from hi are not. Block 0 is the header.
+  uint32_t lo = 1;
+  uint32_t hi = file.fileSize() / 512;
+  while (lo < hi) {
+    uint32_t mid = lo + (hi - lo) / 2;
+    int8_t valid = checkBlock(file, fileId, mid);
+    if (valid < 0)
+      return false;
+    if (valid)
+      lo = mid + 1;
+    else
+      hi = mid;
+  }
+  length = lo * 512UL;
+  return true;
+}
+
+// 1 if the block has the right sequence number and CRC, 0 if not and -1 if it
+// cannot be read. Reads go through SdFat's sector cache, so the block is only
+// read from the card once.
+int8_t Log::checkBlock(file_t &file, uint32_t fileId, uint32_t block) {
+  uint8_t chunk[32];
+  if (!file.seekSet(block * 512UL) ||
+      file.read(chunk, sizeof(chunk)) != sizeof(chunk))
+    return -1;
+  uint32_t seq;
+  uint16_t used, crc;
+  memcpy(&seq, chunk, sizeof(seq));
+  memcpy(&used, chunk + 4, sizeof(used));
+  memcpy(&crc, chunk + 6, sizeof(crc));
+  if (seq != block || used > 512 - BLOCK_HEADER_SIZE)
+    return 0;
+
+  uint16_t c = crc16(crc16(0xFFFF, &fileId, sizeof(fileId)), &seq, sizeof(seq));
+  uint16_t end = BLOCK_HEADER_SIZE + used;
+  uint16_t pos = min(end, (uint16_t)sizeof(chunk));
+  c = crc16(c, chunk + BLOCK_HEADER_SIZE, pos - BLOCK_HEADER_SIZE);
+  while (pos < end) {
+    uint16_t n = min((uint16_t)(end - pos), (uint16_t)sizeof(chunk));
+    if (file.read(chunk, n) != n)
+      return -1;
+    c = crc16(c, chunk, n);
+    pos += n;
+  }
+  c = crc16(c, &used, sizeof(used));
+  return c == crc;
+}
+
+bool Log::preErase() {
+  uint32_t bgnSector, endSector;
+  if (!logFile.contiguousRange(&bgnSector, &endSector))
+    return false;
+
+  // Erase in chunks, to stay within the erase timeout of the card
+  const uint32_t ERASE_SIZE = 262144L;
+  uint32_t bgnErase = bgnSector;
+  while (bgnErase <= endSector) {
+    uint32_t endErase = bgnErase + ERASE_SIZE - 1;
+    if (endErase > endSector)
+      endErase = endSector;
+    if (!sd.card()->erase(bgnErase, endErase))
+      return false;
+    bgnErase = endErase + 1;
+  }
+  return true;
+}
+
 void Log::writeHeader() {
   if (!loggingEnabled)
     return;
 
-  uint32_t timestamp = getCurrentTimestamp();
-  logFile.write("HEADER\n", 7);
-  logFile.write(&numSensors, sizeof(numSensors));
-  logFile.write(&timestamp, sizeof(timestamp));
+  uint8_t version = FORMAT_VERSION;
+  logBuf.write("TEMPLOG", 7);
+  logBuf.write(&version, sizeof(version));
+  logBuf.write(&numSensors, sizeof(numSensors));
+  // The start timestamp, set by openNewLogFile()
+  logBuf.write(&data.fileId, sizeof(data.fileId));
+  // The header has a sector of its own, the blocks follow it
+  logBuf.padSector();
+
+  logBuf.sync();
+}
+
+// Start a block at the current sector. used and the CRC are filled in by
+// sealBlock(), once the records are known.
+bool Log::startBlock() {
+  uint32_t seq = logBuf.position() / 512;
+  uint8_t header[BLOCK_HEADER_SIZE] = {0};
+  memcpy(header, &seq, sizeof(seq));
+  data.blockCrc =
+      crc16(crc16(0xFFFF, &data.fileId, sizeof(data.fileId)), &seq, sizeof(seq));
+  // Every block can be decoded on its own
+  data.sinceKeyframe = LOG_KEYFRAME_INTERVAL;
+  return logBuf.write(header, sizeof(header));
+}
+
+// Fill in used and the CRC of the block being filled. It is still in RAM, and
+// sealed again whenever more records are added and it is synced.
+void Log::sealBlock() {
+  uint16_t fill = logBuf.sectorFill();
+  if (fill < BLOCK_HEADER_SIZE)
+    return;
+  uint16_t used = fill - BLOCK_HEADER_SIZE;
+  uint16_t crc = crc16(data.blockCrc, &used, sizeof(used));
+  uint8_t *block = logBuf.fillingSector();
+  memcpy(block + 4, &used, sizeof(used));
+  memcpy(block + 6, &crc, sizeof(crc));
+}
+
+// Seal the block and pad it to a whole sector.
+void Log::finishBlock() {
+  sealBlock();
+  logBuf.padSector();
+}
+
+bool Log::writeRecord(const void *src, size_t n) {
+  data.blockCrc = crc16(data.blockCrc, src, n);
+  return logBuf.write(src, n);
+}
 
-  // Write the size of each temperature value (4 for float, 8 for double)
-  uint8_t tempSize = sizeof(float);
-  logFile.write(&tempSize, sizeof(tempSize));
+// CRC-16/CCITT, polynomial 0x1021, as _crc_xmodem_update() in avr-libc
+uint16_t Log::crc16(uint16_t crc, const void *data, size_t n) {
+  const uint8_t *p = static_cast<const uint8_t *>(data);
+  while (n--) {
+    crc ^= (uint16_t)*p++ << 8;
+    for (uint8_t i = 0; i < 8; i++)
+      crc = crc & 0x8000 ? (crc << 1) ^ 0x1021 : crc << 1;
+  }
+  return crc;
+}
 
-  logFile.sync();
+// Zig-zag encode value, so small negative numbers are small as well, and write
+// it as a varint: 7 bits per byte, least significant first, the top bit set
+// when more bytes follow.
+bool Log::writeVarint(int32_t value) {
+  uint32_t v = ((uint32_t)value << 1) ^ (uint32_t)(value >> 31);
+  uint8_t buf[5];
+  uint8_t n = 0;
+  while (v >= 0x80) {
+    buf[n++] = (uint8_t)v | 0x80;
+    v >>= 7;
+  }
+  buf[n++] = (uint8_t)v;
+  return writeRecord(buf, n);
 }
 
-int Log::logData(float *temperatures, bool heaterStatus) {
+int Log::logData(float *temperatures, uint8_t status) {
   if (!loggingEnabled)
     return 0;
+  uint32_t start = micros();
 
   if (isFileSizeExceeded()) {
-    logFile.truncate();
-    logFile.close();
+    closeLogFile();
     int ret = openNewLogFile();
     if (ret != 0)
       return ret;
   }
 
-  memcpy(data.temperatures, temperatures, numSensors * sizeof(float));
-  data.heaterStatus = heaterStatus;
-  data.timestamp = getCurrentTimestamp();
-
-  // Write the data directly to the SD card
-  logFile.write(data.temperatures, sizeof(float) * numSensors);
-  logFile.write(&data.heaterStatus, sizeof(bool));
-  logFile.write(&data.timestamp, sizeof(uint32_t));
-
-  // Sync the data to the SD card periodically
-  // The SdFat library maintains an internal buffer (usually 512 bytes, the size
-  // of an SD card block). When you call logFile.write(data), the data is first
-  // written to this internal buffer. The library only writes the data to the SD
-  // card when:
-  // - The internal buffer is full
-  // - You explicitly call logFile.sync() or logFile.close(). (and maybe
-  // flush()) The reason for calling sync() is to prevent data loss.
-  static uint32_t lastSyncTime = 0;
-  if (millis() - lastSyncTime > 1000UL * 60) { // Sync every 1s * 60
-    logFile.sync();
-    lastSyncTime = millis();
+  // Records do not span blocks. Start a new block when the largest record
+  // might not fit in this one.
+  bool ok = true;
+  if (logBuf.sectorFill() + maxRecordSize() > 512)
+    finishBlock();
+  if (logBuf.sectorFill() == 0)
+    ok = startBlock();
+
+  uint32_t timestamp = getCurrentTimestamp();
+  uint32_t seconds = timestampToSeconds(timestamp);
+  bool keyframe = data.sinceKeyframe >= LOG_KEYFRAME_INTERVAL;
+  uint32_t interval = seconds - data.seconds;
+
+  status = (status & (HEATER_ENABLED | HEATING | SENSOR_ERROR)) | RECORD;
+  if (keyframe)
+    status |= KEYFRAME;
+  else if (interval == data.interval)
+    status |= SAME_INTERVAL;
+
+  // Pack the record into RAM. logBuf only hands logFile whole, sector aligned
+  // writes, so SdFat never has to read back and rewrite a partial sector.
+  ok = ok && writeRecord(&status, sizeof(status));
+  if (keyframe) {
+    ok = ok && writeRecord(&timestamp, sizeof(timestamp));
+    data.sinceKeyframe = 0;
+    interval = 0;
+  } else if (!(status & SAME_INTERVAL)) {
+    ok = ok && writeVarint((int32_t)interval);
+  }
+  for (uint8_t i = 0; i < numSensors; i++) {
+    // Quarter degrees, the resolution of the MAX6675
+    float t = temperatures[i] * 4;
+    int16_t q = (t > -32767 && t < 32767) ? (int16_t)lroundf(t)
+                                          : NO_TEMPERATURE;
+    if (keyframe)
+      ok = ok && writeRecord(&q, sizeof(q));
+    else
+      ok = ok && writeVarint((int32_t)q - data.temperatures[i]);
+    data.temperatures[i] = q;
+  }
+  // Sync right away when the heater is switched, by hand, the controller or
+  // the auto-disable, or a thermocouple starts failing
+  uint8_t changed = status ^ data.status;
+  if ((changed & (HEATER_ENABLED | HEATING)) ||
+      (changed & status & SENSOR_ERROR))
+    syncPending = true;
+  data.timestamp = timestamp;
+  data.seconds = seconds;
+  data.interval = interval;
+  data.sinceKeyframe++;
+  recordCount++;
+  data.status = status;
+#if LOG_SUMMARY
+  // A bucket still waiting for the card when the next one of its rollup is
+  // finished, because the card was never idle, is written right away
+  if ((minuteRollup.isDue(seconds) && minuteRollup.isPending()) ||
+      (hourRollup.isDue(seconds) && hourRollup.isPending()))
+    writeSummary();
+  minuteRollup.add(timestamp, seconds, data.temperatures, status & HEATING);
+  hourRollup.add(timestamp, seconds, data.temperatures, status & HEATING);
+#endif // LOG_SUMMARY
+
+  // Otherwise only sync at sector boundaries: finish the block when the next
+  // record might not fit, so the sync writes whole sectors only. Until then
+  // the records are only in RAM, but at most a block of them.
+  if (logBuf.sectorFill() + maxRecordSize() > 512) {
+    finishBlock();
+    syncPending = true;
+  }
+
+  if (!ok) {
+    strcpy_P(errorMessage, PSTR("write Logfile failed"));
+    return -1;
+  }
+  int ret = update();
+
+  uint32_t elapsed = micros() - start;
+  if (elapsed > maxLogMicros)
+    maxLogMicros = elapsed;
+  return ret;
+}
+
+int Log::update() {
+  if (!loggingEnabled || !logFile.isOpen())
+    return 0;
+  if (!logBuf.sectorsQueued() && !syncPending && !isSummaryPending())
+    return 0;
+  // Leave the work for a later call while the card is programming the last
+  // sector, and keep track of how long it was busy
+  uint32_t now = micros();
+  if (logBuf.isBusy()) {
+    if (!cardWaiting) {
+      cardWaiting = true;
+      busySince = now;
+    }
+    return 0;
+  }
+  if (cardWaiting) {
+    cardWaiting = false;
+    if (now - busySince > maxWaitAvoided)
+      maxWaitAvoided = now - busySince;
+  }
+  // Write the completed sectors first. The buffered records, including a
+  // partially filled sector, are only on the card after the sync that
+  // follows them. The summary can wait the longest.
+  bool ok = true;
+  if (logBuf.sectorsQueued()) {
+    ok = logBuf.writeNext();
+  } else if (syncPending) {
+    sealBlock();
+    ok = logBuf.sync();
+    syncPending = false;
+  } else {
+    writeSummary();
+  }
+  if (!ok) {
+    strcpy_P(errorMessage, PSTR("write Logfile failed"));
+    return -1;
   }
   return 0;
 }
 
 bool Log::isFileSizeExceeded() {
-  return loggingEnabled && logFile.fileSize() > PREALLOCATE_SIZE_MiB;
+  // Start a new file before the next block would grow the file beyond the
+  // preallocated, contiguous range
+  return loggingEnabled && logBuf.position() + 512 > PREALLOCATE_SIZE;
 }
 
 uint32_t Log::getCurrentTimestamp() {
@@ -258,6 +745,27 @@ uint32_t Log::getCurrentTimestamp() {
   return timestamp;
 }
 
+// Seconds since 2000-01-01 00:00:00, or since boot without a RTC
+uint32_t Log::timestampToSeconds(uint32_t timestamp) {
+#if USE_RTC
+  uint8_t year, month, day, hour, minute, second;
+  decodeTimestamp(timestamp, year, month, day, hour, minute, second);
+  // Days before the month, in a year that is not a leap year
+  static const uint16_t daysBefore[12] PROGMEM = {0,   31,  59,  90,
+                                                  120, 151, 181, 212,
+                                                  243, 273, 304, 334};
+  if (month < 1 || month > 12)
+    month = 1;
+  uint32_t days = 365UL * year + (year + 3) / 4 +
+                  pgm_read_word(&daysBefore[month - 1]) + day - 1;
+  if (month > 2 && year % 4 == 0)
+    days++;
+  return ((days * 24 + hour) * 60 + minute) * 60 + second;
+#else
+  return timestamp / 1000;
+#endif // USE_RTC
+}
+
 #if USE_RTC
 // Call back for file timestamps.  Only called for file create and sync().
 void Log::SdFat_dateTime(uint16_t *date, uint16_t *time, uint8_t *ms10) {
@@ -6,6 +6,10 @@
 #include <SdFat.h>
 #include <avr/pgmspace.h>
 
+#include "rawFile.h"
+#include "rollup.h"
+#include "sectorBuffer.h"
+
 #define USE_RTC 1
 #if USE_RTC
 #include <uRTCLib.h>
@@ -44,6 +48,54 @@ typedef FsFile file_t;
 
 const uint8_t SD_CS_PIN = 4; // Chip Select for the SD card
 
+// Capacity of each log file in MiB. The whole file is allocated as one
+// contiguous range of clusters when it is created, so logging never has to
+// search the FAT for a free cluster, and a new file is only started once it is
+// full. Unused space is returned to the volume when logging stops.
+#ifndef LOG_FILE_SIZE_MiB
+#define LOG_FILE_SIZE_MiB 100
+#endif
+// Erase the allocated range before logging to it. Writing to erased sectors
+// saves the card from doing it, and the garbage collection that comes with it,
+// while logging.
+#ifndef LOG_PRE_ERASE
+#define LOG_PRE_ERASE 1
+#endif
+// Write records straight to the sectors of the preallocated file, and only
+// update the FAT and directory entry when logging stops. A recording that was
+// never stopped is recovered the next time the card is mounted. Fastest with
+// ENABLE_DEDICATED_SPI, where the sectors are streamed in one multiple sector
+// write.
+#ifndef LOG_RAW_SECTORS
+#define LOG_RAW_SECTORS 0
+#endif
+// Records between two keyframes. A keyframe holds the absolute timestamp and
+// temperatures, the records in between only the change from the one before.
+#ifndef LOG_KEYFRAME_INTERVAL
+#define LOG_KEYFRAME_INTERVAL 60
+#endif
+
+// Keep the min, max and mean of each sensor and the heater duty per minute and
+// per hour, and append them to a summary file next to the log file. Plotting
+// a long run then only needs the summary.
+#ifndef LOG_SUMMARY
+#define LOG_SUMMARY 1
+#endif
+
+// Thermocouples a Log can be made for. The temperatures of the last record
+// and the rollups are kept in buffers of this size in the object, not on the
+// heap.
+#ifndef LOG_MAX_SENSORS
+#define LOG_MAX_SENSORS 2
+#endif
+#if LOG_SUMMARY && ROLLUP_MAX_SENSORS < LOG_MAX_SENSORS
+#error ROLLUP_MAX_SENSORS has to be at least LOG_MAX_SENSORS
+#endif
+
+// List of the log files on the card, in the root directory. See
+// Log::ManifestEntry.
+#define LOG_MANIFEST_NAME "manifest.bin"
+
 // Max SPI rate for AVR is 10 MHz for F_CPU 20 MHz, 8 MHz for F_CPU 16 MHz.
 #define SPI_CLOCK SD_SCK_MHZ(10)
 #ifdef ENABLE_DEDICATED_SPI
@@ -60,24 +112,114 @@ const uint8_t SD_CS_PIN = 4; // Chip Select for the SD card
 
 class Log {
 public:
+  // numSensors up to LOG_MAX_SENSORS
   Log(uint8_t numSensors);
-  ~Log();
 
   // Hardware initialization
   int init(uint8_t SD_CS_PIN);
-  int logData(float *temperatures, bool heaterEnabled);
+  // status is a combination of the HEATER_ENABLED, HEATING and SENSOR_ERROR
+  // bits below
+  int logData(float *temperatures, uint8_t status);
+  // Call from loop(). Each call does at most one transfer to the card: the
+  // oldest buffered sector, or a due sync once they are written. It does
+  // nothing while the card is busy, so it never waits for it.
+  int update();
   const char *getErrorMessage() const { return errorMessage; }
   const char *getLogFileName() const { return logFileName; }
   bool isLoggingEnabled();
   int toggleLogging();
   int startLogging();
   int stopLogging();
+  // Worst case time spent in logData(), in microseconds
+  uint32_t getMaxLogMicros() const { return maxLogMicros; }
+  // Completed sectors waiting for the card
+  uint8_t getQueueDepth() const { return logBuf.sectorsQueued(); }
+  // Longest time update() found the card busy with data waiting, in
+  // microseconds: what a blocking write would have spent waiting for it
+  uint32_t getMaxWaitAvoided() const { return maxWaitAvoided; }
+  // The RTC time now, packed as in the log
+  uint32_t getTimestamp() { return getCurrentTimestamp(); }
+  // Start timestamp of the log file being written
+  uint32_t getFileId() const { return data.fileId; }
+  // CRC-16/CCITT (polynomial 0x1021) of the blocks, also used by Telemetry
+  static uint16_t crc16(uint16_t crc, const void *data, size_t n);
+
+  // Log file format version 3
+  //
+  // The first 512 byte sector holds the header, padded with zeros:
+  //   "TEMPLOG", version (uint8_t), numSensors (uint8_t), start timestamp
+  //   (uint32_t)
+  // Every following sector is a block. The block header is
+  //   sequence number (uint32_t), the sector number in the file
+  //   used (uint16_t), bytes of records after the block header
+  //   crc (uint16_t), CRC-16/CCITT (polynomial 0x1021, initial value 0xFFFF)
+  //     over the start timestamp of the file header, the sequence number, the
+  //     records and used
+  // followed by records and zero padding. A block holds whole records and
+  // starts with a keyframe, so it can be decoded on its own.
+  //
+  // Each record starts with a status byte. A keyframe holds
+  //   timestamp (uint32_t), numSensors temperatures (int16_t)
+  // any other record holds the change since the previous record as zig-zag
+  // encoded varints
+  //   time step in seconds, unless SAME_INTERVAL is set
+  //   numSensors temperature steps
+  // Temperatures are in quarter degrees, the resolution of the MAX6675, and
+  // NO_TEMPERATURE if there is no reading. All values are little endian.
+  //
+  // Version 2 files have the same header and records, but no blocks: the
+  // records follow the header directly, until a status byte without RECORD.
+  // Version 1 files start with "HEADER\n", numSensors, timestamp and the size
+  // of a temperature, followed by fixed size records: numSensors floats, the
+  // heater bool and the timestamp.
+  static const uint8_t FORMAT_VERSION = 3;
+  static const uint8_t BLOCK_HEADER_SIZE = 8;
+  static const int16_t NO_TEMPERATURE = -32767 - 1;
+
+  // Bits of the status byte
+  static const uint8_t HEATER_ENABLED = 0x01; // heating is turned on
+  static const uint8_t HEATING = 0x02;        // the heater element is on
+  static const uint8_t SENSOR_ERROR = 0x04;   // a thermocouple read failed
+  static const uint8_t SAME_INTERVAL = 0x10;  // time step as the last record
+  static const uint8_t RECORD = 0x40;         // always set
+  static const uint8_t KEYFRAME = 0x80;
+
+  // Manifest, LOG_MANIFEST_NAME
+  //
+  // "TEMPMAN", version (uint8_t), followed by an entry per log file, in the
+  // order the files were created. An entry is added when the file is created,
+  // with end and records 0, and completed when the file is closed; a file that
+  // was recovered after a reset keeps the entry as it was. Host tools find the
+  // files of a time range from it, and the logger the next free file name.
+  static const uint8_t MANIFEST_VERSION = 1;
+  static const uint8_t MANIFEST_HEADER_SIZE = 8;
+  struct ManifestEntry {
+    char name[30];      // File name, zero padded
+    uint8_t version;    // FORMAT_VERSION of the file
+    uint8_t numSensors;
+    uint32_t start;     // Packed timestamp of the file header
+    uint32_t end;       // Packed timestamp of the last record
+    uint32_t records;   // Number of records
+  };
+
+  // Summary file, the name of the log file with the extension .sum
+  //
+  // "TEMPSUM", version (uint8_t), numSensors (uint8_t), the start timestamp
+  // of the log file (uint32_t), followed by the summary records of the minute
+  // and hour Rollup in the order they finish.
+  static const uint8_t SUMMARY_VERSION = 1;
+  static const uint8_t SUMMARY_HEADER_SIZE = 13;
 
   struct LogData {
-    uint32_t timestamp;
-    float *
-        temperatures; // Pointer to dynamically allocated array for temperatures
-    bool heaterStatus; // Is the heater heating
+    uint32_t timestamp; // Packed RTC time of the last record
+    uint32_t seconds;   // The same in seconds, for the time steps
+    uint32_t interval;  // Time step to the last record
+    // Temperatures of the last record, quarter degrees
+    int16_t temperatures[LOG_MAX_SENSORS];
+    uint8_t sinceKeyframe; // Records since the last keyframe
+    uint8_t status;        // Status byte of the last record
+    uint32_t fileId;       // Start timestamp of the file, part of block CRCs
+    uint16_t blockCrc;     // CRC of the block being filled, without used
   };
 
 private:
@@ -85,22 +227,69 @@ private:
   bool loggingEnabled;  // Flag to indicate whether logging is enabled
   bool loggingStartet; // Flag to indicate if logging is startet
   uint8_t _SD_CS_PIN;   // CS pin for SD reader
-  // Preallocate 100MiB file, 1024UL * 1024UL * 100UL .
-  const uint32_t PREALLOCATE_SIZE_MiB = 1024UL;
+  // Size of the preallocated log file in bytes
+  const uint32_t PREALLOCATE_SIZE = LOG_FILE_SIZE_MiB * 1024UL * 1024UL;
   char errorMessage[50];
   char logFileName[30]; // Buffer for the log file name
 
   sd_t sd;        // SdFat object
   file_t logFile; // SdFile object for the log file
   LogData data;   // Struct to hold the data to be logged
+  // Records are packed here and written to logFile in whole sectors
+#if LOG_RAW_SECTORS
+  RawFile rawFile; // Sector level access to logFile
+  SectorBuffer<RawFile, LOG_BUF_SECTORS> logBuf;
+#else
+  SectorBuffer<file_t, LOG_BUF_SECTORS> logBuf;
+#endif // LOG_RAW_SECTORS
+  uint32_t maxLogMicros;
+  // The buffered data should be synced to the card as soon as it is idle:
+  // a block is complete, or something worth keeping happened
+  bool syncPending;
+  // The card was busy while update() had data for it, since busySince
+  bool cardWaiting;
+  uint32_t busySince;
+  uint32_t maxWaitAvoided;
+  // Manifest entry of the open log file, or NO_MANIFEST_ENTRY, and the
+  // records in the file
+  static const uint16_t NO_MANIFEST_ENTRY = 0xFFFF;
+  uint16_t manifestIndex;
+  uint32_t recordCount;
+#if LOG_SUMMARY
+  file_t sumFile;
+  Rollup minuteRollup;
+  Rollup hourRollup;
+#endif // LOG_SUMMARY
 
   int enableLogging();
   bool isFileSizeExceeded();
   int openNewLogFile();
+  bool closeLogFile();
+  bool nextLogFileName();
+  int32_t openManifest(file_t &manifest);
+  bool readManifestEntry(file_t &manifest, uint16_t index,
+                         ManifestEntry &entry);
+  void addManifestEntry();
+  void closeManifestEntry();
+  void openSummary();
+  bool isSummaryPending();
+  void writeSummary();
+  bool preErase();
+  void recoverLogFiles();
+  bool findLogEnd(file_t &file, uint32_t &length);
+  int8_t checkBlock(file_t &file, uint32_t fileId, uint32_t block);
   void writeHeader();
   void printSDInfo();
   void errorPrint(const __FlashStringHelper* msg);
   uint32_t getCurrentTimestamp();
+  uint32_t timestampToSeconds(uint32_t timestamp);
+  bool writeVarint(int32_t value);
+  bool writeRecord(const void *src, size_t n);
+  bool startBlock();
+  void sealBlock();
+  void finishBlock();
+  // A keyframe, or a time step and temperature steps of the most varint bytes
+  uint8_t maxRecordSize() const { return 1 + 5 + 3 * numSensors; }
 #if USE_RTC
 
   uRTCLib rtc;
@@ -0,0 +1,105 @@
+#include "profile.h"
+
+#if LOOP_PROFILE
+Profiler profiler;
+
+uint8_t Profiler::bucket(uint32_t micros) {
+  // Bucket 0 below 16 us, then a power of two each
+  uint8_t b = 0;
+  for (uint32_t t = micros >> 4; t && b < BUCKETS - 1; t >>= 1)
+    b++;
+  return b;
+}
+
+void Profiler::add(uint8_t phase, uint32_t micros) {
+  Histogram &h = phases[phase];
+  uint8_t b = bucket(micros);
+  if (h.counts[b] == 0xFF) {
+    for (uint8_t i = 0; i < BUCKETS; i++)
+      h.counts[i] = (h.counts[i] + 1) >> 1;
+  }
+  h.counts[b]++;
+  h.times++;
+  if (micros > h.max) {
+    // Reported when it gets to a new bucket, not for every microsecond
+    if (micros > PROFILE_SLOW_MICROS && b > bucket(h.max))
+      slow |= 1 << phase;
+    h.max = micros;
+  }
+}
+
+void Profiler::reset() {
+  memset(phases, 0, sizeof(phases));
+  slow = 0;
+}
+
+void Profiler::poll(Stream &in) {
+  while (in.available()) {
+    switch (in.read()) {
+    case 'p':
+      print(in);
+      break;
+    case 'r':
+      reset();
+      in.println(F("profile reset"));
+      break;
+    }
+  }
+  for (uint8_t i = 0; slow && i < NUM_PHASES; i++) {
+    if (!(slow & (1 << i)))
+      continue;
+    slow &= ~(1 << i);
+    in.print(F("profile slow "));
+    printName(in, i);
+    in.print(' ');
+    in.println(phases[i].max);
+  }
+}
+
+void Profiler::print(Print &out) const {
+  for (uint8_t i = 0; i < NUM_PHASES; i++) {
+    const Histogram &h = phases[i];
+    out.print(F("profile "));
+    printName(out, i);
+    out.print(F(" max "));
+    out.print(h.max);
+    out.print(F(" n "));
+    out.print(h.times);
+    for (uint8_t b = 0; b < BUCKETS; b++) {
+      out.print(' ');
+      out.print(h.counts[b]);
+    }
+    out.println();
+  }
+}
+
+void Profiler::printName(Print &out, uint8_t phase) {
+  switch (phase) {
+  case LOOP:
+    out.print(F("loop"));
+    break;
+  case MENU:
+    out.print(F("menu"));
+    break;
+  case LOG_UPDATE:
+    out.print(F("log_update"));
+    break;
+  case SENSOR:
+    out.print(F("sensor"));
+    break;
+  case HEATER:
+    out.print(F("heater"));
+    break;
+  case LCD:
+    out.print(F("lcd"));
+    break;
+  case STATUS:
+    out.print(F("status"));
+    break;
+  case LOG_DATA:
+    out.print(F("log_data"));
+    break;
+  }
+}
+
+#endif // LOOP_PROFILE
@@ -0,0 +1,95 @@
+#ifndef PROFILE_H
+#define PROFILE_H
+
+#include <Arduino.h>
+
+// Time the phases of loop() with micros(), to see which one makes it late.
+// Each phase has a histogram of its times in powers of two and the longest
+// time, in 24 bytes of RAM. Built in with DEBUG.
+//
+// PROFILE(phase) at the top of a block times the rest of the block. Once per
+// loop(), Profiler::poll() reads commands from the serial port:
+//   p  print the histograms, a line per phase:
+//        profile <phase> max <us> n <times> <count 0> ... <count 15>
+//      count 0 is below 16 us, count i from 2^(i+3) us to twice that, and
+//      count 15 from 262 ms on. The counts are relative, see add().
+//   r  reset them
+// A phase that takes longer than PROFILE_SLOW_MICROS, and a power of two
+// longer than it ever did, is printed by the next poll() as
+//        profile slow <phase> <us>
+#ifndef LOOP_PROFILE
+#ifdef DEBUG
+#define LOOP_PROFILE 1
+#else
+#define LOOP_PROFILE 0
+#endif
+#endif
+
+#ifndef PROFILE_SLOW_MICROS
+#define PROFILE_SLOW_MICROS 20000UL
+#endif
+
+class Profiler {
+public:
+  enum Phase : uint8_t {
+    LOOP,       // all of loop()
+    MENU,       // menu.update(), the encoder, button and menu screens
+    LOG_UPDATE, // logger.update(), buffered sectors and syncs
+    SENSOR,     // reading the MAX6675
+    HEATER,     // heaterControl.update()
+    LCD,        // the default screen
+    STATUS,     // the status line or telemetry frame on Serial
+    LOG_DATA,   // logger.logData()
+    NUM_PHASES
+  };
+  static const uint8_t BUCKETS = 16;
+
+  Profiler() { reset(); }
+
+  // Count a time of phase. When a count is full all counts of the phase
+  // are halved, rounding up, so the shape stays and rare times are kept.
+  void add(uint8_t phase, uint32_t micros);
+  void reset();
+  // Handle the commands waiting on in, and report slow phases to it
+  void poll(Stream &in);
+  void print(Print &out) const;
+
+  // Times a phase from the constructor to the end of the scope
+  class Scope {
+  public:
+    Scope(Profiler &profiler, uint8_t phase)
+        : profiler(profiler), phase(phase), start(micros()) {}
+    ~Scope() { profiler.add(phase, micros() - start); }
+
+  private:
+    Profiler &profiler;
+    uint8_t phase;
+    uint32_t start;
+  };
+
+private:
+  struct Histogram {
+    uint8_t counts[BUCKETS];
+    uint32_t times;
+    uint32_t max;
+  };
+  Histogram phases[NUM_PHASES];
+  uint8_t slow; // bit per phase with a new max to report
+  static_assert(NUM_PHASES <= 8, "a bit of slow per phase");
+
+  static uint8_t bucket(uint32_t micros);
+  static void printName(Print &out, uint8_t phase);
+};
+
+#if LOOP_PROFILE
+extern Profiler profiler;
+#define PROFILE_CONCAT_(a, b) a##b
+#define PROFILE_CONCAT(a, b) PROFILE_CONCAT_(a, b)
+#define PROFILE(phase)                                                         \
+  Profiler::Scope PROFILE_CONCAT(profileScope, __LINE__)(profiler,             \
+                                                         Profiler::phase)
+#else
+#define PROFILE(phase) do {} while (0)
+#endif
+
+#endif
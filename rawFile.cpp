@@ -0,0 +1,68 @@
+// rawFile.cpp
+#include "rawFile.h"
+
+void RawFile::begin(SdCard *card, uint32_t firstSector, uint32_t count) {
+  this->card = card;
+  this->firstSector = firstSector;
+  this->count = count;
+  pos = 0;
+  nextSector = 0;
+  multi = false;
+}
+
+bool RawFile::close() {
+  bool ok = !card || stopMulti();
+  card = nullptr;
+  return ok;
+}
+
+bool RawFile::seekSet(uint32_t position) {
+  if (position > count * 512)
+    return false;
+  pos = position;
+  return true;
+}
+
+int RawFile::read(void *dst, size_t n) {
+  if (pos % 512 || n > 512 || pos / 512 >= count || !stopMulti())
+    return -1;
+  if (!card->readSector(firstSector + pos / 512, static_cast<uint8_t *>(dst)))
+    return -1;
+  pos += n;
+  return n;
+}
+
+size_t RawFile::write(const void *src, size_t n) {
+  if (pos % 512 || n > 512 || pos / 512 >= count)
+    return 0;
+  const uint8_t *p = static_cast<const uint8_t *>(src);
+  uint32_t sector = firstSector + pos / 512;
+
+  if (card->isDedicatedSpi()) {
+    // Keep streaming as long as the sectors follow each other. Rewriting the
+    // partial sector after a sync starts a new write.
+    if (multi && sector != nextSector && !stopMulti())
+      return 0;
+    if (!multi) {
+      if (!card->writeStart(sector))
+        return 0;
+      multi = true;
+    }
+    if (!card->writeData(p)) {
+      multi = false;
+      return 0;
+    }
+    nextSector = sector + 1;
+  } else if (!card->writeSector(sector, p)) {
+    return 0;
+  }
+  pos += n;
+  return n;
+}
+
+bool RawFile::stopMulti() {
+  if (!multi)
+    return true;
+  multi = false;
+  return card->writeStop();
+}
@@ -0,0 +1,54 @@
+#ifndef RAWFILE_H
+#define RAWFILE_H
+
+#include <Arduino.h>
+#include <SdFat.h>
+
+// Sector level access to a contiguous, preallocated file, modeled on SdFat's
+// LowLatencyLogger example.
+//
+// Data goes straight to the card's sectors, without touching the FAT, the
+// directory entry or SdFat's cache. The file keeps its preallocated size in the
+// directory until the owner truncates it when logging stops.
+//
+// It has the part of the SdFat file interface SectorBuffer uses. Transfers
+// always start on a sector boundary and use a buffer spanning the whole sector;
+// a short write writes the whole sector.
+//
+// On a dedicated SPI bus the sectors are streamed in one multiple sector write
+// (writeStart/writeData/writeStop). A shared bus has to be released between
+// transfers, so there every sector is written on its own.
+class RawFile {
+public:
+  RawFile() : card(nullptr) {}
+
+  // Use the count sectors starting at firstSector on card.
+  void begin(SdCard *card, uint32_t firstSector, uint32_t count);
+  // End a multiple sector write and detach from the card.
+  bool close();
+
+  uint32_t curPosition() const { return pos; }
+  bool seekSet(uint32_t position);
+  int read(void *dst, size_t n);
+  size_t write(const void *src, size_t n);
+  bool isBusy() { return card->isBusy(); }
+  // The card programs every sector as it is received, so there is nothing to
+  // do. Ending the multiple sector write would wait for the last sector to be
+  // programmed; the next write that does not follow on, or close(), ends it
+  // instead.
+  bool sync() { return true; }
+  // End the multiple sector write, before the card is used through SdFat
+  bool release() { return stopMulti(); }
+
+private:
+  SdCard *card;
+  uint32_t firstSector;
+  uint32_t count;      // size in sectors
+  uint32_t pos;        // byte offset in the file
+  uint32_t nextSector; // next sector of an open multiple sector write
+  bool multi;          // a multiple sector write is open
+
+  bool stopMulti();
+};
+
+#endif
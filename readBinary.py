@@ -1,70 +1,317 @@
+import binascii
 import struct
-from datetime import datetime
-import matplotlib.pyplot as plt
-import matplotlib.dates as mdates
+from datetime import datetime, timedelta
 import glob
 from pathlib import Path
 import argparse
+import csv
+import io
+import subprocess
 
 def read_log_file(file_path):
+    """Read a log file written by Log, format version 1, 2 or 3.
+
+    Returns lists of timestamps, temperature tuples and heater statuses
+    (heater enabled), or None, None, None if the file is not a log file.
+    """
+    with open(file_path, 'rb') as log_file:
+        data = log_file.read()
+
+    if data[:7] == b'HEADER\n':
+        return read_log_v1(file_path, data)
+    if data[:7] == b'TEMPLOG':
+        version = data[7]
+        if version == 2:
+            return read_log_v2(file_path, data)
+        if version == 3:
+            return read_log_v3(file_path, data)
+        print(f"Unsupported log format version {version} in {file_path}.")
+        return None, None, None
+    print(f"Invalid log file format: Header not found in {file_path}.")
+    return None, None, None
+
+
+def read_log_v1(file_path, data):
+    """Version 1: fixed size records of floats, a bool and the timestamp."""
     timestamps = []
     temperatures = []
     heater_statuses = []
-    num_sensors = None
 
-    with open(file_path, 'rb') as log_file:
-        # Read the header
-        header = log_file.read(7)  # Read the first 7 bytes ("HEADER\n")
-        if header != b'HEADER\n':
-            print(f"Invalid log file format: Header not found in {file_path}.")
-            return None, None, None
-
-        # Read the number of sensors (1 byte)
-        num_sensors = struct.unpack('<B', log_file.read(1))[0]
-        print(f"Number of sensors in {file_path}: {num_sensors}")
-
-        # Read the timestamp (4 bytes)
-        timestamp = struct.unpack('<I', log_file.read(4))[0]
-        year, month, day, hour, minute, second = decode_timestamp(timestamp)
-        print(f"Log start time in {file_path}: {year}-{month:02d}-{day:02d} {hour:02d}:{minute:02d}:{second:02d}")
-
-        # Read the size of each temperature value (4 bytes for float, 8 for double)
-        # temp_size = struct.unpack('<B', log_file.read(1))[0]  # Read 1 byte to determine size (4 or 8)
-        temp_size = 4;
-
-
-        # Read the data entries
-        while True:
-            # Read temperatures (num_sensors * 8 bytes each)
-            temp_data = log_file.read(num_sensors * temp_size)
-            if not temp_data:
-                break
-            # Unpack the temperatures based on detected size
-            if temp_size == 4:  # If temperature size is 4 bytes (float)
-                temperatures.append(struct.unpack(f'<{num_sensors}f', temp_data))
-            elif temp_size == 8:  # If temperature size is 8 bytes (double)
-                temperatures.append(struct.unpack(f'<{num_sensors}d', temp_data))
-
-
-            # Read heater status (1 byte)
-            heater_status = log_file.read(1)
-            if not heater_status:
-                break
-            heater_statuses.append(struct.unpack('<?', heater_status)[0])
-
-            # Read timestamp (4 bytes)
-            entry_timestamp = log_file.read(4)
-            if not entry_timestamp:
-                break
-            entry_timestamp = struct.unpack('<I', entry_timestamp)[0]
-            year, month, day, hour, minute, second = decode_timestamp(entry_timestamp)
-            timestamps.append(datetime(year + 2000, month, day, hour, minute, second))
-
-        print(f"Log end time in {file_path}: {year}-{month:02d}-{day:02d} {hour:02d}:{minute:02d}:{second:02d}")
-        print(f"# mesurements in {file_path}: {len(timestamps)}")
+    # "HEADER\n", the number of sensors, the start timestamp and the size of a
+    # temperature value (4 bytes for float, 8 for double)
+    num_sensors, timestamp, temp_size = struct.unpack_from('<BIB', data, 7)
+    print(f"Number of sensors in {file_path}: {num_sensors}")
+    print_time(f"Log start time in {file_path}", timestamp)
+    fmt = f"<{num_sensors}{'f' if temp_size == 4 else 'd'}?I"
+    record_size = struct.calcsize(fmt)
+
+    offset = 13
+    while offset + record_size <= len(data):
+        *temps, heater_status, entry_timestamp = struct.unpack_from(fmt, data, offset)
+        offset += record_size
+        temperatures.append(tuple(temps))
+        heater_statuses.append(heater_status)
+        timestamps.append(timestamp_to_datetime(entry_timestamp))
+
+    print_summary(file_path, timestamps)
+    return timestamps, temperatures, heater_statuses
+
+
+# Bits of the status byte in a version 2 record, see log.h
+HEATER_ENABLED = 0x01
+HEATING = 0x02
+SENSOR_ERROR = 0x04
+SAME_INTERVAL = 0x10
+RECORD = 0x40
+KEYFRAME = 0x80
+RESERVED = 0x28
+NO_TEMPERATURE = -32768
+
+
+def read_varint(data, offset):
+    """Read a zig-zag encoded varint, return the value and the next offset."""
+    value = 0
+    shift = 0
+    while True:
+        if offset >= len(data):
+            raise EOFError
+        byte = data[offset]
+        offset += 1
+        value |= (byte & 0x7F) << shift
+        shift += 7
+        if not byte & 0x80:
+            break
+    return (value >> 1) ^ -(value & 1), offset
+
+
+def decode_records(data, offset, end, num_sensors, timestamps, temperatures,
+                   heater_statuses):
+    """Decode the version 2/3 records in data[offset:end] and append them.
+
+    Stops at a status byte without RECORD, the padding of version 2 files.
+    Raises EOFError if the last record is cut off.
+    """
+    time = None
+    interval = 0
+    temps = [0] * num_sensors
+    while offset < end:
+        status = data[offset]
+        if not status & RECORD or status & RESERVED:
+            break
+        offset += 1
+        if status & KEYFRAME:
+            if offset + 4 + 2 * num_sensors > end:
+                raise EOFError
+            time = timestamp_to_datetime(struct.unpack_from('<I', data, offset)[0])
+            temps = list(struct.unpack_from(f'<{num_sensors}h', data, offset + 4))
+            offset += 4 + 2 * num_sensors
+            interval = 0
+        else:
+            if time is None:
+                raise ValueError("record before the first keyframe")
+            if not status & SAME_INTERVAL:
+                interval, offset = read_varint(data, offset)
+            for i in range(num_sensors):
+                step, offset = read_varint(data, offset)
+                temps[i] += step
+            if offset > end:
+                raise EOFError
+            time += timedelta(seconds=interval)
+        timestamps.append(time)
+        temperatures.append(tuple(float('nan') if t == NO_TEMPERATURE else t / 4
+                                  for t in temps))
+        heater_statuses.append(bool(status & HEATER_ENABLED))
+    return offset
+
+
+def read_log_v2(file_path, data):
+    """Version 2: delta encoded records with periodic keyframes."""
+    timestamps = []
+    temperatures = []
+    heater_statuses = []
+
+    # "TEMPLOG", version, the number of sensors and the start timestamp
+    num_sensors, timestamp = struct.unpack_from('<BI', data, 8)
+    print(f"Number of sensors in {file_path}: {num_sensors}")
+    print_time(f"Log start time in {file_path}", timestamp)
+
+    try:
+        decode_records(data, 13, len(data), num_sensors, timestamps,
+                       temperatures, heater_statuses)
+    except EOFError:
+        print(f"Truncated record at the end of {file_path}.")
+    except ValueError as e:
+        print(f"Corrupt data in {file_path}: {e}")
+
+    print_summary(file_path, timestamps)
+    return timestamps, temperatures, heater_statuses
+
+
+BLOCK_SIZE = 512
+BLOCK_HEADER_SIZE = 8
+
+
+def check_block(block, index, file_id):
+    """Return the number of record bytes in a version 3 block, or None if its
+    sequence number or CRC is wrong."""
+    if len(block) < BLOCK_SIZE:
+        return None
+    seq, used, crc = struct.unpack_from('<IHH', block)
+    if seq != index or used > BLOCK_SIZE - BLOCK_HEADER_SIZE:
+        return None
+    c = binascii.crc_hqx(struct.pack('<II', file_id, seq), 0xFFFF)
+    c = binascii.crc_hqx(block[BLOCK_HEADER_SIZE:BLOCK_HEADER_SIZE + used], c)
+    c = binascii.crc_hqx(struct.pack('<H', used), c)
+    return used if c == crc else None
+
+
+def read_log_v3(file_path, data):
+    """Version 3: version 2 records in 512 byte blocks with a sequence number
+    and a CRC. A bad block only loses its own records."""
+    timestamps = []
+    temperatures = []
+    heater_statuses = []
 
+    num_sensors, file_id = struct.unpack_from('<BI', data, 8)
+    print(f"Number of sensors in {file_path}: {num_sensors}")
+    print_time(f"Log start time in {file_path}", file_id)
+
+    bad = 0
+    for index in range(1, len(data) // BLOCK_SIZE):
+        block = data[index * BLOCK_SIZE:(index + 1) * BLOCK_SIZE]
+        used = check_block(block, index, file_id)
+        if used is None:
+            bad += 1
+            continue
+        try:
+            decode_records(block, BLOCK_HEADER_SIZE, BLOCK_HEADER_SIZE + used,
+                           num_sensors, timestamps, temperatures,
+                           heater_statuses)
+        except (EOFError, ValueError) as e:
+            print(f"Corrupt block {index} in {file_path}: {e!r}")
+    if bad:
+        print(f"Skipped {bad} invalid blocks in {file_path}.")
+
+    print_summary(file_path, timestamps)
     return timestamps, temperatures, heater_statuses
 
+
+def recover_log_file(file_path):
+    """Truncate a version 3 log after its last valid block.
+
+    A log that was never closed keeps the size of its preallocation. Blocks
+    are written in order, so a binary search finds the end of the data in
+    O(log n) block reads, like Log::findLogEnd() on the device.
+    """
+    with open(file_path, 'r+b') as log_file:
+        header = log_file.read(13)
+        if len(header) < 13 or header[:7] != b'TEMPLOG' or header[7] != 3:
+            print(f"Not a version 3 log file: {file_path}.")
+            return False
+        file_id = struct.unpack_from('<I', header, 9)[0]
+        size = log_file.seek(0, 2)
+
+        def valid(index):
+            log_file.seek(index * BLOCK_SIZE)
+            return check_block(log_file.read(BLOCK_SIZE), index, file_id) is not None
+
+        # Blocks before lo are valid, blocks from hi are not
+        lo, hi = 1, size // BLOCK_SIZE
+        while lo < hi:
+            mid = (lo + hi) // 2
+            if valid(mid):
+                lo = mid + 1
+            else:
+                hi = mid
+        length = lo * BLOCK_SIZE
+        if length < size:
+            log_file.truncate(length)
+            print(f"Recovered {file_path}: {size} -> {length} bytes.")
+    return True
+
+
+MANIFEST_ENTRY = struct.Struct('<30sBBIII')
+
+
+def read_manifest(file_path):
+    """Read the manifest Log keeps of its log files, see Log::ManifestEntry.
+
+    Returns a list of dicts with name, version, num_sensors, start, end and
+    records, in the order the files were created. end and records are 0 for
+    a file that was never closed.
+    """
+    with open(file_path, 'rb') as manifest:
+        data = manifest.read()
+    if data[:7] != b'TEMPMAN' or len(data) < 8 or data[7] != 1:
+        print(f"Invalid manifest: {file_path}.")
+        return []
+    entries = []
+    for offset in range(8, len(data) - MANIFEST_ENTRY.size + 1, MANIFEST_ENTRY.size):
+        name, version, num_sensors, start, end, records = MANIFEST_ENTRY.unpack_from(data, offset)
+        entries.append({'name': name.rstrip(b'\0').decode(), 'version': version,
+                        'num_sensors': num_sensors, 'start': start, 'end': end,
+                        'records': records})
+    return entries
+
+
+def print_manifest(file_path):
+    for entry in read_manifest(file_path):
+        start = timestamp_to_datetime(entry['start'])
+        end = timestamp_to_datetime(entry['end']) if entry['end'] else 'open'
+        print(f"{entry['name']}: v{entry['version']} {start} - {end}, "
+              f"{entry['records']} records")
+
+
+def read_summary(file_path):
+    """Read the per minute and per hour summary Log writes next to a log file.
+
+    Returns a dict mapping level (0 for minutes, 1 for hours) to a list of
+    dicts with start (datetime), samples, duty (fraction of samples with the
+    heater element on) and min, max and mean (lists of degrees, None for a
+    sensor without a reading).
+    """
+    with open(file_path, 'rb') as summary_file:
+        data = summary_file.read()
+    if data[:7] != b'TEMPSUM' or len(data) < 13 or data[7] != 1:
+        print(f"Invalid summary file: {file_path}.")
+        return {}
+    num_sensors = data[8]
+    record = struct.Struct('<BIHH' + 'hhh' * num_sensors)
+    levels = {0: [], 1: []}
+    for offset in range(13, len(data) - record.size + 1, record.size):
+        values = record.unpack_from(data, offset)
+        level, start, samples, heating = values[:4]
+        temps = [None if t == NO_TEMPERATURE else t / 4 for t in values[4:]]
+        levels.setdefault(level, []).append({
+            'start': timestamp_to_datetime(start), 'samples': samples,
+            'duty': heating / samples if samples else 0,
+            'min': temps[0::3], 'max': temps[1::3], 'mean': temps[2::3]})
+    return levels
+
+
+def print_summary_file(file_path):
+    for level, name in ((1, 'Hour'), (0, 'Minute')):
+        for row in read_summary(file_path).get(level, []):
+            print(f"{name} {row['start']}: {row['samples']} samples, "
+                  f"heating {row['duty']:.0%}, min {row['min']} "
+                  f"max {row['max']} mean {row['mean']}")
+
+
+def timestamp_to_datetime(timestamp):
+    year, month, day, hour, minute, second = decode_timestamp(timestamp)
+    return datetime(year + 2000, month, day, hour, minute, second)
+
+
+def print_time(text, timestamp):
+    year, month, day, hour, minute, second = decode_timestamp(timestamp)
+    print(f"{text}: {year}-{month:02d}-{day:02d} {hour:02d}:{minute:02d}:{second:02d}")
+
+
+def print_summary(file_path, timestamps):
+    if timestamps:
+        print(f"Log end time in {file_path}: {timestamps[-1]}")
+    print(f"# mesurements in {file_path}: {len(timestamps)}")
+
 def decode_timestamp(timestamp):
     """Decode the timestamp using bitwise operations
 
@@ -88,6 +335,9 @@ def plot_data(timestamps, temperatures, heater_statuses):
     if not timestamps or not temperatures or not heater_statuses:
         print("No data to plot.")
         return
+    # Only here, so the decoding can be used without matplotlib
+    import matplotlib.pyplot as plt
+    import matplotlib.dates as mdates
 
     # Flatten temperature data (since it's a list of lists)
     temperatures = [temp[0] for temp in temperatures]
@@ -121,17 +371,51 @@ def plot_data(timestamps, temperatures, heater_statuses):
     # Show the plot
     plt.show()
 
-def main(pattern):
+def read_downsampled(files, points):
+    """Merge the files and reduce them to points buckets with
+    host/build/templog downsample, which keeps the peaks and the heater
+    steps where each bucket starts and ends. Reading a long run with the
+    readers above takes minutes."""
+    templog = Path(__file__).parent / 'host' / 'build' / 'templog'
+    result = subprocess.run([str(templog), 'downsample', '-n', str(points)] +
+                            files, stdout=subprocess.PIPE, text=True,
+                            check=True)
+    timestamps = []
+    temperatures = []
+    heater_statuses = []
+    rows = csv.reader(io.StringIO(result.stdout))
+    next(rows)
+    for row in rows:
+        timestamps.append(datetime.strptime(row[0], '%Y-%m-%d %H:%M:%S'))
+        temperatures.append(tuple(float(t) if t else float('nan')
+                                  for t in row[2:]))
+        heater_statuses.append(bool(int(row[1]) & HEATER_ENABLED))
+    return timestamps, temperatures, heater_statuses
+
+
+def main(pattern, recover=False, points=None):
     # Path to the folder containing the files
     folder_path = Path('./logs')
     # Find all matching files
-    files = sorted(glob.glob(str(folder_path / pattern)), key=lambda x: int(x[-6:-4]))  # Sort by XX part
+    # TempLog_YYMMDD_hhmmss_NN.bin sorts by the start of the recording, then
+    # the segment number NN, also when the pattern matches several recordings
+    files = sorted(glob.glob(str(folder_path / pattern)))
+
+    if recover:
+        for file_path in files:
+            recover_log_file(file_path)
 
     # Initialize combined data lists
     all_timestamps = []
     all_temperatures = []
     all_heater_statuses = []
 
+    if points and files:
+        all_timestamps, all_temperatures, all_heater_statuses = \
+            read_downsampled(files, points)
+        print(f"Read {len(all_timestamps)} points from {len(files)} files")
+        files = []
+
     # Read data from all files
     for file_path in files:
         print(f"Reading file: {file_path}")
@@ -157,7 +441,32 @@ if __name__ == "__main__":
         default='TempLog_250131_230846_*.bin',
         help="File pattern to match log files (e.g., 'TempLog_250131_230846_*.bin')."
     )
+    parser.add_argument(
+        "--recover",
+        action='store_true',
+        help="Truncate log files that were never closed after their last valid block."
+    )
+    parser.add_argument(
+        "--manifest",
+        type=str,
+        help="List the log files in a manifest written by the logger (e.g., 'logs/manifest.bin')."
+    )
+    parser.add_argument(
+        "--summary",
+        type=str,
+        help="List the per hour and per minute rollups of a summary file (e.g., 'logs/TempLog_250131_230846_00.sum')."
+    )
+    parser.add_argument(
+        "--points",
+        type=int,
+        help="Downsample to this many buckets with host/build/templog (e.g., 2000), for long runs."
+    )
     args = parser.parse_args()
 
-    # Run the main function with the provided pattern
-    main(args.pattern)
+    if args.manifest:
+        print_manifest(args.manifest)
+    elif args.summary:
+        print_summary_file(args.summary)
+    else:
+        # Run the main function with the provided pattern
+        main(args.pattern, args.recover, args.points)
@@ -0,0 +1,70 @@
+// rollup.cpp
+#include "rollup.h"
+
+Rollup::Rollup(uint8_t level, uint16_t seconds, uint8_t numSensors)
+    : level(level), length(seconds),
+      numSensors(numSensors < ROLLUP_MAX_SENSORS ? numSensors
+                                                 : ROLLUP_MAX_SENSORS),
+      bucket(0), start(0), samples(0), heating(0), pending(false) {}
+
+bool Rollup::add(uint32_t timestamp, uint32_t seconds,
+                 const int16_t *temperatures, bool heating) {
+  bool ok = true;
+  if (isDue(seconds)) {
+    ok = !pending;
+    finish();
+  }
+  if (!samples) {
+    bucket = seconds / length;
+    start = timestamp;
+    this->heating = 0;
+    for (uint8_t i = 0; i < numSensors; i++) {
+      min[i] = 32767;
+      max[i] = NO_TEMPERATURE;
+      sum[i] = 0;
+      valid[i] = 0;
+    }
+  }
+  samples++;
+  if (heating)
+    this->heating++;
+  for (uint8_t i = 0; i < numSensors; i++) {
+    int16_t t = temperatures[i];
+    if (t == NO_TEMPERATURE)
+      continue;
+    if (t < min[i])
+      min[i] = t;
+    if (t > max[i])
+      max[i] = t;
+    sum[i] += t;
+    valid[i]++;
+  }
+  return ok;
+}
+
+void Rollup::finish() {
+  if (!samples)
+    return;
+  uint8_t *p = out;
+  *p++ = level;
+  memcpy(p, &start, sizeof(start));
+  p += sizeof(start);
+  memcpy(p, &samples, sizeof(samples));
+  p += sizeof(samples);
+  memcpy(p, &heating, sizeof(heating));
+  p += sizeof(heating);
+  for (uint8_t i = 0; i < numSensors; i++) {
+    int16_t t[3] = {NO_TEMPERATURE, NO_TEMPERATURE, NO_TEMPERATURE};
+    if (valid[i]) {
+      // Rounded to the nearest quarter degree
+      int32_t n = valid[i];
+      t[0] = min[i];
+      t[1] = max[i];
+      t[2] = (sum[i] + (sum[i] < 0 ? -n : n) / 2) / n;
+    }
+    memcpy(p, t, sizeof(t));
+    p += sizeof(t);
+  }
+  samples = 0;
+  pending = true;
+}
@@ -0,0 +1,68 @@
+#ifndef ROLLUP_H
+#define ROLLUP_H
+
+#include <Arduino.h>
+
+// Sensors a Rollup has room for. Its buffers are part of the object, so it
+// needs no heap.
+#ifndef ROLLUP_MAX_SENSORS
+#define ROLLUP_MAX_SENSORS 2
+#endif
+
+// Running aggregates of the logged records over buckets of a fixed length,
+// e.g. a minute or an hour, in fixed RAM: per sensor the min, max and mean
+// temperature, and the number of samples with the heater element on.
+//
+// When a sample falls in a new bucket, the finished one is packed into a
+// summary record and kept until the owner has written it, see isPending().
+// Summary record:
+//   level (uint8_t), the index of the rollup: 0 for minutes, 1 for hours
+//   start timestamp (uint32_t), packed RTC time of the first sample
+//   samples (uint16_t)
+//   heating (uint16_t), samples with the heater element on
+//   numSensors times min, max and mean (int16_t)
+// Temperatures are in quarter degrees; a sensor without a reading in the
+// whole bucket has NO_TEMPERATURE for all three. All values are little
+// endian.
+class Rollup {
+public:
+  static const int16_t NO_TEMPERATURE = -32767 - 1; // as in Log
+
+  // numSensors up to ROLLUP_MAX_SENSORS
+  Rollup(uint8_t level, uint16_t seconds, uint8_t numSensors);
+
+  // Add a sample, temperatures in quarter degrees. Returns false if it
+  // finished a bucket while the last one was still pending; that one is lost.
+  bool add(uint32_t timestamp, uint32_t seconds, const int16_t *temperatures,
+           bool heating);
+  // Would a sample at seconds finish the bucket being filled?
+  bool isDue(uint32_t seconds) const {
+    return samples && (seconds / length != bucket || samples == 0xFFFF);
+  }
+  // Finish the bucket being filled now, e.g. when logging stops
+  void finish();
+
+  // A finished bucket waits to be written
+  bool isPending() const { return pending; }
+  const uint8_t *record() const { return out; }
+  uint8_t recordSize() const { return 9 + 6 * numSensors; }
+  // The record is written
+  void clearPending() { pending = false; }
+
+private:
+  uint8_t level;
+  uint16_t length;  // seconds
+  uint8_t numSensors;
+  uint32_t bucket;  // seconds / length of the bucket being filled
+  uint32_t start;   // packed timestamp of its first sample
+  uint16_t samples;
+  uint16_t heating;
+  int16_t min[ROLLUP_MAX_SENSORS];
+  int16_t max[ROLLUP_MAX_SENSORS];
+  int32_t sum[ROLLUP_MAX_SENSORS];
+  uint16_t valid[ROLLUP_MAX_SENSORS]; // samples with a reading, per sensor
+  uint8_t out[9 + 6 * ROLLUP_MAX_SENSORS]; // the finished bucket
+  bool pending;
+};
+
+#endif
@@ -0,0 +1,154 @@
+#ifndef SECTORBUFFER_H
+#define SECTORBUFFER_H
+
+#include <Arduino.h>
+
+// Number of 512 byte sectors records are packed into before they are handed to
+// SdFat. With two sectors the buffers ping-pong: one fills while the other
+// waits for the card to finish programming. The Uno only has RAM for one, in
+// which case a full sector is written as soon as the card is idle, and at the
+// latest when the next byte has to go into it.
+#ifndef LOG_BUF_SECTORS
+#if defined(RAMEND) && RAMEND <= 0x8FF
+#define LOG_BUF_SECTORS 1
+#else
+#define LOG_BUF_SECTORS 2
+#endif
+#endif // LOG_BUF_SECTORS
+
+// Sector aligned write buffer for a log file.
+//
+// Records are copied into RAM and the file only ever sees writes of one whole
+// sector starting on a sector boundary, so SdFat writes them straight to the
+// card instead of doing read-modify-write cycles through its cache. The only
+// partial writes are done by sync(), which keeps the partial sector in RAM and
+// rewrites it in full once it is complete.
+//
+// F is the SdFat file type (File32, ExFile, FsFile), modeled on SdFat's
+// RingBuf.
+template <class F, uint8_t Sectors> class SectorBuffer {
+public:
+  static const uint16_t SECTOR_SIZE = 512;
+
+  SectorBuffer() { begin(nullptr); }
+
+  // Attach to an open file. Writing continues at the current file position;
+  // if that is inside a sector, the already written part is read back so the
+  // sector can later be written in full.
+  bool begin(F *_file) {
+    file = _file;
+    head = 0;
+    full = 0;
+    fill = 0;
+    sectorPos = 0;
+    maxWriteMicros = 0;
+    if (!file)
+      return true;
+    uint32_t pos = file->curPosition();
+    fill = pos % SECTOR_SIZE;
+    sectorPos = pos - fill;
+    if (fill) {
+      if (!file->seekSet(sectorPos) || file->read(buf[0], fill) != (int)fill)
+        return false;
+    }
+    return true;
+  }
+
+  // Copy n bytes into the buffer. Only blocks on the card if every sector is
+  // full and the oldest one has not been written yet.
+  bool write(const void *src, size_t n) {
+    const uint8_t *p = static_cast<const uint8_t *>(src);
+    while (n) {
+      if (full == Sectors && !writeSector())
+        return false;
+      uint8_t *dst = buf[(head + full) % Sectors];
+      size_t m = SECTOR_SIZE - fill;
+      if (m > n)
+        m = n;
+      memcpy(dst + fill, p, m);
+      fill += m;
+      p += m;
+      n -= m;
+      if (fill == SECTOR_SIZE) {
+        full++;
+        fill = 0;
+      }
+    }
+    return true;
+  }
+
+  // Write the oldest completed sector. Check isBusy() first, so it does not
+  // wait for the card.
+  bool writeNext() { return !full || writeSector(); }
+
+  // Is the card still programming the last sector written?
+  bool isBusy() { return file && file->isBusy(); }
+
+  // Write everything, including the partial sector, and sync the file.
+  bool sync() {
+    while (full) {
+      if (!writeSector())
+        return false;
+    }
+    if (fill) {
+      // Pad with zeros, in case the file writes the whole sector
+      memset(buf[head] + fill, 0, SECTOR_SIZE - fill);
+      if (file->curPosition() != sectorPos && !file->seekSet(sectorPos))
+        return false;
+      if (file->write(buf[head], fill) != fill)
+        return false;
+    }
+    return file->sync();
+  }
+
+  // Fill the rest of the sector being filled with zeros, so it can be written.
+  void padSector() {
+    if (!fill)
+      return;
+    memset(fillingSector() + fill, 0, SECTOR_SIZE - fill);
+    full++;
+    fill = 0;
+  }
+  // The sector being filled, to update what was written to it. Only valid
+  // while it is partly filled: sectorFill() is not 0.
+  uint8_t *fillingSector() { return buf[(head + full) % Sectors]; }
+  uint16_t sectorFill() const { return fill; }
+
+  // Logical size of the file, including the buffered bytes.
+  uint32_t position() const {
+    return sectorPos + (uint32_t)full * SECTOR_SIZE + fill;
+  }
+  // Completed sectors waiting to be written.
+  uint8_t sectorsQueued() const { return full; }
+  // Bytes not yet written to the card.
+  uint16_t bytesBuffered() const { return full * SECTOR_SIZE + fill; }
+  // Worst case time spent writing a single sector, in microseconds.
+  uint32_t getMaxWriteMicros() const { return maxWriteMicros; }
+
+private:
+  F *file;
+  uint8_t buf[Sectors][SECTOR_SIZE];
+  uint8_t head;       // oldest full sector
+  uint8_t full;       // number of full sectors waiting to be written
+  uint16_t fill;      // bytes in the sector being filled
+  uint32_t sectorPos; // file offset of buf[head]
+  uint32_t maxWriteMicros;
+
+  bool writeSector() {
+    uint32_t start = micros();
+    // a sync() may have left the position after a partial sector
+    if (file->curPosition() != sectorPos && !file->seekSet(sectorPos))
+      return false;
+    if (file->write(buf[head], SECTOR_SIZE) != SECTOR_SIZE)
+      return false;
+    sectorPos += SECTOR_SIZE;
+    head = (head + 1) % Sectors;
+    full--;
+    uint32_t elapsed = micros() - start;
+    if (elapsed > maxWriteMicros)
+      maxWriteMicros = elapsed;
+    return true;
+  }
+};
+
+#endif
@@ -0,0 +1,131 @@
+#include "devices.h"
+
+#include <string.h>
+
+namespace sim {
+
+namespace {
+uint8_t toBcd(uint8_t v) { return ((v / 10) << 4) | (v % 10); }
+uint8_t fromBcd(uint8_t v) { return (v >> 4) * 10 + (v & 0x0F); }
+
+// Days since 2000-01-01 for a civil date, valid for 2000..2099
+int32_t daysFromCivil(int y, unsigned m, unsigned d) {
+  y -= m <= 2;
+  const int era = y / 400;
+  const unsigned yoe = (unsigned)(y - era * 400);
+  const unsigned doy = (153 * (m + (m > 2 ? -3 : 9)) + 2) / 5 + d - 1;
+  const unsigned doe = yoe * 365 + yoe / 4 - yoe / 100 + doy;
+  return era * 146097 + (int32_t)doe - 730425; // 730425 = days 0000-03-01..2000
+}
+} // namespace
+
+uint32_t toSeconds2000(uint8_t year, uint8_t month, uint8_t day, uint8_t hour,
+                       uint8_t minute, uint8_t second) {
+  return (uint32_t)daysFromCivil(2000 + year, month, day) * 86400UL +
+         hour * 3600UL + minute * 60UL + second;
+}
+
+void fromSeconds2000(uint32_t t, uint8_t &year, uint8_t &month, uint8_t &day,
+                     uint8_t &hour, uint8_t &minute, uint8_t &second) {
+  second = t % 60;
+  minute = (t / 60) % 60;
+  hour = (t / 3600) % 24;
+  int32_t z = t / 86400 + 730425;
+  const int32_t era = z / 146097;
+  const unsigned doe = (unsigned)(z - era * 146097);
+  const unsigned yoe = (doe - doe / 1460 + doe / 36524 - doe / 146096) / 365;
+  const unsigned doy = doe - (365 * yoe + yoe / 4 - yoe / 100);
+  const unsigned mp = (5 * doy + 2) / 153;
+  day = doy - (153 * mp + 2) / 5 + 1;
+  month = mp < 10 ? mp + 3 : mp - 9;
+  year = (uint8_t)(yoe + era * 400 + (month <= 2) - 2000);
+}
+
+//------------------------------------------------------------------------------
+Ds1307::Ds1307(uint8_t year, uint8_t month, uint8_t day, uint8_t hour,
+               uint8_t minute, uint8_t second)
+    : offset(toSeconds2000(year, month, day, hour, minute, second)) {
+  memset(reg, 0, sizeof(reg));
+}
+
+uint32_t Ds1307::seconds() const { return offset + now() / 1000000; }
+
+bool Ds1307::write(const uint8_t *data, uint8_t length) {
+  if (!length)
+    return true;
+  pointer = data[0] & 0x3F;
+  if (length == 1)
+    return true;
+  uint8_t y, mo, d, h, mi, s;
+  fromSeconds2000(seconds(), y, mo, d, h, mi, s);
+  uint8_t time[7] = {toBcd(s), toBcd(mi), toBcd(h), 1, toBcd(d), toBcd(mo),
+                     toBcd(y)};
+  bool setTime = false;
+  for (uint8_t i = 1; i < length; i++, pointer = (pointer + 1) & 0x3F) {
+    if (pointer < 7) {
+      time[pointer] = data[i];
+      setTime = true;
+    } else {
+      reg[pointer] = data[i];
+    }
+  }
+  if (setTime) {
+    offset = (int64_t)toSeconds2000(fromBcd(time[6]), fromBcd(time[5] & 0x1F),
+                                    fromBcd(time[4]), fromBcd(time[2] & 0x3F),
+                                    fromBcd(time[1] & 0x7F),
+                                    fromBcd(time[0] & 0x7F)) -
+             (int64_t)(now() / 1000000);
+  }
+  return true;
+}
+
+uint8_t Ds1307::read(uint8_t *data, uint8_t length) {
+  uint8_t y, mo, d, h, mi, s;
+  fromSeconds2000(seconds(), y, mo, d, h, mi, s);
+  // 2000-01-01 was a Saturday, DS1307 counts Sunday as 1
+  uint8_t dow = (seconds() / 86400 + 6) % 7 + 1;
+  reg[0] = toBcd(s);
+  reg[1] = toBcd(mi);
+  reg[2] = toBcd(h);
+  reg[3] = dow;
+  reg[4] = toBcd(d);
+  reg[5] = toBcd(mo);
+  reg[6] = toBcd(y);
+  for (uint8_t i = 0; i < length; i++, pointer = (pointer + 1) & 0x3F)
+    data[i] = reg[pointer];
+  return length;
+}
+
+//------------------------------------------------------------------------------
+bool LcdBackpack::write(const uint8_t *, uint8_t length) {
+  bytesWritten += length;
+  return true;
+}
+
+uint8_t LcdBackpack::read(uint8_t *data, uint8_t length) {
+  memset(data, 0xFF, length);
+  return length;
+}
+
+//------------------------------------------------------------------------------
+void Max6675::select(bool selected) {
+  if (selected) {
+    latched = frame();
+    index = 0;
+  }
+}
+
+uint8_t Max6675::transfer(uint8_t) {
+  uint8_t rtn = index == 0 ? latched >> 8 : index == 1 ? latched & 0xFF : 0;
+  index++;
+  return rtn;
+}
+
+uint16_t Max6675::frame() {
+  // D14..D3 temperature in 0.25 C steps, D2 open thermocouple
+  float t = temperature < 0 ? 0 : temperature > 1023.75f ? 1023.75f
+                                                           : temperature;
+  return (uint16_t)(t * 4.0f + 0.5f) << 3;
+}
+
+} // namespace sim
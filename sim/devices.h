@@ -0,0 +1,63 @@
+// Simulated peripherals of the temp-monitor board: the DS1307 RTC and the
+// PCF8574 LCD backpack on I2C, and MAX6675 thermocouple converters on SPI.
+#ifndef SIM_DEVICES_H
+#define SIM_DEVICES_H
+
+#include <stdint.h>
+
+#include "hal/hal.h"
+
+namespace sim {
+
+// DS1307 real time clock. Counts virtual time from a settable start date.
+class Ds1307 : public I2cDevice {
+public:
+  // Start date, 2000 based year
+  Ds1307(uint8_t year = 25, uint8_t month = 1, uint8_t day = 1,
+         uint8_t hour = 0, uint8_t minute = 0, uint8_t second = 0);
+  bool write(const uint8_t *data, uint8_t length) override;
+  uint8_t read(uint8_t *data, uint8_t length) override;
+  // Seconds since 2000-01-01 00:00:00 at the current virtual time
+  uint32_t seconds() const;
+
+private:
+  int64_t offset; // seconds since 2000 at virtual time zero
+  uint8_t reg[64];
+  uint8_t pointer = 0;
+};
+
+// Calendar helpers, seconds since 2000-01-01 00:00:00
+uint32_t toSeconds2000(uint8_t year, uint8_t month, uint8_t day, uint8_t hour,
+                       uint8_t minute, uint8_t second);
+void fromSeconds2000(uint32_t t, uint8_t &year, uint8_t &month, uint8_t &day,
+                     uint8_t &hour, uint8_t &minute, uint8_t &second);
+
+// I2C_LCD on a PCF8574 backpack. Accepts and counts the writes.
+class LcdBackpack : public I2cDevice {
+public:
+  bool write(const uint8_t *data, uint8_t length) override;
+  uint8_t read(uint8_t *data, uint8_t length) override;
+  uint32_t bytesWritten = 0;
+};
+
+// MAX6675 at a fixed temperature. The 16 bit frame is latched when the chip
+// is selected and shifted out MSB first.
+class Max6675 : public SpiDevice {
+public:
+  explicit Max6675(float temperature = 20.0f) : temperature(temperature) {}
+  void select(bool selected) override;
+  uint8_t transfer(uint8_t out) override;
+  float temperature;
+
+protected:
+  // Raw frame returned by the next conversion
+  virtual uint16_t frame();
+
+private:
+  uint16_t latched = 0;
+  uint8_t index = 0;
+};
+
+} // namespace sim
+
+#endif
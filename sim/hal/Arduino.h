@@ -0,0 +1,270 @@
+// Host stand-in for the Arduino core, just enough of it to build the firmware
+// and the libraries it uses on Linux.
+//
+// Time is virtual: millis()/micros() only move when the firmware waits
+// (delay()) or when a bus transfer is charged its modelled cost, so a run is
+// deterministic and as fast as the host can execute it. See hal.h for the
+// simulator side of the interface.
+#ifndef SIM_ARDUINO_H
+#define SIM_ARDUINO_H
+
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <algorithm>
+#include <string>
+
+#include "avr/pgmspace.h"
+
+#define ARDUINO_SIM 1
+
+typedef uint8_t byte;
+typedef bool boolean;
+typedef unsigned int word;
+
+#define HIGH 0x1
+#define LOW 0x0
+#define INPUT 0x0
+#define OUTPUT 0x1
+#define INPUT_PULLUP 0x2
+
+#define LSBFIRST 0
+#define MSBFIRST 1
+
+#define DEC 10
+#define HEX 16
+#define OCT 8
+#define BIN 2
+
+#define NUM_DIGITAL_PINS 20
+
+// ATmega328 hardware SPI and analog pins
+static const uint8_t SS = 10;
+static const uint8_t MOSI = 11;
+static const uint8_t MISO = 12;
+static const uint8_t SCK = 13;
+static const uint8_t A0 = 14;
+static const uint8_t A1 = 15;
+static const uint8_t A2 = 16;
+static const uint8_t A3 = 17;
+static const uint8_t A4 = 18;
+static const uint8_t A5 = 19;
+
+using std::max;
+using std::min;
+
+template <class T, class L, class H> T constrain(T x, L lo, H hi) {
+  return x < lo ? lo : (x > hi ? hi : x);
+}
+
+unsigned long millis();
+unsigned long micros();
+void delay(unsigned long ms);
+void delayMicroseconds(unsigned int us);
+void yield();
+
+void pinMode(uint8_t pin, uint8_t mode);
+void digitalWrite(uint8_t pin, uint8_t val);
+int digitalRead(uint8_t pin);
+int analogRead(uint8_t pin);
+void analogWrite(uint8_t pin, int val);
+
+inline void noInterrupts() {}
+inline void interrupts() {}
+inline void cli() {}
+inline void sei() {}
+
+long random(long howbig);
+long random(long howsmall, long howbig);
+void randomSeed(unsigned long seed);
+
+// Register level pin access used by the Encoder library (direct_pin_read.h)
+volatile uint8_t *simPinRegister(uint8_t pin);
+#define IO_REG_TYPE uint8_t
+#define PIN_TO_BASEREG(pin) (simPinRegister(pin))
+#define PIN_TO_BITMASK(pin) (1)
+#define DIRECT_PIN_READ(base, mask) (((*(base)) & (mask)) ? 1 : 0)
+
+//------------------------------------------------------------------------------
+class __FlashStringHelper;
+#define F(string_literal)                                                      \
+  (reinterpret_cast<const __FlashStringHelper *>(PSTR(string_literal)))
+
+class String {
+public:
+  String(const char *s = "") : s(s ? s : "") {}
+  String(const __FlashStringHelper *s)
+      : s(reinterpret_cast<const char *>(s)) {}
+  String(const std::string &s) : s(s) {}
+  explicit String(char c) : s(1, c) {}
+  explicit String(int v, unsigned char base = DEC) : s(fmt(v, base)) {}
+  explicit String(unsigned v, unsigned char base = DEC) : s(fmt(v, base)) {}
+  explicit String(long v, unsigned char base = DEC) : s(fmt(v, base)) {}
+  explicit String(unsigned long v, unsigned char base = DEC)
+      : s(fmt(v, base)) {}
+  explicit String(double v, unsigned char decimals = 2) {
+    char buf[40];
+    snprintf(buf, sizeof(buf), "%.*f", decimals, v);
+    s = buf;
+  }
+  unsigned int length() const { return s.size(); }
+  const char *c_str() const { return s.c_str(); }
+  char charAt(unsigned int i) const { return i < s.size() ? s[i] : 0; }
+  char operator[](unsigned int i) const { return charAt(i); }
+  String substring(unsigned int from) const { return substring(from, length()); }
+  String substring(unsigned int from, unsigned int to) const {
+    if (from > to)
+      std::swap(from, to);
+    if (from >= s.size())
+      return String();
+    return String(s.substr(from, std::min<size_t>(to, s.size()) - from));
+  }
+  int indexOf(char c) const {
+    size_t i = s.find(c);
+    return i == std::string::npos ? -1 : (int)i;
+  }
+  long toInt() const { return atol(s.c_str()); }
+  float toFloat() const { return atof(s.c_str()); }
+  String &operator+=(const String &o) {
+    s += o.s;
+    return *this;
+  }
+  String &operator+=(const char *o) {
+    s += o;
+    return *this;
+  }
+  String &operator+=(char c) {
+    s += c;
+    return *this;
+  }
+  friend String operator+(String a, const String &b) { return a += b; }
+  bool operator==(const String &o) const { return s == o.s; }
+  bool operator==(const char *o) const { return s == o; }
+  bool operator!=(const String &o) const { return s != o.s; }
+
+private:
+  std::string s;
+  template <class T> static std::string fmt(T v, unsigned char base) {
+    if (base == DEC)
+      return std::to_string(v);
+    std::string r;
+    unsigned long long u = (unsigned long long)v;
+    do {
+      r.insert(r.begin(), "0123456789ABCDEF"[u % base]);
+      u /= base;
+    } while (u);
+    return r;
+  }
+};
+
+//------------------------------------------------------------------------------
+class Print;
+class Printable {
+public:
+  virtual ~Printable() {}
+  virtual size_t printTo(Print &p) const = 0;
+};
+
+class Print {
+public:
+  virtual ~Print() {}
+  virtual size_t write(uint8_t) = 0;
+  virtual size_t write(const uint8_t *buffer, size_t size) {
+    size_t n = 0;
+    while (size--) {
+      if (!write(*buffer++))
+        break;
+      n++;
+    }
+    return n;
+  }
+  size_t write(const char *str) {
+    return str ? write((const uint8_t *)str, strlen(str)) : 0;
+  }
+  size_t write(const char *buffer, size_t size) {
+    return write((const uint8_t *)buffer, size);
+  }
+  virtual int availableForWrite() { return 0; }
+  virtual void flush() {}
+
+  int getWriteError() { return writeError; }
+  void clearWriteError() { writeError = 0; }
+
+  size_t print(const __FlashStringHelper *s) {
+    return write(reinterpret_cast<const char *>(s));
+  }
+  size_t print(const String &s) { return write(s.c_str()); }
+  size_t print(const char s[]) { return write(s); }
+  size_t print(char c) { return write((uint8_t)c); }
+  size_t print(unsigned char v, int base = DEC) {
+    return print((unsigned long)v, base);
+  }
+  size_t print(int v, int base = DEC) { return print((long)v, base); }
+  size_t print(unsigned int v, int base = DEC) {
+    return print((unsigned long)v, base);
+  }
+  size_t print(long v, int base = DEC) {
+    if (base == DEC && v < 0)
+      return print('-') + print((unsigned long)-v, base);
+    return print((unsigned long)v, base);
+  }
+  size_t print(unsigned long v, int base = DEC) {
+    return print(String(v, (unsigned char)(base ? base : DEC)));
+  }
+  size_t print(long long v, int base = DEC) { return print((long)v, base); }
+  size_t print(unsigned long long v, int base = DEC) {
+    return print((unsigned long)v, base);
+  }
+  size_t print(double v, int digits = 2) {
+    if (isnan(v))
+      return print("nan");
+    if (isinf(v))
+      return print("inf");
+    return print(String(v, (unsigned char)digits));
+  }
+  size_t print(const Printable &p) { return p.printTo(*this); }
+
+  size_t println() { return write("\r\n"); }
+  template <class T> size_t println(const T &v) { return print(v) + println(); }
+  template <class T> size_t println(const T &v, int f) {
+    return print(v, f) + println();
+  }
+
+protected:
+  void setWriteError(int err = 1) { writeError = err; }
+
+private:
+  int writeError = 0;
+};
+
+class Stream : public Print {
+public:
+  virtual int available() = 0;
+  virtual int read() = 0;
+  virtual int peek() = 0;
+  void setTimeout(unsigned long) {}
+};
+
+// Serial port. Output goes to stdout (or nowhere, see sim::serialEcho) and is
+// charged 10 bit times per byte at the configured baud rate once the 64 byte
+// TX buffer is full, like HardwareSerial on the AVR.
+class HardwareSerial : public Stream {
+public:
+  void begin(unsigned long baud);
+  void end() {}
+  int available() override;
+  int read() override;
+  int peek() override;
+  int availableForWrite() override;
+  void flush() override;
+  size_t write(uint8_t c) override;
+  using Print::write;
+  operator bool() { return true; }
+};
+
+extern HardwareSerial Serial;
+
+#endif
@@ -0,0 +1,124 @@
+// The unittest() macros and assertions of arduino_ci, enough to run the
+// lib/*/test/unit_test_001.cpp of the libraries against the mock HAL.
+//
+// https://github.com/Arduino-CI/arduino_ci/blob/master/REFERENCE.md
+//
+// A failed assertion is reported and the test goes on; unittest_main() runs
+// the tests in the order of the file and returns non-zero if any failed.
+#ifndef SIM_ARDUINO_UNIT_TESTS_H
+#define SIM_ARDUINO_UNIT_TESTS_H
+
+#include <math.h>
+#include <stdio.h>
+
+#include <vector>
+
+namespace unittest {
+
+struct Test {
+  const char *name;
+  void (*run)();
+};
+
+inline std::vector<Test> &tests() {
+  static std::vector<Test> t;
+  return t;
+}
+
+struct State {
+  void (*setup)() = nullptr;
+  void (*teardown)() = nullptr;
+  unsigned assertions = 0;
+  unsigned failed = 0;
+};
+
+inline State &state() {
+  static State s;
+  return s;
+}
+
+struct Register {
+  Register(const char *name, void (*run)()) { tests().push_back({name, run}); }
+};
+
+struct Hook {
+  Hook(void (*&hook)(), void (*fn)()) { hook = fn; }
+};
+
+inline bool check(bool ok, const char *file, int line, const char *what) {
+  state().assertions++;
+  if (!ok) {
+    state().failed++;
+    fprintf(stderr, "%s:%d: failed: %s\n", file, line, what);
+  }
+  return ok;
+}
+
+inline int run() {
+  State &s = state();
+  unsigned failedTests = 0;
+  for (const Test &t : tests()) {
+    unsigned before = s.failed;
+    if (s.setup)
+      s.setup();
+    t.run();
+    if (s.teardown)
+      s.teardown();
+    bool ok = s.failed == before;
+    failedTests += !ok;
+    fprintf(stderr, "%s %s\n", ok ? "ok  " : "FAIL", t.name);
+  }
+  fprintf(stderr, "%zu tests, %u failed, %u assertions\n", tests().size(),
+          failedTests, s.assertions);
+  return failedTests ? 1 : 0;
+}
+
+} // namespace unittest
+
+#define unittest(name)                                                         \
+  static void unittest_##name();                                               \
+  static unittest::Register unittest_register_##name(#name, unittest_##name);  \
+  static void unittest_##name()
+
+#define unittest_setup()                                                       \
+  static void unittest_setup_();                                               \
+  static unittest::Hook unittest_setup_hook_(unittest::state().setup,          \
+                                             unittest_setup_);                 \
+  static void unittest_setup_()
+
+#define unittest_teardown()                                                    \
+  static void unittest_teardown_();                                            \
+  static unittest::Hook unittest_teardown_hook_(unittest::state().teardown,    \
+                                                unittest_teardown_);           \
+  static void unittest_teardown_()
+
+#define unittest_main()                                                        \
+  int main() { return unittest::run(); }
+
+#define unittest_check_(ok, what) unittest::check((ok), __FILE__, __LINE__, what)
+
+#define assertEqual(a, b) unittest_check_((a) == (b), #a " == " #b)
+#define assertNotEqual(a, b) unittest_check_((a) != (b), #a " != " #b)
+#define assertComparativeEquivalent(a, b)                                      \
+  unittest_check_(!((a) > (b)) && !((a) < (b)), #a " ~ " #b)
+#define assertComparativeNotEquivalent(a, b)                                   \
+  unittest_check_((a) > (b) || (a) < (b), #a " !~ " #b)
+#define assertLess(a, b) unittest_check_((a) < (b), #a " < " #b)
+#define assertMore(a, b) unittest_check_((a) > (b), #a " > " #b)
+#define assertLessOrEqual(a, b) unittest_check_((a) <= (b), #a " <= " #b)
+#define assertMoreOrEqual(a, b) unittest_check_((a) >= (b), #a " >= " #b)
+#define assertTrue(a) unittest_check_(bool(a), #a)
+#define assertFalse(a) unittest_check_(!(a), "!" #a)
+#define assertNull(a) unittest_check_((a) == nullptr, #a " == NULL")
+#define assertNotNull(a) unittest_check_((a) != nullptr, #a " != NULL")
+
+#define assertEqualFloat(a, b, epsilon)                                        \
+  unittest_check_(fabs(double(a) - double(b)) <= (epsilon), #a " == " #b)
+#define assertNotEqualFloat(a, b, epsilon)                                     \
+  unittest_check_(fabs(double(a) - double(b)) >= (epsilon), #a " != " #b)
+#define assertInfinity(a) unittest_check_(isinf(a), "isinf(" #a ")")
+#define assertNotInfinity(a) unittest_check_(!isinf(a), "!isinf(" #a ")")
+#define assertNAN(a) unittest_check_(isnan(a), "isnan(" #a ")")
+#define assertNotNAN(a) unittest_check_(!isnan(a), "!isnan(" #a ")")
+
+#endif
@@ -0,0 +1,56 @@
+// Host stand-in for the Arduino SPI library.
+//
+// Transfers are routed to the simulated device whose chip select pin is
+// currently driven LOW (see sim::attachSpi() in hal.h) and charged 8 SCK
+// periods per byte at the clock of the active transaction.
+#ifndef SIM_SPI_H
+#define SIM_SPI_H
+
+#include "Arduino.h"
+
+#define SPI_MODE0 0x00
+#define SPI_MODE1 0x04
+#define SPI_MODE2 0x08
+#define SPI_MODE3 0x0C
+
+#define SPI_CLOCK_DIV2 0x04
+#define SPI_CLOCK_DIV4 0x00
+
+class SPISettings {
+public:
+  SPISettings() : clock(4000000), bitOrder(MSBFIRST), dataMode(SPI_MODE0) {}
+  SPISettings(uint32_t clock, uint8_t bitOrder, uint8_t dataMode)
+      : clock(clock), bitOrder(bitOrder), dataMode(dataMode) {}
+  uint32_t clock;
+  uint8_t bitOrder;
+  uint8_t dataMode;
+};
+
+class SPIClass {
+public:
+  void begin() {}
+  void end() {}
+  void beginTransaction(SPISettings settings);
+  void endTransaction();
+  uint8_t transfer(uint8_t data);
+  uint16_t transfer16(uint16_t data) {
+    uint16_t hi = transfer(data >> 8);
+    return (hi << 8) | transfer(data & 0xFF);
+  }
+  void transfer(void *buf, size_t count) {
+    uint8_t *p = static_cast<uint8_t *>(buf);
+    for (size_t i = 0; i < count; i++)
+      p[i] = transfer(p[i]);
+  }
+  void setClockDivider(uint8_t) {}
+  void setDataMode(uint8_t) {}
+  void setBitOrder(uint8_t) {}
+  void usingInterrupt(uint8_t) {}
+
+private:
+  uint32_t clock = 4000000;
+};
+
+extern SPIClass SPI;
+
+#endif
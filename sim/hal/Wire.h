@@ -0,0 +1,50 @@
+// Host stand-in for the Arduino Wire (I2C) library.
+//
+// Transactions are routed to the simulated device at the addressed slave
+// address (see sim::attachI2c() in hal.h) and charged 9 SCL periods per byte
+// at the configured bus clock.
+#ifndef SIM_WIRE_H
+#define SIM_WIRE_H
+
+#include "Arduino.h"
+
+#define BUFFER_LENGTH 32
+
+class TwoWire : public Stream {
+public:
+  void begin() {}
+  void begin(uint8_t) {}
+  void begin(int, int) {}
+  void end() {}
+  void setClock(uint32_t hz) { clock = hz; }
+  void beginTransmission(uint8_t address);
+  void beginTransmission(int address) { beginTransmission((uint8_t)address); }
+  uint8_t endTransmission(bool sendStop = true);
+  uint8_t requestFrom(uint8_t address, uint8_t quantity, bool sendStop = true);
+  uint8_t requestFrom(int address, int quantity) {
+    return requestFrom((uint8_t)address, (uint8_t)quantity);
+  }
+  size_t write(uint8_t data) override;
+  size_t write(const uint8_t *data, size_t quantity) override;
+  size_t write(unsigned long n) { return write((uint8_t)n); }
+  size_t write(long n) { return write((uint8_t)n); }
+  size_t write(unsigned int n) { return write((uint8_t)n); }
+  size_t write(int n) { return write((uint8_t)n); }
+  using Print::write;
+  int available() override { return rxLength - rxIndex; }
+  int read() override { return rxIndex < rxLength ? rxBuffer[rxIndex++] : -1; }
+  int peek() override { return rxIndex < rxLength ? rxBuffer[rxIndex] : -1; }
+
+private:
+  uint32_t clock = 100000;
+  uint8_t txAddress = 0;
+  uint8_t txBuffer[BUFFER_LENGTH];
+  uint8_t txLength = 0;
+  uint8_t rxBuffer[BUFFER_LENGTH];
+  uint8_t rxIndex = 0;
+  uint8_t rxLength = 0;
+};
+
+extern TwoWire Wire;
+
+#endif
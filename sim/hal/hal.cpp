@@ -0,0 +1,248 @@
+#include "hal.h"
+
+#include <map>
+#include <string>
+#include <vector>
+
+#include "Arduino.h"
+#include "SPI.h"
+#include "Wire.h"
+
+HardwareSerial Serial;
+SPIClass SPI;
+TwoWire Wire;
+
+namespace {
+uint64_t nowMicros = 0;
+sim::Costs costModel;
+sim::Stats busStats;
+
+volatile uint8_t pinLevel[NUM_DIGITAL_PINS];
+std::function<void(uint8_t, uint8_t)> pinHook;
+
+std::map<uint8_t, sim::SpiDevice *> spiDevices;
+std::map<uint8_t, sim::I2cDevice *> i2cDevices;
+
+// Serial TX model
+const uint8_t SERIAL_TX_BUFFER_SIZE = 64;
+uint32_t serialByteMicros = 87; // 115200 baud, 10 bits per byte
+uint64_t serialTxEmptyAt = 0;   // time the TX buffer has drained
+bool echoSerial = true;
+std::function<void(uint8_t)> serialHook;
+std::string serialRx;
+
+void charge(uint64_t us) { nowMicros += us; }
+} // namespace
+
+namespace sim {
+uint64_t now() { return nowMicros; }
+void advance(uint64_t us) { nowMicros += us; }
+void attachSpi(uint8_t csPin, SpiDevice *device) { spiDevices[csPin] = device; }
+void attachI2c(uint8_t address, I2cDevice *device) {
+  i2cDevices[address] = device;
+}
+void setPin(uint8_t pin, uint8_t level) {
+  if (pin < NUM_DIGITAL_PINS)
+    pinLevel[pin] = level ? HIGH : LOW;
+}
+uint8_t getPin(uint8_t pin) {
+  return pin < NUM_DIGITAL_PINS ? pinLevel[pin] : LOW;
+}
+void onPinWrite(std::function<void(uint8_t, uint8_t)> hook) { pinHook = hook; }
+void serialInput(const char *text) { serialRx += text; }
+void serialEcho(bool enable) { echoSerial = enable; }
+void onSerialWrite(std::function<void(uint8_t)> hook) { serialHook = hook; }
+Costs &costs() { return costModel; }
+Stats &stats() { return busStats; }
+} // namespace sim
+
+//------------------------------------------------------------------------------
+// Time
+unsigned long millis() { return nowMicros / 1000; }
+unsigned long micros() { return (unsigned long)nowMicros; }
+void delay(unsigned long ms) { charge((uint64_t)ms * 1000); }
+void delayMicroseconds(unsigned int us) { charge(us); }
+void yield() {}
+
+//------------------------------------------------------------------------------
+// Pins
+void pinMode(uint8_t pin, uint8_t mode) {
+  if (pin < NUM_DIGITAL_PINS && mode == INPUT_PULLUP)
+    pinLevel[pin] = HIGH;
+}
+
+void digitalWrite(uint8_t pin, uint8_t val) {
+  charge(costModel.digitalWrite);
+  if (pin >= NUM_DIGITAL_PINS)
+    return;
+  uint8_t level = val ? HIGH : LOW;
+  bool changed = pinLevel[pin] != level;
+  pinLevel[pin] = level;
+  if (changed) {
+    auto dev = spiDevices.find(pin);
+    if (dev != spiDevices.end())
+      dev->second->select(level == LOW);
+  }
+  if (pinHook)
+    pinHook(pin, level);
+}
+
+int digitalRead(uint8_t pin) {
+  charge(costModel.digitalWrite);
+  return sim::getPin(pin);
+}
+
+int analogRead(uint8_t) {
+  charge(112); // 13 ADC clocks at 125 kHz
+  return 0;
+}
+void analogWrite(uint8_t pin, int val) { digitalWrite(pin, val > 127); }
+
+volatile uint8_t *simPinRegister(uint8_t pin) {
+  return pin < NUM_DIGITAL_PINS ? &pinLevel[pin] : &pinLevel[0];
+}
+
+long random(long howbig) { return howbig ? rand() % howbig : 0; }
+long random(long howsmall, long howbig) {
+  return howsmall >= howbig ? howsmall : howsmall + random(howbig - howsmall);
+}
+void randomSeed(unsigned long seed) { srand(seed); }
+
+//------------------------------------------------------------------------------
+// Serial
+void HardwareSerial::begin(unsigned long baud) {
+  serialByteMicros = (10UL * 1000000UL + baud - 1) / baud;
+}
+
+int HardwareSerial::available() { return serialRx.size(); }
+
+int HardwareSerial::read() {
+  if (serialRx.empty())
+    return -1;
+  uint8_t c = serialRx[0];
+  serialRx.erase(0, 1);
+  return c;
+}
+
+int HardwareSerial::peek() {
+  return serialRx.empty() ? -1 : (uint8_t)serialRx[0];
+}
+
+int HardwareSerial::availableForWrite() {
+  if (serialTxEmptyAt <= nowMicros)
+    return SERIAL_TX_BUFFER_SIZE - 1;
+  uint64_t queued =
+      (serialTxEmptyAt - nowMicros + serialByteMicros - 1) / serialByteMicros;
+  return queued >= SERIAL_TX_BUFFER_SIZE - 1
+             ? 0
+             : SERIAL_TX_BUFFER_SIZE - 1 - (int)queued;
+}
+
+void HardwareSerial::flush() {
+  if (serialTxEmptyAt > nowMicros) {
+    busStats.serialStallMicros += serialTxEmptyAt - nowMicros;
+    nowMicros = serialTxEmptyAt;
+  }
+}
+
+size_t HardwareSerial::write(uint8_t c) {
+  // Block, like the AVR core does, while the TX buffer is full
+  if (availableForWrite() == 0) {
+    uint64_t wait = serialTxEmptyAt - nowMicros -
+                    (uint64_t)(SERIAL_TX_BUFFER_SIZE - 2) * serialByteMicros;
+    busStats.serialStallMicros += wait;
+    nowMicros += wait;
+  }
+  serialTxEmptyAt =
+      (serialTxEmptyAt > nowMicros ? serialTxEmptyAt : nowMicros) +
+      serialByteMicros;
+  busStats.serialBytes++;
+  if (echoSerial)
+    putchar(c);
+  if (serialHook)
+    serialHook(c);
+  return 1;
+}
+
+//------------------------------------------------------------------------------
+// SPI
+void SPIClass::beginTransaction(SPISettings settings) {
+  clock = settings.clock ? settings.clock : 4000000;
+  // The AVR SPI clock is F_CPU / 2^n, at most 8 MHz
+  uint32_t sck = 8000000;
+  while (sck > clock && sck > 125000)
+    sck /= 2;
+  clock = sck;
+}
+
+void SPIClass::endTransaction() {}
+
+uint8_t SPIClass::transfer(uint8_t data) {
+  uint64_t cost = 8000000ULL / clock + costModel.spiByteOverhead;
+  charge(cost);
+  busStats.spiBytes++;
+  busStats.spiMicros += cost;
+  sim::SpiDevice *selected = nullptr;
+  uint8_t rx = 0xFF;
+  for (auto &dev : spiDevices) {
+    if (pinLevel[dev.first] != LOW)
+      continue;
+    if (selected)
+      busStats.spiConflicts++;
+    selected = dev.second;
+    rx &= dev.second->transfer(data); // open drain like conflict
+  }
+  return rx;
+}
+
+//------------------------------------------------------------------------------
+// Wire
+namespace {
+void chargeI2c(uint32_t clock, size_t bytes) {
+  uint64_t cost = costModel.i2cStartStop + bytes * 9ULL * 1000000ULL / clock;
+  charge(cost);
+  busStats.i2cBytes += bytes;
+  busStats.i2cMicros += cost;
+}
+} // namespace
+
+void TwoWire::beginTransmission(uint8_t address) {
+  txAddress = address;
+  txLength = 0;
+}
+
+size_t TwoWire::write(uint8_t data) {
+  if (txLength >= BUFFER_LENGTH)
+    return 0;
+  txBuffer[txLength++] = data;
+  return 1;
+}
+
+size_t TwoWire::write(const uint8_t *data, size_t quantity) {
+  size_t n = 0;
+  while (n < quantity && write(data[n]))
+    n++;
+  return n;
+}
+
+uint8_t TwoWire::endTransmission(bool) {
+  chargeI2c(clock, txLength + 1);
+  auto dev = i2cDevices.find(txAddress);
+  uint8_t rtn = 2; // address NACK
+  if (dev != i2cDevices.end())
+    rtn = dev->second->write(txBuffer, txLength) ? 0 : 3;
+  txLength = 0;
+  return rtn;
+}
+
+uint8_t TwoWire::requestFrom(uint8_t address, uint8_t quantity, bool) {
+  if (quantity > BUFFER_LENGTH)
+    quantity = BUFFER_LENGTH;
+  rxIndex = 0;
+  rxLength = 0;
+  auto dev = i2cDevices.find(address);
+  if (dev != i2cDevices.end())
+    rxLength = dev->second->read(rxBuffer, quantity);
+  chargeI2c(clock, rxLength + 1);
+  return rxLength;
+}
@@ -0,0 +1,78 @@
+// Simulator side of the mock Arduino HAL.
+//
+// The firmware only sees the Arduino API (Arduino.h, SPI.h, Wire.h). The
+// simulated world - devices on the buses, input pins, the passage of time -
+// is set up through the functions here.
+#ifndef SIM_HAL_H
+#define SIM_HAL_H
+
+#include <stdint.h>
+
+#include <functional>
+
+namespace sim {
+
+// Virtual time in microseconds since reset.
+uint64_t now();
+// Let time pass, e.g. while the firmware is idle between loop() calls.
+void advance(uint64_t us);
+
+// A device on the SPI bus, selected by driving its chip select pin LOW.
+class SpiDevice {
+public:
+  virtual ~SpiDevice() {}
+  // Chip select changed
+  virtual void select(bool selected) { (void)selected; }
+  // Exchange one byte. Called with the device selected.
+  virtual uint8_t transfer(uint8_t out) = 0;
+};
+void attachSpi(uint8_t csPin, SpiDevice *device);
+
+// A device on the I2C bus.
+class I2cDevice {
+public:
+  virtual ~I2cDevice() {}
+  // Master write transaction. Return false to NACK.
+  virtual bool write(const uint8_t *data, uint8_t length) = 0;
+  // Master read transaction, return the number of bytes supplied.
+  virtual uint8_t read(uint8_t *data, uint8_t length) = 0;
+};
+void attachI2c(uint8_t address, I2cDevice *device);
+
+// Drive an input pin from outside, e.g. a button or the encoder.
+void setPin(uint8_t pin, uint8_t level);
+// Current level of a pin.
+uint8_t getPin(uint8_t pin);
+// Called whenever the firmware writes an output pin.
+void onPinWrite(std::function<void(uint8_t pin, uint8_t level)> hook);
+
+// Queue bytes to be read by the firmware from Serial.
+void serialInput(const char *text);
+// Echo Serial output to stdout (default on).
+void serialEcho(bool enable);
+// Called with every byte the firmware writes to Serial.
+void onSerialWrite(std::function<void(uint8_t c)> hook);
+
+// Cost model, in microseconds. Defaults approximate an ATmega328 at 16 MHz.
+struct Costs {
+  uint32_t digitalWrite = 4; // digitalWrite()/digitalRead() with pin lookup
+  uint32_t spiByteOverhead = 1; // loop and register access around SPDR
+  uint32_t i2cStartStop = 20;
+};
+Costs &costs();
+
+// Bus statistics since reset.
+struct Stats {
+  uint64_t spiBytes = 0;
+  uint64_t spiMicros = 0;
+  uint32_t spiConflicts = 0; // transfers with more than one device selected
+  uint64_t i2cBytes = 0;
+  uint64_t i2cMicros = 0;
+  uint64_t serialBytes = 0;
+  uint64_t serialStallMicros = 0; // time spent waiting for the TX buffer
+};
+Stats &stats();
+
+} // namespace sim
+
+#endif
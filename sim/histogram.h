@@ -0,0 +1,93 @@
+// Histogram of latencies in microseconds, eight buckets to a power of two,
+// so a percentile is within an eighth of the true one, from a microsecond to
+// over an hour in a few hundred counters.
+#ifndef SIM_HISTOGRAM_H
+#define SIM_HISTOGRAM_H
+
+#include <stdint.h>
+#include <stdio.h>
+
+namespace sim {
+
+class Histogram {
+public:
+  void add(uint64_t us) {
+    counts[bucket(us)]++;
+    total++;
+    sum += us;
+    if (us > max_)
+      max_ = us;
+  }
+
+  uint64_t count() const { return total; }
+  uint64_t max() const { return max_; }
+  double mean() const { return total ? double(sum) / total : 0; }
+
+  // The upper bound of the bucket of the pth percentile, 0 <= p <= 100
+  uint64_t percentile(double p) const {
+    uint64_t rank = uint64_t(p / 100 * total + 0.5);
+    if (rank < 1)
+      rank = 1;
+    uint64_t n = 0;
+    for (int i = 0; i < BUCKETS; i++) {
+      n += counts[i];
+      if (n >= rank)
+        return lower(i + 1) - 1 < max_ ? lower(i + 1) - 1 : max_;
+    }
+    return max_;
+  }
+
+  // One line of count and percentiles
+  void summary(FILE *f, const char *name) const {
+    fprintf(f,
+            "%s: %llu, mean %.0f us, p50 %llu us, p99 %llu us, "
+            "p99.9 %llu us, max %llu us\n",
+            name, (unsigned long long)total, mean(),
+            (unsigned long long)percentile(50),
+            (unsigned long long)percentile(99),
+            (unsigned long long)percentile(99.9), (unsigned long long)max_);
+  }
+
+  // The counts per power of two, the empty ones left out
+  void print(FILE *f) const {
+    for (int octave = 0; octave < BUCKETS / SUB; octave++) {
+      uint64_t n = 0;
+      for (int i = 0; i < SUB; i++)
+        n += counts[octave * SUB + i];
+      if (!n)
+        continue;
+      fprintf(f, "  < %10llu us %10llu %7.3f%%\n",
+              (unsigned long long)lower((octave + 1) * SUB),
+              (unsigned long long)n, 100.0 * n / total);
+    }
+  }
+
+private:
+  static const int SUB = 8; // buckets to a power of two
+  static const int BUCKETS = 40 * SUB;
+
+  uint64_t counts[BUCKETS] = {};
+  uint64_t total = 0;
+  uint64_t sum = 0;
+  uint64_t max_ = 0;
+
+  // Below SUB each value has a bucket, above it SUB to a power of two
+  static int bucket(uint64_t us) {
+    if (us < SUB)
+      return int(us);
+    int e = 63 - __builtin_clzll(us); // 2^e <= us
+    int i = (e - 2) * SUB + int((us >> (e - 3)) & (SUB - 1));
+    return i < BUCKETS ? i : BUCKETS - 1;
+  }
+  // The smallest value of bucket i
+  static uint64_t lower(int i) {
+    if (i < SUB)
+      return uint64_t(i);
+    int e = i / SUB + 2;
+    return (uint64_t(SUB) + i % SUB) << (e - 3);
+  }
+};
+
+} // namespace sim
+
+#endif
@@ -0,0 +1,286 @@
+// Runs the temp-monitor firmware on the host against the mock HAL.
+//
+//   temp-monitor-sim [--seconds N] [--tick US] [--quiet] [--target C]
+//                    [--ambient C] [--power W] [--dead-time S] [--lag S]
+//                    [--noise C] [--open P] [--seed N] [--trace FILE]
+//                    [--image FILE] [--program US] [--jitter US]
+//                    [--rewrite US] [--used] [--gc N] [--gc-stall MIN:MAX]
+//                    [--write-errors P] [--read-errors P] [--histogram]
+//                    [--profile]
+//
+// setup() is called once and loop() until N seconds of virtual time have
+// passed. Between two loop() calls the virtual clock advances by the tick
+// (default 1000 us), which stands in for the time loop() takes on the AVR.
+//
+// The thermocouple reads the oven of a ThermalPlant, heated through the
+// heater pin. With --target the heater is enabled at that temperature after
+// setup(), as if set with the encoder, and the run ends with the overshoot,
+// undershoot and cycles of the oven, to compare changes to HeaterControl.
+// --trace writes the plant each simulated second as CSV.
+//
+// The SD card is a FlashCard, in memory or on an image file that is kept
+// between runs, with the write times, garbage collection stalls and errors
+// of FlashTiming. The run ends with the latency of loop(), of all calls and
+// of those that went to the card, to compare the logging options of log.h
+// on the same card; --histogram adds the counts per power of two.
+// --profile sends the p command of profile.h at the end, for the times of
+// the phases of loop() as the firmware measured them.
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <SdFat.h>
+#include <algorithm>
+#include <chrono>
+#include <memory>
+
+#include "devices.h"
+#include "hal/hal.h"
+#include "heaterControl.h"
+#include "histogram.h"
+#include "plant.h"
+#include "sdcard.h"
+
+void setup();
+void loop();
+extern HeaterControl heaterControl;
+
+// Pins and addresses as wired in temp-monitor.ino, log.h and menu.h
+const uint8_t SIM_SD_CS_PIN = 4;
+const uint8_t SIM_MAX6675_CS_PIN = 7;
+const uint8_t SIM_ENCODER_BUTTON_PIN = 5;
+const uint8_t SIM_HEATER_PIN = 6;
+const uint8_t SIM_LCD_ADDRESS = 0x27;
+const uint8_t SIM_RTC_ADDRESS = 0x68;
+
+static void usage(const char *prog) {
+  fprintf(stderr,
+          "usage: %s [--seconds N] [--tick US] [--quiet] [--target C]\n"
+          "       [--ambient C] [--power W] [--dead-time S] [--lag S]\n"
+          "       [--noise C] [--open P] [--seed N] [--trace FILE]\n"
+          "       [--image FILE] [--program US] [--jitter US] [--rewrite US]\n"
+          "       [--used] [--gc N] [--gc-stall MIN:MAX] [--write-errors P]\n"
+          "       [--read-errors P] [--histogram] [--profile]\n",
+          prog);
+  exit(2);
+}
+
+// Put a FAT file system on a blank card, like a freshly formatted SD card.
+static bool formatCard() {
+  SdSpiCard card;
+  FatFormatter formatter;
+  uint8_t buf[512];
+  return card.begin(SdSpiConfig(SIM_SD_CS_PIN, SHARED_SPI, SD_SCK_MHZ(8))) &&
+         formatter.format(&card, buf);
+}
+
+int main(int argc, char **argv) {
+  double seconds = 60;
+  uint32_t tick = 1000;
+  bool quiet = false;
+  float target = NAN;
+  sim::PlantParams params;
+  float noise = 0.25f, open = 0;
+  uint32_t seed = 1;
+  const char *tracePath = nullptr;
+  sim::FlashTiming timing;
+  const char *image = nullptr;
+  bool histogram = false;
+  bool profile = false;
+  for (int i = 1; i < argc; i++) {
+    if (!strcmp(argv[i], "--seconds") && i + 1 < argc)
+      seconds = atof(argv[++i]);
+    else if (!strcmp(argv[i], "--tick") && i + 1 < argc)
+      tick = strtoul(argv[++i], nullptr, 0);
+    else if (!strcmp(argv[i], "--quiet"))
+      quiet = true;
+    else if (!strcmp(argv[i], "--target") && i + 1 < argc)
+      target = atof(argv[++i]);
+    else if (!strcmp(argv[i], "--ambient") && i + 1 < argc)
+      params.ambient = atof(argv[++i]);
+    else if (!strcmp(argv[i], "--power") && i + 1 < argc)
+      params.power = atof(argv[++i]);
+    else if (!strcmp(argv[i], "--dead-time") && i + 1 < argc)
+      params.deadTime = atof(argv[++i]);
+    else if (!strcmp(argv[i], "--lag") && i + 1 < argc)
+      params.sensorLag = atof(argv[++i]);
+    else if (!strcmp(argv[i], "--noise") && i + 1 < argc)
+      noise = atof(argv[++i]);
+    else if (!strcmp(argv[i], "--open") && i + 1 < argc)
+      open = atof(argv[++i]);
+    else if (!strcmp(argv[i], "--seed") && i + 1 < argc)
+      seed = strtoul(argv[++i], nullptr, 0);
+    else if (!strcmp(argv[i], "--trace") && i + 1 < argc)
+      tracePath = argv[++i];
+    else if (!strcmp(argv[i], "--image") && i + 1 < argc)
+      image = argv[++i];
+    else if (!strcmp(argv[i], "--program") && i + 1 < argc)
+      timing.programMicros = strtoul(argv[++i], nullptr, 0);
+    else if (!strcmp(argv[i], "--jitter") && i + 1 < argc)
+      timing.jitterMicros = strtoul(argv[++i], nullptr, 0);
+    else if (!strcmp(argv[i], "--rewrite") && i + 1 < argc)
+      timing.rewriteMicros = strtoul(argv[++i], nullptr, 0);
+    else if (!strcmp(argv[i], "--used"))
+      timing.used = true;
+    else if (!strcmp(argv[i], "--gc") && i + 1 < argc)
+      timing.gcInterval = strtoul(argv[++i], nullptr, 0);
+    else if (!strcmp(argv[i], "--gc-stall") && i + 1 < argc) {
+      // Milliseconds
+      char *p;
+      timing.gcMinMicros = strtoul(argv[++i], &p, 10) * 1000;
+      timing.gcMaxMicros =
+          *p == ':' ? strtoul(p + 1, nullptr, 10) * 1000 : timing.gcMinMicros;
+      if (timing.gcMaxMicros < timing.gcMinMicros)
+        usage(argv[0]);
+    } else if (!strcmp(argv[i], "--write-errors") && i + 1 < argc)
+      timing.writeErrorRate = atof(argv[++i]);
+    else if (!strcmp(argv[i], "--read-errors") && i + 1 < argc)
+      timing.readErrorRate = atof(argv[++i]);
+    else if (!strcmp(argv[i], "--histogram"))
+      histogram = true;
+    else if (!strcmp(argv[i], "--profile"))
+      profile = true;
+    else
+      usage(argv[0]);
+  }
+  FILE *trace = nullptr;
+  if (tracePath && !(trace = fopen(tracePath, "w"))) {
+    perror(tracePath);
+    return 1;
+  }
+
+  // A 1 GB card
+  std::unique_ptr<sim::FlashCard> flash(
+      image ? new sim::FlashCard(timing, seed, image, 2097152)
+            : new sim::FlashCard(timing, seed));
+  sim::FlashCard &card = *flash;
+  sim::ThermalPlant plant(params);
+  sim::PlantThermocouple thermocouple(plant, noise, open, seed);
+  sim::Ds1307 rtc;
+  sim::LcdBackpack lcd;
+  sim::attachSpi(SIM_SD_CS_PIN, &card);
+  sim::attachSpi(SIM_MAX6675_CS_PIN, &thermocouple);
+  sim::attachI2c(SIM_RTC_ADDRESS, &rtc);
+  sim::attachI2c(SIM_LCD_ADDRESS, &lcd);
+  sim::setPin(SIM_ENCODER_BUTTON_PIN, HIGH);
+  sim::setPin(SIM_SD_CS_PIN, HIGH);
+  sim::setPin(SIM_MAX6675_CS_PIN, HIGH);
+
+  // The errors are for the firmware, not the formatting
+  card.timing.writeErrorRate = card.timing.readErrorRate = 0;
+  if (card.blank() && !formatCard()) {
+    fprintf(stderr, "formatting the simulated SD card failed\n");
+    return 1;
+  }
+  card.timing = timing;
+  sim::serialEcho(!quiet);
+
+  // The oven as the heater pin drives it: switches, and the time it was on
+  uint32_t cycles = 0;
+  uint64_t onSince = 0, onMicros = 0;
+  bool heaterPin = false;
+  sim::onPinWrite([&](uint8_t pin, uint8_t level) {
+    if (pin != SIM_HEATER_PIN || bool(level) == heaterPin)
+      return;
+    heaterPin = level;
+    plant.setHeater(heaterPin);
+    if (heaterPin) {
+      cycles++;
+      onSince = sim::now();
+    } else {
+      onMicros += sim::now() - onSince;
+    }
+  });
+
+  auto wallStart = std::chrono::steady_clock::now();
+  uint64_t simStart = sim::now();
+  uint64_t end = simStart + (uint64_t)(seconds * 1e6);
+  uint64_t loops = 0;
+  setup();
+  uint64_t enabled = sim::now();
+  if (!isnan(target)) {
+    heaterControl.setTargetTemperature(target);
+    heaterControl.enable();
+  }
+  if (trace)
+    fprintf(trace, "seconds,heater,heating,oven,sensor\n");
+  // The oven from when it first reached the target
+  bool reached = false;
+  float maxOven = -INFINITY, minOven = INFINITY;
+  uint64_t nextSample = enabled;
+  // The time of loop(), and of the calls that read, wrote or polled the card
+  sim::Histogram loopTime, cardLoopTime;
+  while (sim::now() < end) {
+    uint64_t cardIo = card.sectorsRead + card.sectorsWritten + card.busyPolls;
+    uint64_t start = sim::now();
+    loop();
+    loopTime.add(sim::now() - start);
+    if (card.sectorsRead + card.sectorsWritten + card.busyPolls != cardIo)
+      cardLoopTime.add(sim::now() - start);
+    sim::advance(tick);
+    loops++;
+    if (sim::now() >= nextSample) {
+      plant.advanceTo(sim::now());
+      float oven = plant.oven();
+      reached |= oven >= target;
+      if (reached) {
+        maxOven = std::max(maxOven, oven);
+        minOven = std::min(minOven, oven);
+      }
+      if (trace)
+        fprintf(trace, "%.3f,%d,%d,%.3f,%.3f\n",
+                (sim::now() - enabled) / 1e6, heaterPin, plant.heating(),
+                oven, plant.sensor());
+      nextSample += 1000000;
+    }
+  }
+  if (profile) {
+    sim::serialEcho(true);
+    sim::serialInput("p");
+    loop();
+  }
+  if (heaterPin)
+    onMicros += sim::now() - onSince;
+  if (trace)
+    fclose(trace);
+  double wall = std::chrono::duration<double>(
+                    std::chrono::steady_clock::now() - wallStart)
+                    .count();
+  double simulated = (sim::now() - simStart) / 1e6;
+
+  const sim::Stats &s = sim::stats();
+  fprintf(stderr,
+          "\nsimulated %.1f s in %.3f s wall (%.0fx), %llu loops\n"
+          "SPI: %llu bytes, %.3f s, %u conflicts\n"
+          "I2C: %llu bytes, %.3f s\n"
+          "Serial: %llu bytes, %.3f s stalled\n"
+          "SD: %u sectors read, %u written, %u busy polls, %u GC stalls "
+          "(%.3f s), %u read errors, %u write errors\n",
+          simulated, wall, wall > 0 ? simulated / wall : 0,
+          (unsigned long long)loops, (unsigned long long)s.spiBytes,
+          s.spiMicros / 1e6, s.spiConflicts, (unsigned long long)s.i2cBytes,
+          s.i2cMicros / 1e6, (unsigned long long)s.serialBytes,
+          s.serialStallMicros / 1e6, card.sectorsRead, card.sectorsWritten,
+          card.busyPolls, card.gcStalls, card.gcMicros / 1e6, card.readErrors,
+          card.writeErrors);
+  loopTime.summary(stderr, "loop()");
+  if (histogram)
+    loopTime.print(stderr);
+  cardLoopTime.summary(stderr, "loop() with card I/O");
+  if (histogram)
+    cardLoopTime.print(stderr);
+  fprintf(stderr, "Oven: %.2f, sensor %.2f, %u conversions, %u open\n",
+          plant.oven(), plant.sensor(), thermocouple.conversions,
+          thermocouple.openFrames);
+  if (!isnan(target)) {
+    double heated = (sim::now() - enabled) / 1e6;
+    fprintf(stderr,
+            "Control: target %.2f, %u cycles, duty %.3f, overshoot %.2f, "
+            "undershoot %.2f\n",
+            target, cycles, heated > 0 ? onMicros / 1e6 / heated : 0.0,
+            reached ? maxOven - target : NAN,
+            reached ? target - minOven : NAN);
+  }
+  return 0;
+}
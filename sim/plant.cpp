@@ -0,0 +1,65 @@
+#include "plant.h"
+
+#include <algorithm>
+
+namespace sim {
+
+ThermalPlant::ThermalPlant(const PlantParams &params)
+    : p(params), ovenTemp(params.ambient), sensorTemp(params.ambient) {}
+
+void ThermalPlant::step(float seconds) {
+  float in = heatOn ? p.power : 0;
+  ovenTemp += (in - p.loss * (ovenTemp - p.ambient)) / p.heatCapacity * seconds;
+  float k = p.sensorLag > 0 ? seconds / p.sensorLag : 1;
+  sensorTemp += (ovenTemp - sensorTemp) * (k < 1 ? k : 1);
+}
+
+void ThermalPlant::advanceTo(uint64_t t) {
+  uint64_t delay = (uint64_t)(p.deadTime * 1e6f);
+  for (;;) {
+    // The switches that reached the oven
+    while (!pending.empty() && pending.front().first + delay <= time) {
+      heatOn = pending.front().second;
+      pending.pop_front();
+    }
+    if (time >= t)
+      break;
+    // Up to the next step, or the next switch to reach the oven
+    uint64_t next = std::min<uint64_t>(time + STEP_MICROS, t);
+    if (!pending.empty())
+      next = std::min(next, pending.front().first + delay);
+    step((next - time) / 1e6f);
+    time = next;
+  }
+}
+
+void ThermalPlant::setHeater(bool on) {
+  uint64_t t = now();
+  advanceTo(t);
+  if (on == pinOn)
+    return;
+  pinOn = on;
+  pending.emplace_back(t, on);
+  // Without dead time the switch takes effect at once
+  advanceTo(t);
+}
+
+PlantThermocouple::PlantThermocouple(ThermalPlant &plant, float noise,
+                                     float open, uint32_t seed)
+    : Max6675(plant.sensor()), plant(plant), noise(noise), open(open),
+      rng(seed) {}
+
+uint16_t PlantThermocouple::frame() {
+  plant.advanceTo(now());
+  conversions++;
+  temperature = plant.sensor() + (noise > 0 ? noise * normal(rng) : 0);
+  uint16_t f = Max6675::frame();
+  if (open > 0 && uniform(rng) < open) {
+    // D2 set, the temperature bits are not valid
+    openFrames++;
+    f |= 0x04;
+  }
+  return f;
+}
+
+} // namespace sim
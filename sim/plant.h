@@ -0,0 +1,87 @@
+// Thermal model of the oven, to try changes to HeaterControl without heating
+// a real one.
+//
+// The oven is a first order system with dead time: a single heat capacity,
+// heated by the element while the heater pin is HIGH and losing heat to the
+// ambient in proportion to the difference. The heat of the element reaches
+// the oven deadTime seconds after the pin switched. The thermocouple lags the
+// oven by a first order time constant of its own. PlantThermocouple returns
+// the sensor temperature to the firmware as MAX6675 frames, with noise, the
+// 0.25 degree steps of the converter, and the open input bit now and then.
+#ifndef SIM_PLANT_H
+#define SIM_PLANT_H
+
+#include <stdint.h>
+
+#include <deque>
+#include <random>
+
+#include "devices.h"
+
+namespace sim {
+
+struct PlantParams {
+  float ambient = 20;        // degrees
+  float power = 800;         // W of the element
+  float heatCapacity = 8000; // J/K of the oven
+  float loss = 4;            // W/K to the ambient
+  float deadTime = 20;       // s from the pin to heat in the oven
+  float sensorLag = 10;      // s, time constant of the thermocouple
+};
+
+class ThermalPlant {
+public:
+  // Integration step
+  static const uint32_t STEP_MICROS = 100000;
+
+  explicit ThermalPlant(const PlantParams &params = PlantParams());
+
+  // Advance the model to the virtual time t, in microseconds
+  void advanceTo(uint64_t t);
+  // The heater pin changed at the current virtual time
+  void setHeater(bool on);
+
+  const PlantParams &params() const { return p; }
+  float oven() const { return ovenTemp; }
+  float sensor() const { return sensorTemp; }
+  // Whether the element heats the oven now, after the dead time
+  bool heating() const { return heatOn; }
+
+private:
+  PlantParams p;
+  uint64_t time = 0; // of the model, microseconds
+  float ovenTemp;
+  float sensorTemp;
+  bool heatOn = false;
+  bool pinOn = false;
+  // Switches of the pin still on their way to the oven: time and level
+  std::deque<std::pair<uint64_t, bool>> pending;
+
+  void step(float seconds);
+};
+
+// MAX6675 on the thermocouple of a ThermalPlant
+class PlantThermocouple : public Max6675 {
+public:
+  // noise: standard deviation in degrees. open: share of the conversions
+  // that report an open thermocouple.
+  PlantThermocouple(ThermalPlant &plant, float noise = 0.25f, float open = 0,
+                    uint32_t seed = 1);
+  uint32_t conversions = 0;
+  uint32_t openFrames = 0;
+
+protected:
+  uint16_t frame() override;
+
+private:
+  ThermalPlant &plant;
+  float noise;
+  float open;
+  std::mt19937 rng;
+  std::normal_distribution<float> normal;
+  std::uniform_real_distribution<float> uniform;
+};
+
+} // namespace sim
+
+#endif
@@ -0,0 +1,347 @@
+#include "sdcard.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+
+namespace sim {
+
+SdCard::SdCard(uint32_t sectorCount)
+    : sectors((sectorCount + 1023) & ~1023UL),
+      // calloc()ed memory is mapped lazily, so untouched sectors are free
+      data(static_cast<uint8_t *>(calloc(sectors, 512))), created(true) {
+  if (!data) {
+    fprintf(stderr, "sim: cannot allocate a %u sector SD card\n", sectors);
+    exit(1);
+  }
+}
+
+SdCard::SdCard(const char *image, uint32_t sectorCount) {
+  fd = open(image, O_RDWR | O_CREAT, 0644);
+  struct stat st;
+  if (fd < 0 || fstat(fd, &st) != 0) {
+    fprintf(stderr, "sim: cannot open %s: %s\n", image, strerror(errno));
+    exit(1);
+  }
+  created = st.st_size == 0;
+  sectors = created ? (sectorCount + 1023) & ~1023UL
+                    : uint32_t(st.st_size / 512) & ~1023UL;
+  size_t length = (size_t)sectors * 512;
+  if (created && ftruncate(fd, length) != 0) {
+    fprintf(stderr, "sim: cannot size %s: %s\n", image, strerror(errno));
+    exit(1);
+  }
+  void *p = mmap(nullptr, length, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  if (p == MAP_FAILED) {
+    fprintf(stderr, "sim: cannot map %s: %s\n", image, strerror(errno));
+    exit(1);
+  }
+  data = std::unique_ptr<uint8_t, Free>(static_cast<uint8_t *>(p),
+                                        Free(length));
+}
+
+SdCard::~SdCard() {
+  data.reset();
+  if (fd >= 0)
+    close(fd);
+}
+
+void SdCard::Free::operator()(uint8_t *p) const {
+  if (mapped)
+    munmap(p, mapped);
+  else
+    free(p);
+}
+
+void SdCard::eraseSectors(uint32_t first, uint32_t last) {
+  uint8_t *bgn = sector(first);
+  uint8_t *end = sector(last + 1);
+  // Of an image, punch a hole in the file, which reads as zero
+  if (fd >= 0) {
+    if (fallocate(fd, FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE,
+                  (off_t)first * 512, end - bgn) != 0)
+      memset(bgn, 0, end - bgn);
+    return;
+  }
+  // Give whole pages back to the OS, they read as zero again
+  uintptr_t page = sysconf(_SC_PAGESIZE);
+  uint8_t *bgnPage = (uint8_t *)(((uintptr_t)bgn + page - 1) & ~(page - 1));
+  uint8_t *endPage = (uint8_t *)((uintptr_t)end & ~(page - 1));
+  if (bgnPage < endPage &&
+      madvise(bgnPage, endPage - bgnPage, MADV_DONTNEED) == 0) {
+    memset(bgn, 0, bgnPage - bgn);
+    memset(endPage, 0, end - endPage);
+  } else {
+    memset(bgn, 0, end - bgn);
+  }
+}
+
+void SdCard::select(bool selected) {
+  if (!selected)
+    cmdLength = 0;
+}
+
+void SdCard::respond(uint8_t status) {
+  out.clear();
+  out.push_back(0xFF); // NCR fill byte
+  out.push_back(status);
+}
+
+void SdCard::queueData(const uint8_t *src, size_t n) {
+  out.push_back(0xFE);
+  out.insert(out.end(), src, src + n);
+  out.push_back(0); // CRC, not checked by SdFat
+  out.push_back(0);
+}
+
+bool SdCard::commit(uint32_t n, const uint8_t *src) {
+  if (n >= sectors)
+    return false;
+  memcpy(sector(n), src, 512);
+  return true;
+}
+
+void SdCard::command() {
+  uint8_t index = cmd[0] & 0x3F;
+  uint32_t arg = (uint32_t)cmd[1] << 24 | (uint32_t)cmd[2] << 16 |
+                 (uint32_t)cmd[3] << 8 | cmd[4];
+  bool acmd = appCmd;
+  appCmd = false;
+  if (acmd) {
+    switch (index) {
+    case 41: // SD_SEND_OP_COND
+      idle = false;
+      respond(0x00);
+      return;
+    case 13: { // SD_STATUS, R2 then 64 bytes
+      uint8_t sds[64] = {0};
+      respond(0x00);
+      out.push_back(0x00);
+      queueData(sds, sizeof(sds));
+      return;
+    }
+    case 23: // SET_WR_BLK_ERASE_COUNT
+      respond(0x00);
+      return;
+    }
+  }
+  switch (index) {
+  case 0: // GO_IDLE_STATE
+    idle = true;
+    state = IDLE;
+    respond(0x01);
+    break;
+  case 8: // SEND_IF_COND
+    respond(r1());
+    out.push_back(0x00);
+    out.push_back(0x00);
+    out.push_back(0x01);
+    out.push_back(arg & 0xFF);
+    break;
+  case 55: // APP_CMD
+    appCmd = true;
+    respond(r1());
+    break;
+  case 58: // READ_OCR, power up and CCS (SDHC) bits set
+    respond(r1());
+    out.push_back(0xC0);
+    out.push_back(0xFF);
+    out.push_back(0x80);
+    out.push_back(0x00);
+    break;
+  case 59: // CRC_ON_OFF
+  case 16: // SET_BLOCKLEN
+    respond(r1());
+    break;
+  case 9: { // SEND_CSD, version 2.0
+    uint8_t csd[16] = {0x40, 0x0E, 0x00, 0x32, 0x5B, 0x59, 0x00, 0x00,
+                       0x00, 0x00, 0x7F, 0x80, 0x0A, 0x40, 0x00, 0x01};
+    uint32_t cSize = sectors / 1024 - 1;
+    csd[7] = (cSize >> 16) & 0x3F;
+    csd[8] = cSize >> 8;
+    csd[9] = cSize;
+    respond(0x00);
+    queueData(csd, sizeof(csd));
+    break;
+  }
+  case 10: { // SEND_CID
+    uint8_t cid[16] = {0x03, 'S', 'D', 'S', 'I', 'M', 'S', 0x10,
+                       0x00, 0x00, 0x00, 0x01, 0x01, 0x91, 0x00, 0x01};
+    respond(0x00);
+    queueData(cid, sizeof(cid));
+    break;
+  }
+  case 13: // SEND_STATUS, R2
+    respond(0x00);
+    out.push_back(0x00);
+    break;
+  case 12: // STOP_TRANSMISSION
+    state = IDLE;
+    respond(0x00);
+    break;
+  case 17: // READ_SINGLE_BLOCK
+  case 18: // READ_MULTIPLE_BLOCK
+    if (arg >= sectors) {
+      respond(0x40); // parameter error
+      break;
+    }
+    address = arg;
+    state = index == 17 ? READ_SINGLE : READ_MULTI;
+    readReadyAt = now() + readAccessMicros;
+    respond(0x00);
+    break;
+  case 24: // WRITE_BLOCK
+  case 25: // WRITE_MULTIPLE_BLOCK
+    if (arg >= sectors) {
+      respond(0x40);
+      break;
+    }
+    address = arg;
+    state = index == 24 ? WRITE_SINGLE : WRITE_MULTI;
+    respond(0x00);
+    break;
+  case 32: // ERASE_WR_BLK_START
+    eraseStart = arg;
+    respond(0x00);
+    break;
+  case 33: // ERASE_WR_BLK_END
+    eraseEnd = arg;
+    respond(0x00);
+    break;
+  case 38: // ERASE
+    if (eraseStart <= eraseEnd && eraseEnd < sectors) {
+      eraseSectors(eraseStart, eraseEnd);
+      erased(eraseStart, eraseEnd);
+      busyUntil = now() + eraseMicros;
+      respond(0x00);
+    } else {
+      respond(0x40);
+    }
+    break;
+  default:
+    respond(r1() | 0x04); // illegal command
+    break;
+  }
+}
+
+uint8_t SdCard::transfer(uint8_t in) {
+  // Data block of a write
+  if (receiving) {
+    rx[rxLength++] = in;
+    if (rxLength == sizeof(rx)) {
+      receiving = false;
+      bool ok = commit(address, rx);
+      out.clear();
+      out.push_back(ok ? 0xE5 : 0xED); // accepted / write error
+      if (ok) {
+        sectorsWritten++;
+        busyUntil = now() + programTime(address);
+      } else {
+        writeErrors++;
+      }
+      address++;
+      if (state == WRITE_SINGLE || !ok)
+        state = IDLE;
+    }
+    return 0xFF;
+  }
+  // Command frame
+  if (cmdLength) {
+    cmd[cmdLength++] = in;
+    if (cmdLength == sizeof(cmd)) {
+      cmdLength = 0;
+      command();
+    }
+    return 0xFF;
+  }
+  if ((in & 0xC0) == 0x40) {
+    out.clear();
+    cmd[0] = in;
+    cmdLength = 1;
+    return 0xFF;
+  }
+  // Data tokens of a write
+  if (state == WRITE_SINGLE && in == 0xFE) {
+    receiving = true;
+    rxLength = 0;
+    return 0xFF;
+  }
+  if (state == WRITE_MULTI && (in == 0xFC || in == 0xFD)) {
+    if (in == 0xFC) {
+      receiving = true;
+      rxLength = 0;
+    } else {
+      state = IDLE;
+      busyUntil = now() + programMicros / 4;
+    }
+    return 0xFF;
+  }
+  if (!out.empty()) {
+    uint8_t rtn = out.front();
+    out.pop_front();
+    return rtn;
+  }
+  if (now() < busyUntil) {
+    busyPolls++;
+    return 0x00;
+  }
+  if (state == READ_SINGLE || state == READ_MULTI) {
+    if (now() < readReadyAt)
+      return 0xFF;
+    if (!readable(address)) {
+      // Data error token instead of the data
+      readErrors++;
+      state = IDLE;
+      return 0x01;
+    }
+    queueData(sector(address), 512);
+    sectorsRead++;
+    address++;
+    if (state == READ_SINGLE || address >= sectors)
+      state = IDLE;
+    else
+      readReadyAt = now() + readAccessMicros;
+    uint8_t rtn = out.front();
+    out.pop_front();
+    return rtn;
+  }
+  return 0xFF;
+}
+
+uint32_t FlashCard::programTime(uint32_t sector) {
+  uint32_t t = timing.programMicros + between(0, timing.jitterMicros);
+  if (written[sector])
+    t += timing.rewriteMicros;
+  written[sector] = true;
+  if (timing.gcInterval && !--untilGc) {
+    uint32_t stall = between(timing.gcMinMicros, timing.gcMaxMicros);
+    t += stall;
+    gcStalls++;
+    gcMicros += stall;
+    scheduleGc();
+  }
+  return t;
+}
+
+bool FlashCard::commit(uint32_t sector, const uint8_t *src) {
+  if (timing.writeErrorRate > 0 && uniform(rng) < timing.writeErrorRate)
+    return false;
+  return SdCard::commit(sector, src);
+}
+
+void FlashCard::erased(uint32_t first, uint32_t last) {
+  std::fill(written.begin() + first, written.begin() + last + 1, false);
+}
+
+bool FlashCard::readable(uint32_t) {
+  return !(timing.readErrorRate > 0 && uniform(rng) < timing.readErrorRate);
+}
+
+} // namespace sim
@@ -0,0 +1,166 @@
+// SD card in SPI mode, as seen by SdFat's SdSpiCard.
+//
+// Implements the subset of the SD protocol SdFat uses: initialization
+// (CMD0/8/55/ACMD41/58), CSD/CID, single and multiple sector reads and writes,
+// erase and card status. After a write the card holds MISO low for a
+// programming time, which SdFat sees as busy.
+//
+// FlashCard adds the latency and faults of a real card: write times that
+// vary, garbage collection stalls, and failed reads and writes.
+#ifndef SIM_SDCARD_H
+#define SIM_SDCARD_H
+
+#include <stdint.h>
+
+#include <deque>
+#include <memory>
+#include <random>
+#include <vector>
+
+#include "hal/hal.h"
+
+namespace sim {
+
+class SdCard : public SpiDevice {
+public:
+  // Card size in 512 byte sectors, rounded up to a multiple of 1024. The
+  // default is a 1 GB card; memory is only used for sectors that are written.
+  explicit SdCard(uint32_t sectorCount = 2097152);
+  // A card backed by an image file, of its size if it exists and is not
+  // empty. Writes go to the file.
+  SdCard(const char *image, uint32_t sectorCount);
+  ~SdCard();
+  // The image was created or empty, and needs a file system
+  bool blank() const { return created; }
+  void select(bool selected) override;
+  uint8_t transfer(uint8_t out) override;
+
+  uint32_t sectorCount() const { return sectors; }
+  uint8_t *sector(uint32_t n) { return data.get() + (size_t)n * 512; }
+
+  // Timing, in microseconds
+  uint32_t readAccessMicros = 100; // command to data token
+  uint32_t programMicros = 700;    // busy after a sector write
+  uint32_t eraseMicros = 2000;     // busy after an erase command
+
+  // Counters
+  uint32_t sectorsRead = 0;
+  uint32_t sectorsWritten = 0;
+  uint32_t busyPolls = 0;   // bytes SdFat read while the card was busy
+  uint32_t writeErrors = 0; // sectors rejected by commit()
+  uint32_t readErrors = 0;
+
+protected:
+  // Busy time after writing a sector. Override for other latency models.
+  virtual uint32_t programTime(uint32_t sector) {
+    (void)sector;
+    return programMicros;
+  }
+  // Called for every sector written; return false to reject the data.
+  virtual bool commit(uint32_t sector, const uint8_t *src);
+  // Called after an erase of the sectors first to last
+  virtual void erased(uint32_t first, uint32_t last) {
+    (void)first;
+    (void)last;
+  }
+  // Called for every sector read; return false for a read error.
+  virtual bool readable(uint32_t sector) {
+    (void)sector;
+    return true;
+  }
+
+private:
+  enum State { IDLE, READ_SINGLE, READ_MULTI, WRITE_SINGLE, WRITE_MULTI };
+
+  uint32_t sectors;
+  struct Free {
+    Free() : mapped(0) {}
+    explicit Free(size_t length) : mapped(length) {}
+    size_t mapped; // length of the mapping of an image, or calloc()ed
+    void operator()(uint8_t *p) const;
+  };
+  std::unique_ptr<uint8_t, Free> data;
+  int fd = -1; // of the image
+  bool created = false;
+  std::deque<uint8_t> out;
+  State state = IDLE;
+  bool idle = true; // not initialized yet
+  bool appCmd = false;
+  uint8_t cmd[6];
+  uint8_t cmdLength = 0;
+  uint8_t rx[514];
+  uint16_t rxLength = 0;
+  bool receiving = false;
+  uint32_t address = 0;
+  uint32_t eraseStart = 0;
+  uint32_t eraseEnd = 0;
+  uint64_t busyUntil = 0;
+  uint64_t readReadyAt = 0;
+
+  void command();
+  void eraseSectors(uint32_t first, uint32_t last);
+  void respond(uint8_t r1);
+  void queueData(const uint8_t *src, size_t n);
+  uint8_t r1() const { return idle ? 0x01 : 0x00; }
+};
+
+// Latency model of a card, in microseconds. A sector write keeps the card
+// busy for programMicros plus up to jitterMicros, and rewriteMicros more if
+// it was written since it was last erased. About every gcInterval
+// sectors written, give or take half of it, the card stalls for garbage
+// collection, moving data to free a block, for gcMinMicros to gcMaxMicros.
+struct FlashTiming {
+  uint32_t programMicros = 700;
+  uint32_t jitterMicros = 300;
+  uint32_t rewriteMicros = 1500;
+  uint32_t gcInterval = 256; // sectors, 0 for no stalls
+  uint32_t gcMinMicros = 50000;
+  uint32_t gcMaxMicros = 250000;
+  bool used = false;         // every sector written before, none erased
+  double writeErrorRate = 0; // share of sector writes that fail
+  double readErrorRate = 0;
+};
+
+class FlashCard : public SdCard {
+public:
+  explicit FlashCard(const FlashTiming &timing, uint32_t seed = 1,
+                     uint32_t sectorCount = 2097152)
+      : SdCard(sectorCount), timing(timing), rng(seed),
+        written(this->sectorCount(), timing.used) {
+    scheduleGc();
+  }
+  FlashCard(const FlashTiming &timing, uint32_t seed, const char *image,
+            uint32_t sectorCount)
+      : SdCard(image, sectorCount), timing(timing), rng(seed),
+        written(this->sectorCount(), timing.used) {
+    scheduleGc();
+  }
+
+  FlashTiming timing;
+  uint32_t gcStalls = 0;
+  uint64_t gcMicros = 0;
+
+protected:
+  uint32_t programTime(uint32_t sector) override;
+  bool commit(uint32_t sector, const uint8_t *src) override;
+  void erased(uint32_t first, uint32_t last) override;
+  bool readable(uint32_t sector) override;
+
+private:
+  std::mt19937 rng;
+  std::uniform_real_distribution<double> uniform;
+  uint32_t untilGc = 0; // sectors to the next stall
+  // Sectors written since they were erased
+  std::vector<bool> written;
+
+  uint32_t between(uint32_t lo, uint32_t hi) {
+    return lo + uint32_t(uniform(rng) * (hi - lo));
+  }
+  void scheduleGc() {
+    untilGc = between(timing.gcInterval / 2, timing.gcInterval * 3 / 2) + 1;
+  }
+};
+
+} // namespace sim
+
+#endif
@@ -0,0 +1,105 @@
+// The board for the tests of the firmware in test/: a freshly formatted SD
+// card in memory and the RTC, wired as in main.cpp, and the files on the
+// card read and written from the host side.
+#ifndef SIM_TEST_BOARD_H
+#define SIM_TEST_BOARD_H
+
+#include <SdFat.h>
+
+#include <string>
+#include <vector>
+
+#include "devices.h"
+#include "hal/hal.h"
+#include "sdcard.h"
+#include "test/tempFile.h"
+
+namespace test {
+
+const uint8_t SD_CS_PIN = 4;
+const uint8_t RTC_ADDRESS = 0x68;
+
+class Board {
+public:
+  Board() {
+    sim::serialEcho(false);
+    sim::attachSpi(SD_CS_PIN, &card);
+    sim::attachI2c(RTC_ADDRESS, &rtc);
+    sim::setPin(SD_CS_PIN, HIGH);
+    SdSpiCard spi;
+    FatFormatter formatter;
+    uint8_t buf[512];
+    formatted = spi.begin(SdSpiConfig(SD_CS_PIN, SHARED_SPI, SD_SCK_MHZ(8))) &&
+                formatter.format(&spi, buf);
+    // Records in the middle of a second, so the time the bus transfers take
+    // does not move them into the next one
+    sim::advance((1500000 - sim::now() % 1000000) % 1000000);
+  }
+
+  sim::SdCard card;
+  sim::Ds1307 rtc;
+  bool formatted;
+
+  // Let seconds pass on the RTC
+  void wait(uint32_t seconds) { sim::advance(uint64_t(seconds) * 1000000); }
+  // Set the RTC, in seconds since 2000
+  void setClock(uint32_t seconds) {
+    uint8_t y, mo, d, h, mi, s;
+    sim::fromSeconds2000(seconds, y, mo, d, h, mi, s);
+    // The register pointer, then seconds to year
+    uint8_t regs[8] = {0, bcd(s), bcd(mi), bcd(h), 1, bcd(d), bcd(mo), bcd(y)};
+    rtc.write(regs, sizeof(regs));
+  }
+  uint32_t clock() const { return rtc.seconds(); }
+
+  // Mount the card on the host side. This initializes the card again, which
+  // the firmware does not notice between two of its calls. The firmware's
+  // volume stays the current one, the files here are opened on this one.
+  bool mount() {
+    return sd.cardBegin(SdSpiConfig(SD_CS_PIN, SHARED_SPI, SD_SCK_MHZ(8))) &&
+           (sd.FatVolume::begin(sd.card(), false) ||
+            sd.FatVolume::begin(sd.card(), false, 0));
+  }
+  bool exists(const char *name) {
+    File32 f;
+    return mount() && f.open(&sd, name, O_RDONLY);
+  }
+  // Size of a file as its directory entry has it, -1 if it is not there
+  int64_t fileSize(const char *name) {
+    File32 f;
+    if (!mount() || !f.open(&sd, name, O_RDONLY))
+      return -1;
+    return f.fileSize();
+  }
+  // The file occupies one contiguous range of clusters
+  bool isContiguous(const char *name) {
+    File32 f;
+    uint32_t bgn, end;
+    return mount() && f.open(&sd, name, O_RDONLY) &&
+           f.contiguousRange(&bgn, &end);
+  }
+  bool readFile(const char *name, std::vector<uint8_t> &data) {
+    File32 f;
+    if (!mount() || !f.open(&sd, name, O_RDONLY))
+      return false;
+    data.resize(f.fileSize());
+    return f.read(data.data(), data.size()) == int(data.size());
+  }
+  // Create name with data at its start, preallocated to size bytes as the
+  // logger leaves a file it was writing to
+  bool createFile(const char *name, const std::vector<uint8_t> &data,
+                  uint32_t size) {
+    File32 f;
+    return mount() && f.open(&sd, name, O_RDWR | O_CREAT | O_TRUNC) &&
+           f.preAllocate(size) &&
+           f.write(data.data(), data.size()) == data.size() && f.close();
+  }
+
+private:
+  SdFat32 sd;
+  static uint8_t bcd(uint8_t v) { return uint8_t((v / 10) << 4 | v % 10); }
+};
+
+} // namespace test
+
+#endif
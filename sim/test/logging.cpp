@@ -0,0 +1,64 @@
+// Starting and stopping the logger, and the files it leaves on the card
+#include "ArduinoUnitTests.h"
+#include "board.h"
+#include "log.h"
+
+#include <string>
+
+const int64_t PREALLOCATED = int64_t(LOG_FILE_SIZE_MiB) * 1024 * 1024;
+
+static void logSeconds(Log &log, test::Board &board, int seconds) {
+  float t[1] = {20.0f};
+  for (int i = 0; i < seconds; i++) {
+    log.logData(t, Log::HEATER_ENABLED);
+    t[0] += 0.25f;
+    board.wait(1);
+  }
+}
+
+unittest(new_file_is_preallocated) {
+  test::Board board;
+  assertTrue(board.formatted);
+  Log log(1);
+  assertEqual(0, log.init(test::SD_CS_PIN));
+  std::string name = log.getLogFileName();
+  assertEqual(PREALLOCATED, board.fileSize(name.c_str()));
+  assertTrue(board.isContiguous(name.c_str()));
+  logSeconds(log, board, 100);
+  assertEqual(0, log.stopLogging());
+  // The unused part is given back
+  int64_t size = board.fileSize(name.c_str());
+  assertMore(size, 512);
+  assertLess(size, PREALLOCATED);
+  assertEqual(0, size % 512);
+}
+
+// A stopped file was truncated to its data. Logging again goes to a new
+// preallocated file, instead of growing the old one a cluster at a time.
+unittest(restart_goes_to_new_file) {
+  test::Board board;
+  Log log(1);
+  assertEqual(0, log.init(test::SD_CS_PIN));
+  std::string first = log.getLogFileName();
+  logSeconds(log, board, 100);
+  assertEqual(0, log.stopLogging());
+  int64_t stopped = board.fileSize(first.c_str());
+  std::vector<uint8_t> before;
+  assertTrue(board.readFile(first.c_str(), before));
+
+  assertEqual(0, log.startLogging());
+  std::string second = log.getLogFileName();
+  assertNotEqual(first, second);
+  assertEqual(PREALLOCATED, board.fileSize(second.c_str()));
+  assertTrue(board.isContiguous(second.c_str()));
+  logSeconds(log, board, 100);
+  assertEqual(0, log.stopLogging());
+
+  std::vector<uint8_t> after;
+  assertTrue(board.readFile(first.c_str(), after));
+  assertEqual(stopped, int64_t(after.size()));
+  assertTrue(before == after);
+  assertTrue(board.isContiguous(second.c_str()));
+}
+
+unittest_main()
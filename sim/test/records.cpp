@@ -0,0 +1,196 @@
+// The records Log::logData() writes, read back by Cursor of host/templog.h
+// and by readBinary.py, and written again by LogWriter, which has to give
+// the same blocks
+#include "ArduinoUnitTests.h"
+#include "board.h"
+#include "log.h"
+#include "templog.h"
+
+#include <string>
+
+// Seconds from 1970 to 2000, between the RTC and the host tools
+const int64_t EPOCH_2000 = 946684800;
+
+struct Record {
+  int64_t time;
+  uint8_t status;
+  int16_t q[2];
+};
+
+// As logData() stores a temperature
+static int16_t quarterDegrees(float t) {
+  t *= 4;
+  return (t > -32767 && t < 32767) ? int16_t(lroundf(t))
+                                   : Log::NO_TEMPERATURE;
+}
+
+// A recording of two sensors with what the decoders have to follow: runs of
+// the same interval and intervals that change, keyframes in and at the start
+// of blocks, a sensor without readings, steps of the heater bits, gaps of
+// days, the clock set back, and large temperature steps.
+static std::vector<Record> record(Log &log, test::Board &board) {
+  std::vector<Record> records;
+  float t[2] = {20.0f, 150.0f};
+  auto add = [&](uint8_t status) {
+    Record r = {board.clock() + EPOCH_2000, status,
+                {quarterDegrees(t[0]), quarterDegrees(t[1])}};
+    log.logData(t, status);
+    records.push_back(r);
+  };
+  for (int i = 0; i < 300; i++) {
+    add(i / 37 % 2 ? Log::HEATER_ENABLED | Log::HEATING
+                   : Log::HEATER_ENABLED);
+    t[0] += 0.25f;
+    t[1] -= i % 3 ? 0.0f : 0.5f;
+    board.wait(1);
+  }
+  for (int i = 0; i < 100; i++) {
+    add(Log::HEATER_ENABLED);
+    t[0] += i % 2 ? 3.75f : -2.0f;
+    board.wait(i % 5 + 1);
+  }
+  // The second thermocouple fails, and comes back
+  t[1] = NAN;
+  for (int i = 0; i < 50; i++) {
+    add(Log::HEATER_ENABLED | Log::SENSOR_ERROR);
+    board.wait(1);
+  }
+  t[1] = 80.0f;
+  add(Log::HEATER_ENABLED);
+  // Off for three days, and for more than a month
+  board.wait(3 * 86400);
+  add(0);
+  board.wait(40 * 86400 + 17);
+  add(0);
+  // The clock set back by two hours
+  board.setClock(board.clock() - 7200);
+  add(Log::HEATER_ENABLED);
+  // Steps of many varint bytes, and below zero
+  t[0] = 1000.0f;
+  board.wait(1);
+  add(Log::HEATER_ENABLED | Log::HEATING);
+  t[0] = -10.25f;
+  board.wait(1);
+  add(Log::HEATER_ENABLED);
+  for (int i = 0; i < 20; i++) {
+    board.wait(1);
+    add(Log::HEATER_ENABLED);
+  }
+  return records;
+}
+
+// The records as readBinary.py decodes them: the time, the heater enabled
+// bit and the temperatures in quarter degrees
+static bool readBinary(const std::string &path, std::vector<Record> &records) {
+  // The tests run in sim/
+  std::string cmd =
+      "python3 -c '"
+      "import sys\n"
+      "sys.path.insert(0, \"..\")\n"
+      "import readBinary\n"
+      "from datetime import datetime\n"
+      "ts, temps, heater = readBinary.read_log_file(sys.argv[1])\n"
+      "for t, v, h in zip(ts, temps, heater):\n"
+      "    print(\"R\", int((t - datetime(1970, 1, 1)).total_seconds()), "
+      "int(h), *(-32768 if x != x else round(x * 4) for x in v))\n"
+      "' " +
+      path;
+  FILE *p = popen(cmd.c_str(), "r");
+  if (!p)
+    return false;
+  records.clear();
+  char line[256];
+  while (fgets(line, sizeof(line), p)) {
+    long long time;
+    int heater, q0, q1;
+    if (sscanf(line, "R %lld %d %d %d", &time, &heater, &q0, &q1) == 4)
+      records.push_back({time, uint8_t(heater ? Log::HEATER_ENABLED : 0),
+                         {int16_t(q0), int16_t(q1)}});
+  }
+  return pclose(p) == 0;
+}
+
+unittest(decoders_agree_with_logData) {
+  test::Board board;
+  board.setClock(25 * 365 * 86400 + 12345);
+  Log log(2);
+  assertEqual(0, log.init(test::SD_CS_PIN));
+  std::string name = log.getLogFileName();
+  std::vector<Record> expected = record(log, board);
+  assertEqual(0, log.stopLogging());
+
+  std::vector<uint8_t> logged;
+  assertTrue(board.readFile(name.c_str(), logged));
+  test::TempFile file;
+  assertTrue(file.write(logged));
+
+  // Cursor
+  templog::LogFile f;
+  assertTrue(f.open(file.path()));
+  assertEqual(3, f.header().version);
+  assertMore(f.blockCount(), size_t(4));
+  size_t n = 0;
+  int sameInterval = 0, keyframes = 0;
+  templog::Cursor c = f.records();
+  while (c.next()) {
+    if (n >= expected.size())
+      break;
+    const Record &r = expected[n++];
+    assertEqual(r.time, c.time());
+    assertEqual(r.status, c.status() & (templog::HEATER_ENABLED |
+                                        templog::HEATING |
+                                        templog::SENSOR_ERROR));
+    assertEqual(r.q[0], c.quarterDegrees(0));
+    assertEqual(r.q[1], c.quarterDegrees(1));
+    sameInterval += (c.status() & templog::SAME_INTERVAL) != 0;
+    keyframes += (c.status() & templog::KEYFRAME) != 0;
+  }
+  assertEqual(expected.size(), n);
+  assertEqual(0u, c.invalidBlocks());
+  assertEqual(0u, c.corruptBlocks());
+  assertMore(sameInterval, 300);
+  // Keyframes in the blocks as well, not only at their start
+  assertMore(keyframes, int(f.blockCount()));
+  // Every block can be decoded on its own
+  for (size_t i = 1; i < f.blockCount(); i++) {
+    templog::Block b = f.block(i);
+    assertEqual(templog::Block::VALID, b.state);
+    assertTrue(b.used && (b.records[0] & templog::KEYFRAME));
+  }
+
+  // readBinary.py
+  std::vector<Record> decoded;
+  assertTrue(readBinary(file.path(), decoded));
+  assertEqual(expected.size(), decoded.size());
+  for (size_t i = 0; i < expected.size() && i < decoded.size(); i++) {
+    assertEqual(expected[i].time, decoded[i].time);
+    assertEqual(expected[i].status & Log::HEATER_ENABLED, decoded[i].status);
+    assertEqual(expected[i].q[0], decoded[i].q[0]);
+    assertEqual(expected[i].q[1], decoded[i].q[1]);
+  }
+
+  // LogWriter, the same file id in the header and the same blocks
+  test::TempFile written;
+  templog::LogWriter w;
+  assertTrue(w.open(written.path(), 2, f.header().start));
+  for (const Record &r : expected) {
+    double t[2];
+    for (int i = 0; i < 2; i++)
+      t[i] = r.q[i] == Log::NO_TEMPERATURE ? NAN : r.q[i] / 4.0;
+    assertTrue(w.add(r.time, r.status, t));
+  }
+  assertTrue(w.close());
+  std::vector<uint8_t> rewritten;
+  assertTrue(written.read(rewritten));
+  assertEqual(logged.size(), rewritten.size());
+  assertTrue(std::equal(logged.begin(), logged.begin() + 13,
+                        rewritten.begin()));
+  for (size_t i = 1; i < f.blockCount() && i * 512 < rewritten.size(); i++) {
+    // The padding after the records is not part of the block
+    size_t end = i * 512 + 8 + f.block(i).used;
+    assertTrue(std::equal(logged.begin() + i * 512, logged.begin() + end,
+                          rewritten.begin() + i * 512));
+  }
+}
+
+unittest_main()
@@ -0,0 +1,161 @@
+// Recovery of a log file that was never closed: Log::findLogEnd() has to
+// stop after the last valid block, whatever follows it in the preallocated
+// file. readBinary.py --recover has to agree, and Cursor has to decode the
+// records of the valid blocks and nothing else.
+#include "ArduinoUnitTests.h"
+#include "board.h"
+#include "log.h"
+#include "templog.h"
+
+#include <string>
+
+const uint32_t FILE_SIZE = 1024UL * 1024;
+const uint32_t BLOCK = 512;
+// Not the name the logger takes for its own file
+const char *NAME = "TempLog_241231_120000_00.bin";
+const int64_t START = 1735646400; // 2024-12-31 12:00:00
+
+// A log of one sensor written by LogWriter, and what it holds
+struct Written {
+  std::vector<uint8_t> data;
+  std::vector<int64_t> times;
+  std::vector<int16_t> temps; // quarter degrees
+  std::vector<size_t> blocks; // the block of each record
+};
+
+static Written writeLog(int64_t start, int records) {
+  Written w;
+  test::TempFile file;
+  templog::LogWriter writer;
+  if (!writer.open(file.path(), 1, templog::fromEpoch(start)))
+    return w;
+  for (int i = 0; i < records; i++) {
+    double t = 20 + (i * 7 % 50) * 0.25;
+    writer.add(start + i, templog::HEATER_ENABLED, &t);
+    w.times.push_back(start + i);
+    w.temps.push_back(int16_t(t * 4));
+    // The record is in the block being filled
+    w.blocks.push_back(writer.size() / BLOCK - 1);
+  }
+  writer.close();
+  file.read(w.data);
+  return w;
+}
+
+static std::vector<uint8_t> block(const Written &w, size_t index) {
+  return std::vector<uint8_t>(w.data.begin() + index * BLOCK,
+                              w.data.begin() + (index + 1) * BLOCK);
+}
+
+// The header and the first blocks of w, as far as they were written, then
+// tail, and erased sectors to the size of the preallocation
+static std::vector<uint8_t> image(const Written &w, size_t blocks,
+                                  const std::vector<uint8_t> &tail,
+                                  uint8_t erased) {
+  std::vector<uint8_t> data(w.data.begin(),
+                            w.data.begin() + (blocks + 1) * BLOCK);
+  data.insert(data.end(), tail.begin(), tail.end());
+  data.resize(FILE_SIZE, erased);
+  return data;
+}
+
+static bool recoverWithReadBinary(const std::string &path) {
+  // The tests run in sim/
+  std::string cmd = "python3 -c '"
+                    "import sys\n"
+                    "sys.path.insert(0, \"..\")\n"
+                    "import readBinary\n"
+                    "sys.exit(not readBinary.recover_log_file(sys.argv[1]))\n"
+                    "' " +
+                    path + " >/dev/null";
+  return system(cmd.c_str()) == 0;
+}
+
+// Put data on the card as a file the logger never closed, and check that
+// recovery keeps exactly the first valid blocks of w
+static void checkRecovery(const std::vector<uint8_t> &data, const Written &w,
+                          size_t valid) {
+  uint32_t length = (valid + 1) * BLOCK;
+
+  test::TempFile copy;
+  assertTrue(copy.write(data));
+  assertTrue(recoverWithReadBinary(copy.path()));
+  std::vector<uint8_t> recovered;
+  assertTrue(copy.read(recovered));
+  assertEqual(length, recovered.size());
+
+  test::Board board;
+  assertTrue(board.createFile(NAME, data, FILE_SIZE));
+  assertEqual(int64_t(FILE_SIZE), board.fileSize(NAME));
+  Log log(1);
+  assertEqual(0, log.init(test::SD_CS_PIN));
+  assertEqual(int64_t(length), board.fileSize(NAME));
+
+  std::vector<uint8_t> left;
+  assertTrue(board.readFile(NAME, left));
+  assertTrue(recovered == left);
+  test::TempFile file;
+  assertTrue(file.write(left));
+  templog::LogFile f;
+  assertTrue(f.open(file.path()));
+  templog::Cursor c = f.records();
+  size_t n = 0;
+  while (c.next() && n < w.times.size()) {
+    assertEqual(w.times[n], c.time());
+    assertEqual(w.temps[n], c.quarterDegrees(0));
+    assertMoreOrEqual(valid, w.blocks[n]);
+    n++;
+  }
+  assertEqual(0u, c.invalidBlocks());
+  assertEqual(0u, c.corruptBlocks());
+  // All the records of the valid blocks
+  assertTrue(n == w.times.size() || w.blocks[n] > valid);
+}
+
+unittest(erased_after_the_last_block) {
+  Written w = writeLog(START, 2000);
+  assertMore(w.data.size() / BLOCK, size_t(8));
+  checkRecovery(image(w, 6, {}, 0xFF), w, 6);
+  checkRecovery(image(w, 6, {}, 0x00), w, 6);
+}
+
+// The last block was synced before it was full
+unittest(last_block_partly_filled) {
+  Written w = writeLog(START, 1000);
+  size_t blocks = w.data.size() / BLOCK - 1;
+  assertTrue(w.blocks.back() == blocks);
+  checkRecovery(image(w, blocks, {}, 0xFF), w, blocks);
+}
+
+// Power failed while a block was written
+unittest(partly_written_block) {
+  Written w = writeLog(START, 2000);
+  std::vector<uint8_t> torn = block(w, 5);
+  std::fill(torn.begin() + 256, torn.end(), 0xFF);
+  checkRecovery(image(w, 4, torn, 0xFF), w, 4);
+}
+
+// A file was on the same clusters before: its blocks have the sequence
+// numbers of their place, but another file id
+unittest(stale_blocks_of_an_earlier_file) {
+  Written earlier = writeLog(START - 86400, 4000);
+  Written w = writeLog(START, 2000);
+  std::vector<uint8_t> data = earlier.data;
+  data.resize(FILE_SIZE, 0x00);
+  std::copy(w.data.begin(), w.data.begin() + 5 * BLOCK, data.begin());
+  checkRecovery(data, w, 4);
+}
+
+// A valid block of this file where a later one belongs, with a lower
+// sequence number than its place
+unittest(stale_block_with_lower_seq) {
+  Written w = writeLog(START, 2000);
+  checkRecovery(image(w, 4, block(w, 3), 0x00), w, 4);
+}
+
+unittest(no_valid_blocks) {
+  Written w = writeLog(START, 100);
+  checkRecovery(image(w, 0, {}, 0x00), w, 0);
+}
+
+unittest_main()
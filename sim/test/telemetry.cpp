@@ -0,0 +1,151 @@
+// The frames Telemetry::send() writes, with text printed between them, read
+// by TelemetryReceiver of host/telemetry.h
+#include "ArduinoUnitTests.h"
+#include "board.h"
+#include "heaterControl.h"
+#include "log.h"
+#include "telemetry.h"
+
+// The receiver, not the firmware's telemetry.h
+#include "host/telemetry.h"
+
+// The serial port
+class Sink : public Print {
+public:
+  std::vector<uint8_t> bytes;
+  using Print::write;
+  size_t write(uint8_t c) override {
+    bytes.push_back(c);
+    return 1;
+  }
+};
+
+const uint8_t HEATER_PIN = 5;
+#ifdef DEBUG
+const uint8_t STATS = Telemetry::STATS;
+const size_t STATS_SIZE = 9;
+#else
+const uint8_t STATS = 0;
+const size_t STATS_SIZE = 0;
+#endif
+
+struct Sent {
+  uint8_t flags;
+  uint32_t timestamp;
+  uint32_t fileId;
+  uint16_t untilDisable;
+  int16_t q[2];
+  size_t begin, end; // its bytes on the wire
+};
+
+static int16_t quarterDegrees(float t) {
+  return std::isnan(t) ? Log::NO_TEMPERATURE : int16_t(lroundf(t * 4));
+}
+
+// 600 frames, the sequence number wrapping around twice, text printed
+// before some, and logging stopped after 300
+static std::vector<Sent> send(test::Board &board, Sink &serial,
+                              int &lines) {
+  std::vector<Sent> sent;
+  Log log(2);
+  HeaterControl heater(HEATER_PIN);
+  heater.init();
+  heater.setTargetTemperature(151.25f);
+  heater.enable();
+  Telemetry telemetry;
+  lines = 0;
+  if (log.init(test::SD_CS_PIN) != 0)
+    return sent;
+  for (int i = 0; i < 600; i++) {
+    if (i == 300)
+      log.stopLogging();
+    if (i % 45 == 0) {
+      serial.print("message ");
+      serial.println(i);
+      lines++;
+    }
+    float t[2] = {20 + i * 0.25f, i % 50 == 7 ? NAN : -40.5f + i};
+    uint8_t status = Log::HEATER_ENABLED | (i % 3 ? Log::HEATING : 0) |
+                     (std::isnan(t[1]) ? Log::SENSOR_ERROR : 0);
+    Sent s = {uint8_t(status | (i < 300 ? Telemetry::LOGGING : 0) | STATS),
+              log.getTimestamp(),
+              i < 300 ? log.getFileId() : 0,
+              uint16_t(heater.getTimeUntilDisable() / 60000),
+              {quarterDegrees(t[0]), quarterDegrees(t[1])},
+              serial.bytes.size(),
+              0};
+    telemetry.send(serial, heater, log, t, 2, status);
+    s.end = serial.bytes.size();
+    sent.push_back(s);
+    board.wait(1);
+  }
+  return sent;
+}
+
+unittest(receiver_decodes_the_frames) {
+  test::Board board;
+  board.setClock(25 * 365 * 86400 + 12345);
+  Sink serial;
+  int lines;
+  std::vector<Sent> sent = send(board, serial, lines);
+  assertEqual(size_t(600), sent.size());
+  // Two sensors, the crc, the COBS code byte and the delimiters
+  assertEqual(16 + 4 + STATS_SIZE + 2 + 1 + 2, sent[0].end - sent[0].begin);
+
+  std::vector<templog::TelemetryFrame> frames;
+  std::vector<std::string> text;
+  templog::TelemetryReceiver rx;
+  rx.feed(
+      serial.bytes.data(), serial.bytes.size(),
+      [&](const templog::TelemetryFrame &f) { frames.push_back(f); },
+      [&](const std::string &s) { text.push_back(s); });
+  assertEqual(uint64_t(600), rx.frames());
+  assertEqual(uint64_t(0), rx.lost());
+  assertEqual(uint64_t(0), rx.damaged());
+  assertEqual(size_t(lines), text.size());
+  assertEqual(std::string("message 45"), text.size() > 1 ? text[1] : "");
+  for (size_t i = 0; i < frames.size() && i < sent.size(); i++) {
+    const templog::TelemetryFrame &f = frames[i];
+    assertEqual(uint8_t(i), f.seq);
+    assertEqual(sent[i].flags, f.flags);
+    assertEqual(sent[i].timestamp, f.timestamp());
+    assertEqual(sent[i].fileId, f.fileId);
+    assertEqual(605, f.target);
+    assertEqual(sent[i].untilDisable, f.untilDisable);
+    assertEqual(2, f.numSensors());
+    assertEqual(sent[i].q[0], f.quarterDegrees(0));
+    assertEqual(sent[i].q[1], f.quarterDegrees(1));
+    assertEqual(STATS != 0, f.hasStats());
+  }
+  assertNotEqual(0u, sent[0].fileId);
+  assertLess(sent[599].untilDisable, sent[0].untilDisable);
+}
+
+// Frames missing where the sequence number wraps around, and one damaged
+unittest(lost_and_damaged_frames) {
+  test::Board board;
+  Sink serial;
+  int lines;
+  std::vector<Sent> sent = send(board, serial, lines);
+  assertEqual(size_t(600), sent.size());
+  std::vector<uint8_t> wire(serial.bytes.begin(),
+                            serial.bytes.begin() + sent[250].begin);
+  wire.insert(wire.end(), serial.bytes.begin() + sent[260].begin,
+              serial.bytes.end());
+  // A bit of frame 400 flipped
+  size_t flipped = sent[400].begin - (sent[260].begin - sent[250].begin) + 9;
+  wire[flipped] ^= 0x04;
+
+  templog::TelemetryReceiver rx;
+  uint64_t frames = 0;
+  rx.feed(
+      wire.data(), wire.size(),
+      [&](const templog::TelemetryFrame &) { frames++; },
+      [&](const std::string &) {});
+  assertEqual(uint64_t(589), frames);
+  assertEqual(uint64_t(589), rx.frames());
+  assertEqual(uint64_t(11), rx.lost());
+  assertEqual(uint64_t(1), rx.damaged());
+}
+
+unittest_main()
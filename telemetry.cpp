@@ -0,0 +1,84 @@
+// telemetry.cpp
+#include "telemetry.h"
+#include "heaterControl.h"
+#include "log.h"
+
+// Quarter degrees, as the log stores them
+static int16_t quarterDegrees(float degrees) {
+  float t = degrees * 4;
+  return (t > -32767 && t < 32767) ? (int16_t)lroundf(t) : Log::NO_TEMPERATURE;
+}
+
+void Telemetry::send(Print &out, HeaterControl &heater, Log &logger,
+                     const float *temperatures, uint8_t numSensors,
+                     uint8_t status) {
+  if (numSensors > MAX_SENSORS)
+    numSensors = MAX_SENSORS;
+  uint8_t frame[MAX_FRAME];
+  uint8_t n = 0;
+  auto put = [&](const void *src, uint8_t size) {
+    memcpy(frame + n, src, size);
+    n += size;
+  };
+
+  bool logging = logger.isLoggingEnabled();
+  uint8_t flags = status & (Log::HEATER_ENABLED | Log::HEATING |
+                            Log::SENSOR_ERROR);
+  if (logging)
+    flags |= LOGGING;
+#ifdef DEBUG
+  flags |= STATS;
+#endif
+  frame[n++] = VERSION;
+  frame[n++] = seq++;
+  frame[n++] = flags;
+  uint32_t timestamp = logger.getTimestamp();
+  put(&timestamp, sizeof(timestamp));
+  int16_t target = quarterDegrees(heater.getTargetTemperature());
+  put(&target, sizeof(target));
+  uint32_t minutes = heater.getTimeUntilDisable() / 60000;
+  uint16_t untilDisable = minutes > 0xFFFF ? 0xFFFF : minutes;
+  put(&untilDisable, sizeof(untilDisable));
+  uint32_t fileId = logging ? logger.getFileId() : 0;
+  put(&fileId, sizeof(fileId));
+  frame[n++] = numSensors;
+  for (uint8_t i = 0; i < numSensors; i++) {
+    int16_t q = quarterDegrees(temperatures[i]);
+    put(&q, sizeof(q));
+  }
+#ifdef DEBUG
+  uint32_t maxLogMicros = logger.getMaxLogMicros();
+  put(&maxLogMicros, sizeof(maxLogMicros));
+  frame[n++] = logger.getQueueDepth();
+  uint32_t maxWaitAvoided = logger.getMaxWaitAvoided();
+  put(&maxWaitAvoided, sizeof(maxWaitAvoided));
+#endif
+  uint16_t crc = Log::crc16(0xFFFF, frame, n);
+  put(&crc, sizeof(crc));
+
+  // Delimiter, the frame with one code byte added, delimiter
+  uint8_t wire[MAX_FRAME + 3];
+  wire[0] = 0;
+  uint8_t len = 1 + cobsEncode(frame, n, wire + 1);
+  wire[len++] = 0;
+  out.write(wire, len);
+}
+
+// Consistent Overhead Byte Stuffing: every zero byte is replaced by the
+// distance to the next one, with a code byte in front for the first. n is
+// less than 254, so there is only one code byte. Returns the encoded size,
+// n + 1.
+uint8_t Telemetry::cobsEncode(const uint8_t *in, uint8_t n, uint8_t *out) {
+  uint8_t code = 0; // where the distance to the next zero goes
+  uint8_t o = 1;
+  for (uint8_t i = 0; i < n; i++) {
+    if (in[i] == 0) {
+      out[code] = o - code;
+      code = o++;
+    } else {
+      out[o++] = in[i];
+    }
+  }
+  out[code] = o - code;
+  return o;
+}
@@ -0,0 +1,57 @@
+#ifndef TELEMETRY_H
+#define TELEMETRY_H
+
+#include <Arduino.h>
+
+class HeaterControl;
+class Log;
+
+// Send the status of each second as a binary frame instead of a line of text.
+// A frame is about 22 bytes where the text is about 120, so it fits the 64
+// byte TX buffer and loop() never waits for the serial port. Read it with
+// templog telemetry on the host.
+#ifndef TELEMETRY_BINARY
+#define TELEMETRY_BINARY 0
+#endif
+
+// Telemetry frame, version 1, little endian:
+//   version (uint8_t)
+//   sequence number (uint8_t), counts the frames, to spot lost ones
+//   flags (uint8_t): the HEATER_ENABLED, HEATING and SENSOR_ERROR bits of
+//     Log, LOGGING and STATS below
+//   timestamp (uint32_t), packed RTC time as in the log
+//   target temperature (int16_t)
+//   time until the heater is auto-disabled (uint16_t), minutes
+//   file id of the log file (uint32_t), its start timestamp; 0 when not
+//     logging
+//   numSensors (uint8_t) and numSensors temperatures (int16_t)
+//   with STATS: Log::getMaxLogMicros() (uint32_t), Log::getQueueDepth()
+//     (uint8_t), Log::getMaxWaitAvoided() (uint32_t)
+//   crc (uint16_t), CRC-16/CCITT as Log::crc16() over the bytes before it
+// Temperatures are in quarter degrees, NO_TEMPERATURE without a reading.
+//
+// On the wire the frame is COBS encoded, so it holds no zero bytes, with a
+// zero byte before and after it. Text printed by other code ends up between
+// two frames, and the receiver finds the next frame after it.
+class Telemetry {
+public:
+  static const uint8_t VERSION = 1;
+  static const uint8_t LOGGING = 0x08; // a log file is open
+  static const uint8_t STATS = 0x10;   // the logger statistics follow
+  static const uint8_t MAX_SENSORS = 4;
+
+  // Send a frame with the state of heater and logger and numSensors
+  // temperatures, at most MAX_SENSORS. status holds the HEATER_ENABLED,
+  // HEATING and SENSOR_ERROR bits as passed to Log::logData().
+  void send(Print &out, HeaterControl &heater, Log &logger,
+            const float *temperatures, uint8_t numSensors, uint8_t status);
+
+private:
+  // Frame and crc, with the statistics and all sensors
+  static const uint8_t MAX_FRAME = 18 + 2 * MAX_SENSORS + 9 + 2;
+  uint8_t seq = 0;
+
+  static uint8_t cobsEncode(const uint8_t *in, uint8_t n, uint8_t *out);
+};
+
+#endif
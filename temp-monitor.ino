@@ -7,6 +7,8 @@
 #include "I2C_LCD.h"
 #include "log.h"
 #include "menu.h"
+#include "profile.h"
+#include "telemetry.h"
 // #include "tempReader.h"
 #include <MAX6675.h>
 
@@ -54,11 +56,15 @@ I2C_LCD lcd(0x27);
 HeaterControl heaterControl(HEATER_PIN);
 Log logger(ThermoCouplesNum );
 Menu menu(ENCODER_PIN_A, ENCODER_PIN_B, ENCODER_BUTTON_PIN);
+#if TELEMETRY_BINARY
+Telemetry telemetry;
+#endif
 // MAX6675 thermoCouple(MAX6675_CS_PINS[0], SPI_MISO_PIN , SPI_SCK_PIN);
 MAX6675 thermoCouple(MAX6675_CS_PINS[0], &SPI);
 
 
 float getTemperature() {
+  PROFILE(SENSOR);
   int status = thermoCouple.read();
   if (status != STATUS_OK) {Serial.println(F("ThermoCouple ERROR!"));}
   return thermoCouple.getTemperature();
@@ -112,52 +118,99 @@ void setup() {
 }
 
 void loop() {
-  // Update the menu, handle button presses and rotary encoder inputs
-  menu.update();
+#if LOOP_PROFILE
+  profiler.poll(Serial);
+#endif
+  PROFILE(LOOP);
+  {
+    PROFILE(MENU);
+    // Update the menu, handle button presses and rotary encoder inputs
+    menu.update();
+  }
+  {
+    PROFILE(LOG_UPDATE);
+    // Write buffered log data and syncs while the SD card is idle
+    if (logger.update() != 0)
+      displayError(logger);
+  }
 
   unsigned long currentMillis = millis();
   if (currentMillis - previousMillis >= interval) {
 
     float currentTemp = getTemperature();
-    // Update the heater control logic using the first thermocouple as input
-    heaterControl.update(currentTemp);
+    {
+      PROFILE(HEATER);
+      // Update the heater control logic using the first thermocouple as input
+      heaterControl.update(currentTemp);
+    }
 
     float targetTemp = heaterControl.getTargetTemperature();
 
-    // Display default screen when menu is not active
-    menu.displayDefaultScreen(currentTemp, targetTemp);
+    {
+      PROFILE(LCD);
+      // Display default screen when menu is not active
+      menu.displayDefaultScreen(currentTemp, targetTemp);
+    }
 
     bool heaterEnabled = heaterControl.getHeaterEnabled();
     bool heaterStatus = heaterControl.getHeaterStatus();
-    uint32_t autoDisableTime = heaterControl.getTimeUntilDisable();
-    uint8_t hours, minutes;
-    getHoursAndMinutes(autoDisableTime, hours, minutes);
-
-    // Optional: Log the status or display it on an LCD
-    Serial.print(F("Target °C:, "));
-    Serial.print(targetTemp);
-    Serial.print(F(" Current: "));
-    Serial.print(currentTemp);
-    Serial.print(F(" Heater: "));
-    Serial.print(heaterEnabled ? "ON" : "OFF");
-    Serial.print(F(" Heating: "));
-    Serial.print(heaterStatus ? "ON" : "OFF");
-    Serial.print(F(" Auto-disable: "));
-    Serial.print(hours);
-    Serial.print(F("h "));
-    Serial.print(minutes);
-    Serial.print(F("m"));
-    Serial.print(F(" Log "));
-    Serial.print(logger.isLoggingEnabled() ? "ON " : "OFF ");
-    Serial.print(logger.getLogFileName());
-    Serial.println();
+    float temperatures[NUM_THERMOCOUPLES] = { currentTemp};
+    uint8_t status = 0;
+    if (heaterEnabled) status |= Log::HEATER_ENABLED;
+    if (heaterStatus) status |= Log::HEATING;
+    if (thermoCouple.getStatus() != STATUS_OK) status |= Log::SENSOR_ERROR;
+
+    {
+      PROFILE(STATUS);
+#if TELEMETRY_BINARY
+      telemetry.send(Serial, heaterControl, logger, temperatures,
+                     NUM_THERMOCOUPLES, status);
+#else
+      uint32_t autoDisableTime = heaterControl.getTimeUntilDisable();
+      uint8_t hours, minutes;
+      getHoursAndMinutes(autoDisableTime, hours, minutes);
+
+      // Optional: Log the status or display it on an LCD
+      Serial.print(F("Target °C:, "));
+      Serial.print(targetTemp);
+      Serial.print(F(" Current: "));
+      Serial.print(currentTemp);
+      Serial.print(F(" Heater: "));
+      Serial.print(heaterEnabled ? "ON" : "OFF");
+      Serial.print(F(" Heating: "));
+      Serial.print(heaterStatus ? "ON" : "OFF");
+      Serial.print(F(" Auto-disable: "));
+      Serial.print(hours);
+      Serial.print(F("h "));
+      Serial.print(minutes);
+      Serial.print(F("m"));
+      Serial.print(F(" Log "));
+      Serial.print(logger.isLoggingEnabled() ? "ON " : "OFF ");
+      Serial.print(logger.getLogFileName());
+#ifdef DEBUG
+      // Worst case SD logging latency seen so far
+      Serial.print(F(" Log max: "));
+      Serial.print(logger.getMaxLogMicros());
+      Serial.print(F("us"));
+      // Sectors waiting for the card, and the longest wait that saved loop()
+      Serial.print(F(" Queue: "));
+      Serial.print(logger.getQueueDepth());
+      Serial.print(F(" Wait avoided: "));
+      Serial.print(logger.getMaxWaitAvoided());
+      Serial.print(F("us"));
+#endif
+      Serial.println();
+#endif // TELEMETRY_BINARY
+    }
 
     previousMillis = currentMillis;
 
-    float temperatures[NUM_THERMOCOUPLES] = { currentTemp};
-    // Log the current temperatures and heater status to the SD card
-    if (logger.logData(temperatures, heaterEnabled) != 0)
-      displayError(logger);
+    {
+      PROFILE(LOG_DATA);
+      // Log the current temperatures and heater status to the SD card
+      if (logger.logData(temperatures, status) != 0)
+        displayError(logger);
+    }
   }
 
 }